@@ -0,0 +1,249 @@
+/*
+ * account_directory.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "account_directory.h"
+#include <algorithm>
+#include <cstring>
+
+AccountDirectory::AccountDirectory() : root(new Node(true)), entries(0) {}
+
+AccountDirectory::AccountDirectory(std::vector<Entry>& sorted) : root(nullptr), entries(sorted.size()) {
+	// Full leaves, then full inner levels over them, up to a single root
+	std::vector<Node*> level;
+	for (size_t i = 0; i < sorted.size(); i += DIRECTORY_NODE_SLOTS) {
+		Node* leaf = new Node(true);
+		for (size_t j = i; j < sorted.size() && leaf->count < DIRECTORY_NODE_SLOTS; ++j) {
+			leaf->keys[leaf->count] = sorted[j].first;
+			leaf->accounts[leaf->count++] = sorted[j].second;
+		}
+		level.push_back(leaf);
+	}
+	while (level.size() > 1) {
+		std::vector<Node*> parents;
+		for (size_t i = 0; i < level.size(); i += DIRECTORY_NODE_SLOTS) {
+			Node* parent = new Node(false);
+			for (size_t j = i; j < level.size() && parent->count < DIRECTORY_NODE_SLOTS; ++j) {
+				parent->keys[parent->count] = level[j]->keys[0];
+				parent->children[parent->count++] = level[j];
+			}
+			parents.push_back(parent);
+		}
+		level.swap(parents);
+	}
+	root = level.empty() ? new Node(true) : level[0];
+	std::vector<Entry>().swap(sorted); // The tree holds the entries now, the caller gets the vector back empty
+}
+
+AccountDirectory::~AccountDirectory() {
+	release(root);
+}
+
+void AccountDirectory::release(Node* node) {
+	if (node->refs.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+		return; // Still part of another version
+	}
+	if (!node->leaf) {
+		for (int i = 0; i < node->count; ++i) {
+			release(node->children[i]);
+		}
+	}
+	delete node;
+}
+
+AccountDirectory::Node* AccountDirectory::share(Node* node) {
+	node->refs.fetch_add(1, std::memory_order_relaxed);
+	return node;
+}
+
+AccountDirectory::Node* AccountDirectory::copy(const Node* node) {
+	Node* copy = new Node(node->leaf);
+	copy->count = node->count;
+	std::memcpy(copy->keys, node->keys, node->count * sizeof(int));
+	for (int i = 0; i < node->count; ++i) {
+		if (node->leaf) {
+			copy->accounts[i] = node->accounts[i];
+		} else {
+			copy->children[i] = share(node->children[i]);
+		}
+	}
+	return copy;
+}
+
+int AccountDirectory::childFor(const Node* node, int id) {
+	// The last child whose smallest id is at most `id`, the first one for a smaller id
+	const int* after = std::upper_bound(node->keys, node->keys + node->count, id);
+	return after == node->keys ? 0 : static_cast<int>(after - node->keys) - 1;
+}
+
+Account* AccountDirectory::find(int id) const {
+	const Node* node = root;
+	while (!node->leaf) {
+		node = node->children[childFor(node, id)];
+	}
+	const int* key = std::lower_bound(node->keys, node->keys + node->count, id);
+	if (key == node->keys + node->count || *key != id) {
+		return nullptr;
+	}
+	return node->accounts[key - node->keys];
+}
+
+AccountDirectory::Node* AccountDirectory::insert(const Node* node, int id, Account* account, Node*& split,
+		bool& added) {
+	split = nullptr;
+	int keys[DIRECTORY_NODE_SLOTS + 1];
+	Node* children[DIRECTORY_NODE_SLOTS + 1];
+	Account* accounts[DIRECTORY_NODE_SLOTS + 1];
+	int count;
+
+	if (node->leaf) {
+		int pos = static_cast<int>(std::lower_bound(node->keys, node->keys + node->count, id) - node->keys);
+		if (pos < node->count && node->keys[pos] == id) {
+			added = false;
+			Node* replaced = copy(node);
+			replaced->accounts[pos] = account;
+			return replaced;
+		}
+		added = true;
+		std::memcpy(keys, node->keys, pos * sizeof(int));
+		std::memcpy(accounts, node->accounts, pos * sizeof(Account*));
+		keys[pos] = id;
+		accounts[pos] = account;
+		std::memcpy(keys + pos + 1, node->keys + pos, (node->count - pos) * sizeof(int));
+		std::memcpy(accounts + pos + 1, node->accounts + pos, (node->count - pos) * sizeof(Account*));
+		count = node->count + 1;
+	} else {
+		int pos = childFor(node, id);
+		Node* childSplit;
+		Node* child = insert(node->children[pos], id, account, childSplit, added);
+		count = 0;
+		for (int i = 0; i < node->count; ++i) {
+			if (i == pos) {
+				keys[count] = child->keys[0];
+				children[count++] = child;
+				if (childSplit != nullptr) {
+					keys[count] = childSplit->keys[0];
+					children[count++] = childSplit;
+				}
+			} else {
+				keys[count] = node->keys[i];
+				children[count++] = share(node->children[i]);
+			}
+		}
+	}
+
+	// Split an overflowing node in two halves
+	int kept = count <= DIRECTORY_NODE_SLOTS ? count : count / 2;
+	Node* result = new Node(node->leaf);
+	for (int i = 0; i < count; ++i) {
+		Node* target = result;
+		if (i >= kept) {
+			if (split == nullptr) {
+				split = new Node(node->leaf);
+			}
+			target = split;
+		}
+		target->keys[target->count] = keys[i];
+		if (node->leaf) {
+			target->accounts[target->count++] = accounts[i];
+		} else {
+			target->children[target->count++] = children[i];
+		}
+	}
+	return result;
+}
+
+AccountDirectory::Node* AccountDirectory::remove(const Node* node, int id) {
+	Node* result = new Node(node->leaf);
+	if (node->leaf) {
+		for (int i = 0; i < node->count; ++i) {
+			if (node->keys[i] != id) {
+				result->keys[result->count] = node->keys[i];
+				result->accounts[result->count++] = node->accounts[i];
+			}
+		}
+	} else {
+		int pos = childFor(node, id);
+		for (int i = 0; i < node->count; ++i) {
+			Node* child = i == pos ? remove(node->children[i], id) : share(node->children[i]);
+			if (child != nullptr) { // An emptied child is dropped, no merging
+				result->keys[result->count] = child->keys[0];
+				result->children[result->count++] = child;
+			}
+		}
+	}
+	if (result->count == 0) {
+		delete result;
+		return nullptr;
+	}
+	return result;
+}
+
+AccountDirectory* AccountDirectory::with(int id, Account* account) const {
+	Node* split;
+	bool added;
+	Node* next = insert(root, id, account, split, added);
+	if (split != nullptr) {
+		Node* grown = new Node(false);
+		grown->keys[0] = next->keys[0];
+		grown->children[0] = next;
+		grown->keys[1] = split->keys[0];
+		grown->children[1] = split;
+		grown->count = 2;
+		next = grown;
+	}
+	return new AccountDirectory(next, entries + (added ? 1 : 0));
+}
+
+AccountDirectory* AccountDirectory::without(int id) const {
+	if (find(id) == nullptr) {
+		return new AccountDirectory(share(root), entries);
+	}
+	Node* next = remove(root, id);
+	if (next == nullptr) {
+		next = new Node(true);
+	}
+	// A root left with one child gives way to it
+	while (!next->leaf && next->count == 1) {
+		Node* child = share(next->children[0]);
+		release(next);
+		next = child;
+	}
+	return new AccountDirectory(next, entries - 1);
+}
+
+AccountDirectory::const_iterator AccountDirectory::begin() const {
+	const_iterator it;
+	it.descend(root);
+	return it;
+}
+
+void AccountDirectory::const_iterator::descend(const Node* node) {
+	while (true) {
+		path[depth] = node;
+		index[depth++] = 0;
+		if (node->leaf) {
+			break;
+		}
+		node = node->children[0];
+	}
+	if (node->count == 0) {
+		depth = 0; // Only the root of an empty directory is an empty leaf
+	}
+}
+
+AccountDirectory::const_iterator& AccountDirectory::const_iterator::operator++() {
+	while (depth > 0) {
+		const Node* node = path[depth - 1];
+		if (++index[depth - 1] < node->count) {
+			if (!node->leaf) {
+				descend(node->children[index[depth - 1]]);
+			}
+			return *this;
+		}
+		depth--; // Done with this node, on to the next child of its parent
+	}
+	return *this;
+}
@@ -0,0 +1,102 @@
+/*
+ * account_directory.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ACCOUNT_DIRECTORY_H_
+#define ACCOUNT_DIRECTORY_H_
+
+#include <vector>
+#include <utility>
+#include <atomic>
+#include <cstddef>
+
+class Account;
+
+#define DIRECTORY_NODE_SLOTS 32 // Entries of a leaf, children of an inner node
+#define DIRECTORY_MAX_DEPTH 12  // Splits keep nodes half full, so 2^31 ids fit in 9 levels
+
+// Immutable id -> Account map, sorted by id. A change builds a new directory
+// that the bank publishes atomically, so lookups never take a lock; the old
+// version is retired through the epoch domain.
+//
+// The map is a B+ tree whose nodes the versions share: a change copies only the
+// nodes on the path to its id (path copying), so it costs O(log N) instead of a
+// copy of every entry. Nodes are reference counted by the directories and parent
+// nodes that point to them. A delete does not merge nodes, it only drops the ones
+// it leaves empty.
+class AccountDirectory {
+public:
+	typedef std::pair<int, Account*> Entry;
+
+private:
+	struct Node {
+		std::atomic<int> refs; // Parents and directories pointing to it
+		bool leaf;
+		int count;
+		int keys[DIRECTORY_NODE_SLOTS]; // Leaf: the ids; inner: the smallest id under each child
+		union {
+			Account* accounts[DIRECTORY_NODE_SLOTS];
+			Node* children[DIRECTORY_NODE_SLOTS];
+		};
+
+		explicit Node(bool leaf) : refs(1), leaf(leaf), count(0) {}
+	};
+
+	Node* root;
+	size_t entries;
+
+	explicit AccountDirectory(Node* root, size_t entries) : root(root), entries(entries) {}
+	AccountDirectory(const AccountDirectory&);            // Not copyable, versions share nodes instead
+	AccountDirectory& operator=(const AccountDirectory&);
+
+	static void release(Node* node);
+	static Node* share(Node* node);
+	static Node* copy(const Node* node); // Shares the children of an inner node
+	// The copy of `node` with the entry set, and the new right sibling if it had to split
+	static Node* insert(const Node* node, int id, Account* account, Node*& split, bool& added);
+	static Node* remove(const Node* node, int id); // The copy without the entry, nullptr if left empty
+	static int childFor(const Node* node, int id);
+
+public:
+	// Walks the leaves in id order, yielding entries by value
+	class const_iterator {
+	private:
+		const Node* path[DIRECTORY_MAX_DEPTH];
+		int index[DIRECTORY_MAX_DEPTH];
+		int depth; // 0 at the end
+
+		void descend(const Node* node); // To the first entry under `node`
+		friend class AccountDirectory;
+
+	public:
+		const_iterator() : depth(0) {}
+		Entry operator*() const {
+			const Node* leaf = path[depth - 1];
+			return Entry(leaf->keys[index[depth - 1]], leaf->accounts[index[depth - 1]]);
+		}
+		const_iterator& operator++();
+		bool operator==(const const_iterator& other) const {
+			return depth == other.depth && (depth == 0 ||
+					(path[depth - 1] == other.path[depth - 1] && index[depth - 1] == other.index[depth - 1]));
+		}
+		bool operator!=(const const_iterator& other) const { return !(*this == other); }
+	};
+
+	AccountDirectory();
+	explicit AccountDirectory(std::vector<Entry>& sorted); // Takes entries sorted by id
+	~AccountDirectory();
+
+	Account* find(int id) const; // nullptr if missing
+
+	AccountDirectory* with(int id, Account* account) const; // Copy with the account added or replaced
+	AccountDirectory* without(int id) const;                // Copy without the account
+
+	size_t size() const { return entries; }
+	const_iterator begin() const;
+	const_iterator end() const { return const_iterator(); }
+};
+
+#endif /* ACCOUNT_DIRECTORY_H_ */
@@ -0,0 +1,159 @@
+/*
+ * account_history.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "account_history.h"
+
+AccountHistory::AccountHistory(size_t depth) : depth(depth) {}
+
+AccountHistory::~AccountHistory() {
+	for (auto& pair : rings) {
+		pthread_mutex_destroy(&pair.second->mutex);
+		delete pair.second;
+	}
+}
+
+void AccountHistory::append(int accountId, const HistoryEntry& entry) {
+	lock.acquireReadLock();
+	auto it = rings.find(accountId);
+	Ring* ring = it == rings.end() ? nullptr : it->second;
+	lock.releaseReadLock();
+
+	if (ring == nullptr) {
+		// First change of the account, or one brought back by a restore
+		lock.acquireWriteLock();
+		Ring*& slot = rings[accountId];
+		if (slot == nullptr) {
+			slot = new Ring();
+			pthread_mutex_init(&slot->mutex, nullptr);
+			slot->next = 0;
+		}
+		ring = slot;
+		lock.releaseWriteLock();
+	}
+
+	// The ring cannot go away here: forget() only runs once the account is closed under its own lock
+	pthread_mutex_lock(&ring->mutex);
+	if (ring->entries.size() < depth) {
+		ring->entries.push_back(entry);
+	} else {
+		ring->entries[ring->next] = entry;
+		ring->next = (ring->next + 1) % depth;
+	}
+	pthread_mutex_unlock(&ring->mutex);
+}
+
+void AccountHistory::record(const TxEvent& event) {
+	if (depth == 0) {
+		return;
+	}
+
+	HistoryEntry entry;
+	entry.timestamp = event.timestamp;
+	entry.type = event.type;
+	entry.otherId = 0;
+	entry.balance = event.balance;
+
+	switch (event.type) {
+	case TX_ACCOUNT_OPENED:
+		entry.amount = event.balance;
+		break;
+	case TX_DEPOSIT:
+		entry.amount = event.detail.op.amount;
+		break;
+	case TX_WITHDRAW:
+		entry.amount = -event.detail.op.amount;
+		break;
+	case TX_COMMISSION:
+		entry.amount = -event.detail.op.amount;
+		entry.balance = event.balance;
+		break;
+	case TX_TRANSFER: {
+		entry.amount = -event.detail.op.amount;
+		entry.otherId = event.detail.op.otherId;
+		append(event.accountId, entry);
+
+		// The credit side goes into the destination's history
+		HistoryEntry credit = entry;
+		credit.amount = event.detail.op.amount;
+		credit.balance = event.detail.op.otherBalance;
+		credit.otherId = event.accountId;
+		append(event.detail.op.otherId, credit);
+		return;
+	}
+	default:
+		return; // Queries, errors and bank events do not change an account
+	}
+	append(event.accountId, entry);
+}
+
+void AccountHistory::recordSide(const TxEvent& transfer, int accountId) {
+	if (depth == 0) {
+		return;
+	}
+
+	HistoryEntry entry;
+	entry.timestamp = transfer.timestamp;
+	entry.type = transfer.type;
+	if (accountId == transfer.accountId) {
+		entry.amount = -transfer.detail.op.amount;
+		entry.balance = transfer.balance;
+		entry.otherId = transfer.detail.op.otherId;
+	} else {
+		entry.amount = transfer.detail.op.amount;
+		entry.balance = transfer.detail.op.otherBalance;
+		entry.otherId = transfer.accountId;
+	}
+	append(accountId, entry);
+}
+
+void AccountHistory::restored(int accountId, int change, int balance, int64_t timestamp) {
+	if (depth == 0) {
+		return;
+	}
+	HistoryEntry entry;
+	entry.timestamp = timestamp;
+	entry.amount = change;
+	entry.balance = balance;
+	entry.otherId = 0;
+	entry.type = TX_ROLLBACK;
+	append(accountId, entry);
+}
+
+void AccountHistory::forget(int accountId) {
+	lock.acquireWriteLock();
+	auto it = rings.find(accountId);
+	if (it != rings.end()) {
+		pthread_mutex_destroy(&it->second->mutex);
+		delete it->second;
+		rings.erase(it);
+	}
+	lock.releaseWriteLock();
+}
+
+size_t AccountHistory::latest(int accountId, size_t count, std::vector<HistoryEntry>& out) {
+	out.clear();
+	lock.acquireReadLock();
+	auto it = rings.find(accountId);
+	if (it == rings.end()) {
+		lock.releaseReadLock();
+		return 0;
+	}
+	Ring* ring = it->second;
+	pthread_mutex_lock(&ring->mutex);
+	lock.releaseReadLock();
+
+	size_t size = ring->entries.size();
+	if (count > size) {
+		count = size;
+	}
+	// Entries are oldest first starting at `next` once the ring has wrapped
+	size_t oldest = size < depth ? 0 : ring->next;
+	for (size_t i = size - count; i < size; ++i) {
+		out.push_back(ring->entries[(oldest + i) % size]);
+	}
+	pthread_mutex_unlock(&ring->mutex);
+	return count;
+}
@@ -0,0 +1,61 @@
+/*
+ * account_history.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ACCOUNT_HISTORY_H_
+#define ACCOUNT_HISTORY_H_
+
+#include <map>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+#include "read_write_lock.h"
+#include "tx_log.h"
+
+// One change to an account, as kept by AccountHistory
+struct HistoryEntry {
+	int64_t timestamp; // Wall clock time in nanoseconds
+	int32_t amount;    // Change of the balance, negative for money leaving the account
+	int32_t balance;   // Balance right after the change
+	int32_t otherId;   // Counterparty account of a transfer
+	int32_t type;      // TxEventType of the change
+};
+
+// Per-account append-only history of balance changes, fed from the transaction log events.
+// Each account keeps its last `depth` entries in a ring, so memory is bounded by
+// accounts * depth * sizeof(HistoryEntry) and reading the last N entries is O(N).
+class AccountHistory {
+private:
+	struct Ring {
+		pthread_mutex_t mutex;
+		std::vector<HistoryEntry> entries; // Grows up to `depth`, then wraps
+		size_t next;                       // Slot of the next entry once full
+	};
+
+	size_t depth;
+	std::map<int, Ring*> rings;
+	ReadWriteLock lock; // Protects the map, each ring has its own mutex
+
+	void append(int accountId, const HistoryEntry& entry);
+
+public:
+	AccountHistory(size_t depth);
+	~AccountHistory();
+
+	void record(const TxEvent& event); // Adds the entries an event implies, ignores the rest
+	void recordSide(const TxEvent& transfer, int accountId); // Only the entry of one side of a transfer
+	void forget(int accountId);        // Drops the history of a closed account
+	// Marks a rollback that set the balance, by `change`, under the account lock like any change
+	void restored(int accountId, int change, int balance, int64_t timestamp);
+
+	// Copies up to `count` of the latest entries, oldest first, returns how many were copied
+	size_t latest(int accountId, size_t count, std::vector<HistoryEntry>& out);
+
+	bool enabled() const { return depth > 0; }
+};
+
+#endif /* ACCOUNT_HISTORY_H_ */
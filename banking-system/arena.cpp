@@ -0,0 +1,81 @@
+/*
+ * arena.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "arena.h"
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// Block header size rounded so that the data after it is maximally aligned
+static const size_t HEADER_SIZE = (sizeof(void*) * 3 + alignof(std::max_align_t) - 1)
+		& ~(alignof(std::max_align_t) - 1);
+
+Arena::Arena(size_t blockSize) : head(nullptr), blockSize(blockSize) {}
+
+Arena::~Arena() {
+	while (head != nullptr) {
+		Block* next = head->next;
+		std::free(head);
+		head = next;
+	}
+}
+
+void* Arena::allocate(size_t bytes, size_t align) {
+	if (head != nullptr) {
+		size_t offset = (head->used + align - 1) & ~(align - 1);
+		if (offset + bytes <= head->size) {
+			head->used = offset + bytes;
+			return reinterpret_cast<char*>(head) + HEADER_SIZE + offset;
+		}
+	}
+
+	// Start a new block big enough for the request
+	size_t size = bytes + align > blockSize ? bytes + align : blockSize;
+	Block* block = static_cast<Block*>(std::malloc(HEADER_SIZE + size));
+	if (block == nullptr) {
+		throw std::bad_alloc();
+	}
+	block->next = head;
+	block->size = size;
+	block->used = 0;
+	head = block;
+	return allocate(bytes, align);
+}
+
+const char* Arena::copyString(const std::string& str) {
+	char* copy = static_cast<char*>(allocate(str.size() + 1, 1));
+	std::memcpy(copy, str.c_str(), str.size() + 1);
+	return copy;
+}
+
+void Arena::reset() {
+	if (head == nullptr) {
+		return;
+	}
+	if (head->next == nullptr) {
+		head->used = 0;
+		return;
+	}
+
+	// Several blocks were needed, replace them by one that fits the whole round
+	size_t total = reserved();
+	while (head != nullptr) {
+		Block* next = head->next;
+		std::free(head);
+		head = next;
+	}
+	if (total > blockSize) {
+		blockSize = total;
+	}
+}
+
+size_t Arena::reserved() const {
+	size_t total = 0;
+	for (Block* block = head; block != nullptr; block = block->next) {
+		total += block->size;
+	}
+	return total;
+}
@@ -0,0 +1,46 @@
+/*
+ * arena.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <cstddef>
+#include <string>
+
+// Bump allocator. Memory is handed out from large blocks and released all at
+// once by reset(), which keeps the storage for the next round of allocations.
+// Only trivially destructible data may live in an arena.
+class Arena {
+private:
+	struct Block {
+		Block* next;
+		size_t size; // Usable bytes after the header
+		size_t used;
+	};
+
+	Block* head;      // Block currently being filled, newest first
+	size_t blockSize; // Minimum size of a new block
+
+	Arena(const Arena&);            // Not copyable
+	Arena& operator=(const Arena&);
+
+public:
+	explicit Arena(size_t blockSize = 4096);
+	~Arena();
+
+	void* allocate(size_t bytes, size_t align);
+	const char* copyString(const std::string& str); // NUL terminated copy
+	void reset();             // Frees everything allocated so far in one shot
+	size_t reserved() const;  // Bytes held from the heap
+
+	template <typename T>
+	T* allocateArray(size_t count) {
+		return static_cast<T*>(allocate(sizeof(T) * count, alignof(T)));
+	}
+};
+
+#endif /* ARENA_H_ */
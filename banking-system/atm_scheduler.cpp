@@ -0,0 +1,139 @@
+/*
+ * atm_scheduler.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "atm_scheduler.h"
+#include "banking_system.h"
+#include <algorithm>
+#include <time.h>
+
+long long monotonicMicros() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return static_cast<long long>(ts.tv_sec) * 1000000LL + ts.tv_nsec / 1000;
+}
+
+AtmScheduler::AtmScheduler(size_t numThreads) : running(true) {
+	pthread_mutex_init(&mutex, nullptr);
+
+	// Timers are absolute monotonic deadlines, so the condition variable uses the same clock
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+	pthread_condattr_destroy(&attr);
+
+	for (size_t i = 0; i < numThreads; ++i) {
+		pthread_t thread;
+		pthread_create(&thread, nullptr, worker, this);
+		ThreadPlacement::instance().place(thread, THREAD_ATM, i, "atm scheduler " + std::to_string(i));
+		threads.push_back(thread);
+	}
+}
+
+AtmScheduler::~AtmScheduler() {
+	pthread_mutex_lock(&mutex);
+	running = false;
+	pthread_cond_broadcast(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	for (pthread_t thread : threads) {
+		pthread_join(thread, nullptr);
+	}
+
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void AtmScheduler::pushTimer(ATM* atm, long long due) {
+	// A new generation makes any timer already queued for this ATM stale
+	Timer timer = {due, atm, ++atm->scheduleGen};
+	timers.push_back(timer);
+	std::push_heap(timers.begin(), timers.end());
+	pthread_cond_signal(&cond);
+}
+
+void AtmScheduler::dropTimers(ATM* atm) {
+	size_t kept = 0;
+	for (size_t i = 0; i < timers.size(); ++i) {
+		if (timers[i].atm != atm) {
+			timers[kept++] = timers[i];
+		}
+	}
+	timers.resize(kept);
+	std::make_heap(timers.begin(), timers.end());
+}
+
+void AtmScheduler::schedule(ATM* atm, long delayMicros) {
+	pthread_mutex_lock(&mutex);
+	atm->scheduleDone = false;
+	pushTimer(atm, monotonicMicros() + delayMicros);
+	pthread_mutex_unlock(&mutex);
+}
+
+void AtmScheduler::wake(ATM* atm) {
+	pthread_mutex_lock(&mutex);
+	if (!atm->scheduleDone) {
+		if (atm->inStep) {
+			atm->wakePending = true; // The worker stepping it will reschedule immediately
+		} else {
+			pushTimer(atm, monotonicMicros());
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void* AtmScheduler::worker(void* arg) {
+	AtmScheduler* scheduler = static_cast<AtmScheduler*>(arg);
+
+	pthread_mutex_lock(&scheduler->mutex);
+	while (scheduler->running) {
+		if (scheduler->timers.empty()) {
+			pthread_cond_wait(&scheduler->cond, &scheduler->mutex);
+			continue;
+		}
+
+		// Sleep until the earliest timer expires or an earlier one is added
+		Timer timer = scheduler->timers.front();
+		if (timer.due > monotonicMicros()) {
+			struct timespec deadline;
+			deadline.tv_sec = timer.due / 1000000LL;
+			deadline.tv_nsec = (timer.due % 1000000LL) * 1000;
+			pthread_cond_timedwait(&scheduler->cond, &scheduler->mutex, &deadline);
+			continue;
+		}
+
+		std::pop_heap(scheduler->timers.begin(), scheduler->timers.end());
+		scheduler->timers.pop_back();
+
+		ATM* atm = timer.atm;
+		if (timer.gen != atm->scheduleGen) {
+			continue; // Superseded by a wake-up
+		}
+		atm->inStep = true;
+		atm->wakePending = false;
+		pthread_mutex_unlock(&scheduler->mutex);
+
+		long delay = atm->step();
+
+		pthread_mutex_lock(&scheduler->mutex);
+		atm->inStep = false;
+		if (delay < 0) {
+			// The ATM may be deleted as soon as it is marked finished, so forget it first
+			atm->scheduleDone = true;
+			scheduler->dropTimers(atm);
+			pthread_mutex_unlock(&scheduler->mutex);
+			atm->markFinished();
+			pthread_mutex_lock(&scheduler->mutex);
+			continue;
+		}
+		if (atm->wakePending) {
+			delay = 0;
+		}
+		scheduler->pushTimer(atm, monotonicMicros() + delay);
+	}
+	pthread_mutex_unlock(&scheduler->mutex);
+	return nullptr;
+}
@@ -0,0 +1,53 @@
+/*
+ * atm_scheduler.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ATM_SCHEDULER_H_
+#define ATM_SCHEDULER_H_
+
+#include <vector>
+#include <pthread.h>
+
+class ATM;
+
+// Current time on the monotonic clock in microseconds
+long long monotonicMicros();
+typedef long long (*MonotonicClock)(); // monotonicMicros, or a clock a test steps by hand
+
+// Multiplexes many ATM state machines on a small pool of threads.
+// Each ATM is stepped by one worker at a time, and the delay returned by
+// ATM::step() is turned into a timer instead of a blocking sleep.
+class AtmScheduler {
+private:
+	struct Timer {
+		long long due;     // Monotonic time at which the ATM should be stepped
+		ATM* atm;
+		unsigned gen;      // Stale if it differs from the ATM's current generation
+
+		bool operator<(const Timer& other) const {
+			return due > other.due; // Earliest deadline on top of the heap
+		}
+	};
+
+	std::vector<pthread_t> threads;
+	std::vector<Timer> timers;      // Min-heap on due time
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;            // Signaled when an earlier timer is added or on shutdown
+	bool running;
+
+	static void* worker(void* arg);
+	void pushTimer(ATM* atm, long long due); // Call with the mutex held
+	void dropTimers(ATM* atm);               // Call with the mutex held
+
+public:
+	AtmScheduler(size_t numThreads);
+	~AtmScheduler();
+
+	void schedule(ATM* atm, long delayMicros); // Start stepping an ATM after a delay
+	void wake(ATM* atm);                       // Step an ATM as soon as possible (used for cancellation)
+};
+
+#endif /* ATM_SCHEDULER_H_ */
@@ -0,0 +1,413 @@
+/*
+ * atm_server.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "atm_server.h"
+#include "banking_system.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define ATM_SERVER_MAX_LINE 65536 // A connection sending a longer line is dropped
+
+// Result lines indexed by ATM::CommandResult
+static const char* const resultText[] = { "FAILED\n", "OK\n", "QUEUED\n", "CLOSED\n" };
+
+// Tag stored in epoll data for the server's own descriptors
+static const int LISTEN_TAG = -1;
+static const int WAKE_TAG = -2;
+static const int SIGNAL_TAG = -3;
+
+AtmServer::AtmServer(Bank* bank, const std::string& socketPath)
+	: bank(bank), socketPath(socketPath), listenFd(-1), epollFd(-1), wakeFd(-1), signalFd(-1),
+	  running(false) {}
+
+AtmServer::~AtmServer() {
+	for (auto& pair : connections) {
+		close(pair.first);
+		delete pair.second;
+	}
+	for (Connection* conn : orphans) {
+		delete conn;
+	}
+	if (listenFd >= 0) {
+		close(listenFd);
+		unlink(socketPath.c_str());
+	}
+	if (signalFd >= 0) {
+		close(signalFd);
+	}
+	if (wakeFd >= 0) {
+		close(wakeFd);
+	}
+	if (epollFd >= 0) {
+		close(epollFd);
+	}
+}
+
+void AtmServer::blockSignals() {
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+	pthread_sigmask(SIG_BLOCK, &mask, nullptr);
+}
+
+static bool addToEpoll(int epollFd, int fd, int tag) {
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = tag;
+	return epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == 0;
+}
+
+bool AtmServer::open() {
+	struct sockaddr_un addr;
+	std::memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (socketPath.size() >= sizeof(addr.sun_path)) {
+		return false;
+	}
+	std::strcpy(addr.sun_path, socketPath.c_str());
+
+	listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (listenFd < 0) {
+		return false;
+	}
+	unlink(socketPath.c_str()); // Remove a stale socket left by a previous run
+	if (bind(listenFd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0
+			|| listen(listenFd, SOMAXCONN) != 0) {
+		return false;
+	}
+
+	sigset_t mask;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGINT);
+	sigaddset(&mask, SIGTERM);
+
+	epollFd = epoll_create1(EPOLL_CLOEXEC);
+	wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	if (epollFd < 0 || wakeFd < 0 || signalFd < 0) {
+		return false;
+	}
+	return addToEpoll(epollFd, listenFd, LISTEN_TAG)
+			&& addToEpoll(epollFd, wakeFd, WAKE_TAG)
+			&& addToEpoll(epollFd, signalFd, SIGNAL_TAG);
+}
+
+void AtmServer::wake() {
+	uint64_t one = 1;
+	ssize_t written = write(wakeFd, &one, sizeof(one));
+	(void)written; // The counter saturating still leaves the eventfd readable
+}
+
+void AtmServer::run() {
+	struct epoll_event events[ATM_SERVER_MAX_EVENTS];
+	running = true;
+
+	while (running || !connections.empty() || !orphans.empty()) {
+		int n = epoll_wait(epollFd, events, ATM_SERVER_MAX_EVENTS, nextResumeMs());
+		if (n < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			std::cerr << "Bank error: epoll_wait failed\n";
+			break;
+		}
+
+		bool reap = false;
+		bool shutdown = false;
+		for (int i = 0; i < n; ++i) {
+			int tag = events[i].data.fd;
+			if (tag == LISTEN_TAG) {
+				acceptConnections();
+			} else if (tag == WAKE_TAG) {
+				uint64_t count;
+				while (read(wakeFd, &count, sizeof(count)) > 0) {
+				}
+				reap = true;
+			} else if (tag == SIGNAL_TAG) {
+				struct signalfd_siginfo info;
+				while (read(signalFd, &info, sizeof(info)) > 0) {
+				}
+				shutdown = true;
+			} else {
+				auto it = connections.find(tag);
+				if (it == connections.end()) {
+					continue; // Dropped earlier in this batch
+				}
+				Connection* conn = it->second;
+				if (events[i].events & EPOLLOUT) {
+					flushConnection(conn);
+				}
+				if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR | EPOLLRDHUP)) {
+					readConnection(conn);
+				}
+			}
+		}
+		resumeDeferred();
+
+		// One write per connection for everything its commands produced in this wakeup
+		for (Connection* conn : dirty) {
+			flushConnection(conn);
+		}
+		dirty.clear();
+
+		if (reap) {
+			reapClosedATMs();
+		}
+		if (shutdown && running) {
+			beginShutdown();
+		}
+	}
+}
+
+void AtmServer::acceptConnections() {
+	while (running) {
+		int fd = accept4(listenFd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			return; // EAGAIN once the backlog is drained
+		}
+
+		Connection* conn = new Connection();
+		conn->fd = fd;
+		conn->outputSent = 0;
+		conn->writable = false;
+		conn->reading = true;
+		conn->closing = false;
+		conn->resumeAt = 0;
+
+		// Register the connection as a regular ATM so that "C" closure reaches it
+		conn->atm = new ATM(0, "", bank);
+		conn->atmIndex = bank->registerATM(conn->atm, true);
+		conn->atm->id = conn->atmIndex + 1;
+		conn->atm->attach(this);
+
+		struct epoll_event ev;
+		std::memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP;
+		ev.data.fd = fd;
+		epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev);
+		connections[fd] = conn;
+	}
+}
+
+void AtmServer::readConnection(Connection* conn) {
+	// A deferred connection is not polled for input, only its peer hanging up or an error
+	// wakes it: everything the peer still sent is read in to run in its later turns
+	bool wasDeferred = conn->resumeAt != 0;
+	bool peerGone = wasDeferred;
+	// Otherwise up to one longest line at a time, the rest stays in the socket until the next wakeup
+	while (wasDeferred || conn->input.size() <= ATM_SERVER_MAX_LINE) {
+		ssize_t got = recv(conn->fd, readBuffer, sizeof(readBuffer), 0);
+		if (got > 0) {
+			conn->input.append(readBuffer, got);
+			continue;
+		}
+		if (got == 0 || (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR)) {
+			peerGone = true;
+		}
+		if (got < 0 && errno == EINTR) {
+			continue;
+		}
+		break;
+	}
+
+	if (!wasDeferred) {
+		runLines(conn);
+	}
+	if (conn->input.size() > ATM_SERVER_MAX_LINE && conn->input.find('\n') == std::string::npos) {
+		peerGone = true;
+	}
+	if (peerGone && conn->resumeAt != 0) {
+		// Its last lines still run in turns, without polling the socket meanwhile
+		conn->closing = true;
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+		return;
+	}
+	if (peerGone) {
+		flushConnection(conn); // Best effort for a half-closed peer
+		dropConnection(conn);
+	}
+}
+
+void AtmServer::runLines(Connection* conn) {
+	// Run every complete line, results are queued in order for a single write
+	size_t start = 0;
+	size_t newline;
+	size_t turn = ATM_SERVER_TURN_LINES * bank->atmWeight(conn->atm->id);
+	size_t ran = 0;
+	bool hadOutput = conn->output.size() > conn->outputSent;
+	while ((newline = conn->input.find('\n', start)) != std::string::npos) {
+		size_t end = newline;
+		if (end > start && conn->input[end - 1] == '\r') {
+			--end;
+		}
+		if (end > start) {
+			// The rest waits, unread, for the next turn or until the bank admits the next line
+			long long wait = ran < turn ? bank->admit(conn->atm->id) : 0;
+			if (ran == turn || wait > 0) {
+				conn->resumeAt = monotonicMicros() + wait;
+				deferred.push_back(conn);
+				break;
+			}
+			++ran;
+			int result = conn->atm->handleCommand(conn->input.substr(start, end - start));
+			conn->output += resultText[result];
+		}
+		start = newline + 1;
+	}
+	conn->input.erase(0, start); // Keeps the capacity for the next batch
+
+	if (!hadOutput && conn->output.size() > conn->outputSent) {
+		dirty.push_back(conn);
+	}
+	if (!conn->closing) {
+		updateEvents(conn, conn->writable);
+	}
+}
+
+void AtmServer::resumeDeferred() {
+	if (deferred.empty()) {
+		return;
+	}
+	long long now = monotonicMicros();
+	std::vector<Connection*> due;
+	size_t kept = 0;
+	for (size_t i = 0; i < deferred.size(); ++i) {
+		if (deferred[i]->resumeAt <= now) {
+			due.push_back(deferred[i]);
+		} else {
+			deferred[kept++] = deferred[i];
+		}
+	}
+	deferred.resize(kept);
+
+	for (Connection* conn : due) {
+		conn->resumeAt = 0;
+		runLines(conn); // May defer it again
+		if (conn->closing && conn->resumeAt == 0) {
+			flushConnection(conn);
+			dropConnection(conn);
+		}
+	}
+}
+
+int AtmServer::nextResumeMs() {
+	if (deferred.empty()) {
+		return -1;
+	}
+	long long first = deferred[0]->resumeAt;
+	for (Connection* conn : deferred) {
+		first = std::min(first, conn->resumeAt);
+	}
+	long long wait = first - monotonicMicros();
+	return wait > 0 ? static_cast<int>((wait + 999) / 1000) : 0;
+}
+
+void AtmServer::forget(Connection* conn) {
+	dirty.erase(std::remove(dirty.begin(), dirty.end(), conn), dirty.end());
+	deferred.erase(std::remove(deferred.begin(), deferred.end(), conn), deferred.end());
+}
+
+void AtmServer::flushConnection(Connection* conn) {
+	while (conn->outputSent < conn->output.size()) {
+		ssize_t sent = send(conn->fd, conn->output.data() + conn->outputSent,
+				conn->output.size() - conn->outputSent, MSG_NOSIGNAL);
+		if (sent < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if (errno == EAGAIN || errno == EWOULDBLOCK) {
+				updateEvents(conn, true); // Resume once the socket drains
+			}
+			return;
+		}
+		conn->outputSent += sent;
+	}
+	conn->output.clear(); // Keeps the capacity for the next batch
+	conn->outputSent = 0;
+	updateEvents(conn, false);
+}
+
+void AtmServer::updateEvents(Connection* conn, bool wantWrite) {
+	bool wantRead = conn->resumeAt == 0;
+	if (conn->writable == wantWrite && conn->reading == wantRead) {
+		return;
+	}
+	if (conn->closing) {
+		conn->writable = wantWrite; // No longer polled
+		return;
+	}
+	struct epoll_event ev;
+	std::memset(&ev, 0, sizeof(ev));
+	ev.events = (wantRead ? EPOLLIN | EPOLLRDHUP : 0) | (wantWrite ? EPOLLOUT : 0);
+	ev.data.fd = conn->fd;
+	epoll_ctl(epollFd, EPOLL_CTL_MOD, conn->fd, &ev);
+	conn->writable = wantWrite;
+	conn->reading = wantRead;
+}
+
+void AtmServer::dropConnection(Connection* conn) {
+	connections.erase(conn->fd);
+	forget(conn);
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+	close(conn->fd);
+	conn->fd = -1;
+
+	// The ATM stays registered until the bank processes the closure and we acknowledge it
+	bank->requestATMClosure(conn->atmIndex, conn->atmIndex, true);
+	orphans.push_back(conn);
+}
+
+void AtmServer::reapClosedATMs() {
+	for (auto it = connections.begin(); it != connections.end();) {
+		Connection* conn = it->second;
+		if (!conn->atm->isStopped()) {
+			++it;
+			continue;
+		}
+		conn->output += resultText[ATM::COMMAND_CLOSED];
+		flushConnection(conn);
+		forget(conn);
+		epoll_ctl(epollFd, EPOLL_CTL_DEL, conn->fd, nullptr);
+		close(conn->fd);
+		it = connections.erase(it);
+
+		conn->atm->markFinished(); // The bank frees the ATM once this returns
+		delete conn;
+	}
+
+	size_t kept = 0;
+	for (size_t i = 0; i < orphans.size(); ++i) {
+		if (orphans[i]->atm->isStopped()) {
+			orphans[i]->atm->markFinished();
+			delete orphans[i];
+		} else {
+			orphans[kept++] = orphans[i];
+		}
+	}
+	orphans.resize(kept);
+}
+
+void AtmServer::beginShutdown() {
+	running = false;
+	epoll_ctl(epollFd, EPOLL_CTL_DEL, listenFd, nullptr);
+
+	// Close every session ATM through the bank, the loop ends once all are acknowledged
+	for (auto& pair : connections) {
+		bank->requestATMClosure(pair.second->atmIndex, pair.second->atmIndex, true);
+	}
+}
@@ -0,0 +1,81 @@
+/*
+ * atm_server.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ATM_SERVER_H_
+#define ATM_SERVER_H_
+
+#include <map>
+#include <string>
+#include <vector>
+
+class ATM;
+class Bank;
+
+#define ATM_SERVER_MAX_EVENTS 64   // Events handled per epoll wakeup
+#define ATM_SERVER_READ_CHUNK 4096 // Bytes read per recv call
+#define ATM_SERVER_TURN_LINES 64   // Lines a connection runs before the others get a turn, times its --atm-weight
+
+// Event-driven front-end accepting ATM connections on a Unix domain socket.
+// Every connection is registered with the bank as an ATM, streams commands in the
+// ATM file grammar (one per line, pipelining allowed) and gets one result line back
+// per command: OK, FAILED, QUEUED (VIP) or CLOSED. Connections take turns of a few lines
+// each, so one streaming a backlog cannot hold the loop, and one over its --atm-rate waits
+// until the bank admits its next line. Neither is read from meanwhile: its socket pushes
+// back on the client while the other connections keep being served.
+class AtmServer {
+private:
+	struct Connection {
+		int fd;
+		int atmIndex;          // Index of the ATM in the bank, used for closure requests
+		ATM* atm;              // Owned by the bank once registered, freed by Bank::processATMClosures
+		std::string input;     // Bytes received but not yet parsed into complete lines
+		std::string output;    // Results not yet written to the socket
+		size_t outputSent;     // Prefix of `output` already written
+		bool writable;         // Whether EPOLLOUT is currently requested
+		bool reading;          // Whether EPOLLIN is currently requested, off while deferred
+		bool closing;          // Peer gone while deferred, dropped once its last lines ran
+		long long resumeAt;    // monotonicMicros() when a deferred connection may run its next line, 0 if not deferred
+	};
+
+	Bank* bank;
+	std::string socketPath;
+	int listenFd;
+	int epollFd;
+	int wakeFd;   // eventfd raised by ATM::closeATM
+	int signalFd; // SIGINT / SIGTERM end the server
+	bool running;
+
+	std::map<int, Connection*> connections; // Live connections by socket fd
+	std::vector<Connection*> orphans;       // Peer gone, ATM closure not acknowledged yet
+	std::vector<Connection*> dirty;         // Connections with output to flush this wakeup
+	std::vector<Connection*> deferred;      // Connections waiting for their next turn or for the bank to admit a line
+	char readBuffer[ATM_SERVER_READ_CHUNK];
+
+	void acceptConnections();
+	void readConnection(Connection* conn);
+	void runLines(Connection* conn);       // Runs the complete lines received, up to the end of its turn
+	void resumeDeferred();                 // Runs the deferred connections whose time has come
+	int nextResumeMs();                    // epoll_wait timeout until the next of them (-1 = none)
+	void forget(Connection* conn);         // Removes it from the per-wakeup lists
+	void flushConnection(Connection* conn);
+	void dropConnection(Connection* conn); // Peer gone, keep the ATM until the bank closes it
+	void reapClosedATMs();                 // Acknowledge closures requested through the bank
+	void beginShutdown();
+	void updateEvents(Connection* conn, bool wantWrite);
+
+public:
+	AtmServer(Bank* bank, const std::string& socketPath);
+	~AtmServer();
+
+	bool open();  // Binds the socket, returns false on failure
+	void run();   // Serves connections until SIGINT / SIGTERM and all session ATMs are closed
+	void wake();  // Thread-safe, makes the event loop look for closed ATMs
+
+	static void blockSignals(); // Call before any thread starts so the signals reach the signalfd
+};
+
+#endif /* ATM_SERVER_H_ */
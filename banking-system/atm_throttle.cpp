@@ -0,0 +1,54 @@
+/*
+ * atm_throttle.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "atm_throttle.h"
+#include <cmath>
+
+AtmThrottle::AtmThrottle(const std::map<int, AtmRate>& rates, MonotonicClock clock) : rates(rates), clock(clock) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+AtmThrottle::~AtmThrottle() {
+	pthread_mutex_destroy(&mutex);
+}
+
+long long AtmThrottle::acquire(int atmId) {
+	if (rates.empty()) {
+		return 0;
+	}
+	long long now = clock();
+	pthread_mutex_lock(&mutex);
+	auto it = buckets.find(atmId);
+	if (it == buckets.end()) {
+		// First command of the ATM, it starts with a full bucket
+		auto rate = rates.find(atmId);
+		if (rate == rates.end()) {
+			rate = rates.find(ATM_ANY);
+		}
+		if (rate == rates.end()) {
+			pthread_mutex_unlock(&mutex);
+			return 0; // Not limited
+		}
+		Bucket bucket;
+		bucket.perMicro = rate->second.perSecond / 1e6;
+		bucket.burst = rate->second.burst;
+		bucket.tokens = bucket.burst;
+		bucket.refilledAt = now;
+		it = buckets.insert(std::make_pair(atmId, bucket)).first;
+	}
+
+	Bucket& bucket = it->second;
+	bucket.tokens = std::min(bucket.burst, bucket.tokens + (now - bucket.refilledAt) * bucket.perMicro);
+	bucket.refilledAt = now;
+	long long wait = 0;
+	if (bucket.tokens >= 1) {
+		bucket.tokens -= 1;
+	} else {
+		wait = static_cast<long long>(std::ceil((1 - bucket.tokens) / bucket.perMicro));
+	}
+	pthread_mutex_unlock(&mutex);
+	return wait;
+}
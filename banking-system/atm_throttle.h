@@ -0,0 +1,47 @@
+/*
+ * atm_throttle.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef ATM_THROTTLE_H_
+#define ATM_THROTTLE_H_
+
+#include <map>
+#include <pthread.h>
+#include "bank_config.h"
+#include "atm_scheduler.h"
+
+// Token bucket per ATM id at the bank's front door. Each command an ATM starts takes one
+// token; tokens come back at the ATM's rate up to its burst. An ATM out of tokens is told
+// how long to wait instead of being blocked, so a thread shared by several ATMs (the ATM
+// scheduler, the socket server) keeps serving the others meanwhile.
+class AtmThrottle {
+private:
+	struct Bucket {
+		double tokens;
+		double perMicro; // Tokens added per microsecond
+		double burst;
+		long long refilledAt; // clock() of the last refill
+	};
+
+	std::map<int, AtmRate> rates; // By ATM id, ATM_ANY for the ATMs without their own
+	std::map<int, Bucket> buckets;
+	pthread_mutex_t mutex;        // Protects `buckets`
+	MonotonicClock clock;
+
+	AtmThrottle(const AtmThrottle&);            // Not copyable
+	AtmThrottle& operator=(const AtmThrottle&);
+
+public:
+	explicit AtmThrottle(const std::map<int, AtmRate>& rates, MonotonicClock clock = monotonicMicros);
+	~AtmThrottle();
+
+	// Takes a token for the next command of the ATM and returns 0, or returns how many
+	// microseconds to wait before one is available (taking nothing)
+	long long acquire(int atmId);
+	bool enabled() const { return !rates.empty(); }
+};
+
+#endif /* ATM_THROTTLE_H_ */
@@ -0,0 +1,96 @@
+/*
+ * balance_index.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "balance_index.h"
+#include <climits>
+
+BalanceIndex::BalanceIndex(bool active) : active(active) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+BalanceIndex::~BalanceIndex() {
+	pthread_mutex_destroy(&mutex);
+}
+
+void BalanceIndex::updateLocked(int id, int balance) {
+	auto it = balances.find(id);
+	if (it != balances.end()) {
+		if (it->second == balance) {
+			return; // Nothing moves, e.g. a zero commission
+		}
+		byBalance.erase(std::make_pair(it->second, id));
+		it->second = balance;
+	} else {
+		balances[id] = balance;
+	}
+	byBalance.insert(std::make_pair(balance, id));
+}
+
+void BalanceIndex::update(int id, int balance) {
+	if (!active) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	updateLocked(id, balance);
+	pthread_mutex_unlock(&mutex);
+}
+
+void BalanceIndex::remove(int id) {
+	if (!active) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	auto it = balances.find(id);
+	if (it != balances.end()) {
+		byBalance.erase(std::make_pair(it->second, id));
+		balances.erase(it);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void BalanceIndex::updateBatch(const std::vector<Entry>& changes) {
+	if (!active || changes.empty()) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	for (const Entry& change : changes) {
+		updateLocked(change.first, change.second);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void BalanceIndex::rebuild(const std::vector<Entry>& all) {
+	if (!active) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	byBalance.clear();
+	balances.clear();
+	for (const Entry& entry : all) {
+		balances[entry.first] = entry.second;
+		byBalance.insert(std::make_pair(entry.second, entry.first));
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void BalanceIndex::top(size_t k, std::vector<Entry>& out) const {
+	out.clear();
+	pthread_mutex_lock(&mutex);
+	for (auto it = byBalance.rbegin(); it != byBalance.rend() && out.size() < k; ++it) {
+		out.push_back(std::make_pair(it->second, it->first));
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void BalanceIndex::range(int low, int high, std::vector<Entry>& out) const {
+	out.clear();
+	pthread_mutex_lock(&mutex);
+	auto end = byBalance.upper_bound(std::make_pair(high, INT_MAX));
+	for (auto it = byBalance.lower_bound(std::make_pair(low, INT_MIN)); it != end; ++it) {
+		out.push_back(std::make_pair(it->second, it->first));
+	}
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,52 @@
+/*
+ * balance_index.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef BALANCE_INDEX_H_
+#define BALANCE_INDEX_H_
+
+#include <set>
+#include <vector>
+#include <utility>
+#include <unordered_map>
+#include <pthread.h>
+
+// Secondary index of the accounts ordered by balance, for top-K and range queries.
+// Kept up to date by the bank after every balance change; bulk changes go through
+// updateBatch() so that they take the index lock once.
+class BalanceIndex {
+public:
+	typedef std::pair<int, int> Entry; // (account id, balance)
+
+private:
+	bool active;
+	std::set<std::pair<int, int> > byBalance; // (balance, id), ascending
+	std::unordered_map<int, int> balances;    // id -> balance currently indexed
+	mutable pthread_mutex_t mutex;
+
+	void updateLocked(int id, int balance);
+
+	BalanceIndex(const BalanceIndex&);            // Not copyable
+	BalanceIndex& operator=(const BalanceIndex&);
+
+public:
+	BalanceIndex(bool active);
+	~BalanceIndex();
+
+	bool enabled() const { return active; }
+
+	void update(int id, int balance);
+	void remove(int id);
+	void updateBatch(const std::vector<Entry>& changes);
+	void rebuild(const std::vector<Entry>& all); // Replaces the whole content
+
+	// Up to k accounts with the highest balances, highest first
+	void top(size_t k, std::vector<Entry>& out) const;
+	// Accounts with low <= balance <= high, lowest first
+	void range(int low, int high, std::vector<Entry>& out) const;
+};
+
+#endif /* BALANCE_INDEX_H_ */
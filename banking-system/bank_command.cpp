@@ -0,0 +1,120 @@
+/*
+ * bank_command.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "bank_command.h"
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+
+// Returns the next whitespace separated token of [pos, end) and its length
+static const char* nextToken(const char*& pos, const char* end, size_t& length) {
+	while (pos < end && std::isspace(static_cast<unsigned char>(*pos))) {
+		++pos;
+	}
+	const char* start = pos;
+	while (pos < end && !std::isspace(static_cast<unsigned char>(*pos))) {
+		++pos;
+	}
+	length = pos - start;
+	return start;
+}
+
+// Reads an integer token, a missing or malformed one reads as 0 like a failed stream extraction
+static int nextInt(const char*& pos, const char* end) {
+	size_t length;
+	const char* token = nextToken(pos, end, length);
+	char buffer[24];
+	if (length == 0 || length >= sizeof(buffer)) {
+		return 0;
+	}
+	std::memcpy(buffer, token, length);
+	buffer[length] = '\0';
+	return std::atoi(buffer);
+}
+
+static bool nextPassword(const char*& pos, const char* end, char* password, std::string* longPassword) {
+	size_t length;
+	const char* token = nextToken(pos, end, length);
+	if (length >= COMMAND_PASSWORD_CAPACITY) {
+		if (longPassword == nullptr) {
+			return false;
+		}
+		longPassword->assign(token, length);
+		length = 0;
+	}
+	std::memcpy(password, token, length);
+	password[length] = '\0';
+	return true;
+}
+
+bool BankCommand::parse(const std::string& line, int atmId, BankCommand& out, std::string* longPassword) {
+	const char* pos = line.data();
+	const char* end = pos + line.size();
+
+	out.action = '\0';
+	out.isPersistent = line.find("PERSISTENT") != std::string::npos;
+	out.atmId = atmId;
+	out.accountId = 0;
+	out.amount = 0;
+	out.destId = 0;
+	out.maxStaleMs = -1;
+	out.password[0] = '\0';
+
+	size_t length;
+	const char* action = nextToken(pos, end, length);
+	if (length != 1) {
+		return true; // Unknown action, fails when executed
+	}
+
+	switch (*action) {
+	case 'O': // Open account
+	case 'D': // Deposit
+	case 'W': // Withdraw
+	case 'H': // Account statement, `amount` is the number of entries
+	case 'P': // Balance in the past, `amount` is the number of iterations ago
+		out.accountId = nextInt(pos, end);
+		if (!nextPassword(pos, end, out.password, longPassword)) {
+			return false;
+		}
+		out.amount = nextInt(pos, end);
+		break;
+	case 'B': { // Check balance
+		out.accountId = nextInt(pos, end);
+		if (!nextPassword(pos, end, out.password, longPassword)) {
+			return false;
+		}
+		size_t stale = line.find("STALE=");
+		if (stale != std::string::npos) {
+			out.maxStaleMs = std::atoi(line.c_str() + stale + 6);
+		}
+		break;
+	}
+	case 'Q': // Close account
+	case 'L': // Log in
+		out.accountId = nextInt(pos, end);
+		if (!nextPassword(pos, end, out.password, longPassword)) {
+			return false;
+		}
+		break;
+	case 'T': // Transfer money
+		out.accountId = nextInt(pos, end);
+		if (!nextPassword(pos, end, out.password, longPassword)) {
+			return false;
+		}
+		out.destId = nextInt(pos, end);
+		out.amount = nextInt(pos, end);
+		break;
+	case 'R': // Restore Bank
+	case 'S': // Bank totals in the past
+	case 'C': // Close ATM
+		out.accountId = nextInt(pos, end);
+		break;
+	default:
+		return true;
+	}
+	out.action = *action;
+	return true;
+}
@@ -0,0 +1,34 @@
+/*
+ * bank_command.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef BANK_COMMAND_H_
+#define BANK_COMMAND_H_
+
+#include <string>
+
+// Passwords up to 15 characters are stored inline. That also keeps them within the
+// small-string buffer of std::string, so executing the command does not allocate.
+#define COMMAND_PASSWORD_CAPACITY 16
+
+// One ATM command line, parsed once when it is read and then passed around by value
+struct BankCommand {
+	char action;       // 'O', 'Q', 'D', 'W', 'B', 'H', 'L', 'P', 'T', 'R', 'S' or 'C' ('\0' if unknown)
+	bool isPersistent; // The line carries PERSISTENT
+	int atmId;         // ATM the command came from
+	int accountId;     // Account for O/Q/D/W/B/H/L/P, source for T, iterations for R/S, target ATM for C
+	int amount;        // Initial balance for O, amount for D/W/T, entry count for H, iterations for P
+	int destId;        // Destination account for T
+	int maxStaleMs;    // STALE=<ms> of a B, the oldest snapshot it may be answered from (-1 = the configured bound)
+	char password[COMMAND_PASSWORD_CAPACITY];
+
+	// Parses a line of the ATM file grammar, without allocating unless the password does not
+	// fit inline. Such a password goes to `longPassword` (leaving `password` empty) if given,
+	// otherwise parse returns false.
+	static bool parse(const std::string& line, int atmId, BankCommand& out, std::string* longPassword = nullptr);
+};
+
+#endif /* BANK_COMMAND_H_ */
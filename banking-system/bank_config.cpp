@@ -0,0 +1,265 @@
+/*
+ * bank_config.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "bank_config.h"
+#include "money_audit.h"
+#include "thread_placement.h"
+#include "thread_pool.h"
+#include <cstdlib>
+
+BankConfig::BankConfig() : atmThreads(0), memoryReport(false), binaryLog(false), historyDepth(32),
+	balanceIndex(false), statusTop(0), queryThreads(0), maxStalenessMs(1000),
+	historyRetention(0), historyFile("history.bin"), vipAgingMs(0), vipReport(false),
+	persistentWaitMs(1000), vipMaxThreads(0), vipIdleMs(POOL_IDLE_MS), vipQueueCapacity(0), vipOverflow(OVERFLOW_BLOCK),
+	partitions(0), auditIntervalMs(AUDIT_INTERVAL_MS), timerJobs(true) {}
+
+// Parse a non-negative integer, returns false on garbage
+static bool parseSize(const std::string& value, size_t& out) {
+	if (value.empty()) {
+		return false;
+	}
+	char* end = nullptr;
+	long long parsed = std::strtoll(value.c_str(), &end, 10);
+	if (*end != '\0' || parsed < 0) {
+		return false;
+	}
+	out = static_cast<size_t>(parsed);
+	return true;
+}
+
+// Parse a comma separated list of account ids
+static bool parseIdList(const std::string& value, std::vector<int>& out) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t comma = value.find(',', start);
+		std::string item = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+		char* end = nullptr;
+		long id = std::strtol(item.c_str(), &end, 10);
+		if (item.empty() || *end != '\0') {
+			return false;
+		}
+		out.push_back(static_cast<int>(id));
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return true;
+}
+
+// Parse a comma separated list of priority:milliseconds pairs
+static bool parseTargets(const std::string& value, std::map<int, size_t>& out) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t comma = value.find(',', start);
+		std::string item = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+		size_t colon = item.find(':');
+		if (colon == std::string::npos) {
+			return false;
+		}
+		char* end = nullptr;
+		long priority = std::strtol(item.c_str(), &end, 10);
+		size_t ms;
+		if (colon == 0 || end != item.c_str() + colon || !parseSize(item.substr(colon + 1), ms)) {
+			return false;
+		}
+		out[static_cast<int>(priority)] = ms;
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return true;
+}
+
+// Parse an ATM id, or * for every ATM
+static bool parseAtmId(const std::string& value, int& out) {
+	if (value == "*") {
+		out = ATM_ANY;
+		return true;
+	}
+	size_t id;
+	if (!parseSize(value, id) || id == 0) {
+		return false;
+	}
+	out = static_cast<int>(id);
+	return true;
+}
+
+// Parse a comma separated list of id:rate[:burst] entries, the burst defaults to one second of commands
+static bool parseAtmRates(const std::string& value, std::map<int, AtmRate>& out) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t comma = value.find(',', start);
+		std::string item = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+		size_t colon = item.find(':');
+		size_t second = colon == std::string::npos ? std::string::npos : item.find(':', colon + 1);
+		int id;
+		AtmRate rate;
+		if (colon == std::string::npos || !parseAtmId(item.substr(0, colon), id) ||
+				!parseSize(item.substr(colon + 1, second == std::string::npos ? std::string::npos : second - colon - 1),
+						rate.perSecond) || rate.perSecond == 0) {
+			return false;
+		}
+		rate.burst = rate.perSecond;
+		if (second != std::string::npos && (!parseSize(item.substr(second + 1), rate.burst) || rate.burst == 0)) {
+			return false;
+		}
+		out[id] = rate;
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return true;
+}
+
+// Parse a comma separated list of id:weight pairs
+static bool parseAtmWeights(const std::string& value, std::map<int, size_t>& out) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t comma = value.find(',', start);
+		std::string item = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+		size_t colon = item.find(':');
+		int id;
+		size_t weight;
+		if (colon == std::string::npos || !parseAtmId(item.substr(0, colon), id) ||
+				!parseSize(item.substr(colon + 1), weight) || weight == 0) {
+			return false;
+		}
+		out[id] = weight;
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return true;
+}
+
+// Parse a number of states, or a duration with an s, m or h suffix converted to status ticks
+static bool parseRetention(const std::string& value, size_t& out) {
+	if (value.empty()) {
+		return false;
+	}
+	size_t seconds;
+	switch (value[value.size() - 1]) {
+	case 's':
+	case 'm':
+	case 'h':
+		if (!parseSize(value.substr(0, value.size() - 1), seconds)) {
+			return false;
+		}
+		seconds *= value[value.size() - 1] == 'h' ? 3600 : value[value.size() - 1] == 'm' ? 60 : 1;
+		out = seconds * 1000 / STATUS_INTERVAL_MS;
+		return true;
+	default:
+		return parseSize(value, out);
+	}
+}
+
+bool BankConfig::parseOption(const std::string& option) {
+	if (option.compare(0, 2, "--") != 0) {
+		return false;
+	}
+	size_t eq = option.find('=');
+	std::string name = option.substr(2, eq == std::string::npos ? std::string::npos : eq - 2);
+	std::string value = eq == std::string::npos ? "" : option.substr(eq + 1);
+
+	if (name == "atm-threads") {
+		return parseSize(value, atmThreads);
+	}
+	if (name == "memory-report") {
+		memoryReport = true;
+		return value.empty();
+	}
+	if (name == "account-history") {
+		return parseSize(value, historyDepth);
+	}
+	if (name == "balance-index") {
+		balanceIndex = true;
+		return value.empty();
+	}
+	if (name == "status-top") {
+		balanceIndex = true; // The top accounts come from the index
+		return parseSize(value, statusTop);
+	}
+	if (name == "query-threads") {
+		return parseSize(value, queryThreads);
+	}
+	if (name == "max-staleness") {
+		return parseSize(value, maxStalenessMs);
+	}
+	if (name == "history-retention") {
+		return parseRetention(value, historyRetention);
+	}
+	if (name == "history-file") {
+		historyFile = value;
+		return !value.empty();
+	}
+	if (name == "vip-aging") {
+		return parseSize(value, vipAgingMs);
+	}
+	if (name == "vip-deadline") {
+		return parseTargets(value, vipTargetsMs);
+	}
+	if (name == "persistent-wait") {
+		return parseSize(value, persistentWaitMs);
+	}
+	if (name == "vip-max-threads") {
+		return parseSize(value, vipMaxThreads);
+	}
+	if (name == "vip-idle") {
+		return parseSize(value, vipIdleMs);
+	}
+	if (name == "vip-queue-capacity") {
+		return parseSize(value, vipQueueCapacity);
+	}
+	if (name == "vip-overflow") {
+		vipOverflow = value == "shed" ? OVERFLOW_SHED : value == "reject" ? OVERFLOW_REJECT : OVERFLOW_BLOCK;
+		return value == "block" || value == "shed" || value == "reject";
+	}
+	if (name == "partitions") {
+		return parseSize(value, partitions);
+	}
+	if (name == "vip-cpus") {
+		return parseCpuList(value, vipCpus);
+	}
+	if (name == "atm-cpus") {
+		return parseCpuList(value, atmCpus);
+	}
+	if (name == "background-cpus") {
+		return parseCpuList(value, backgroundCpus);
+	}
+	if (name == "atm-rate") {
+		return parseAtmRates(value, atmRates);
+	}
+	if (name == "atm-weight") {
+		return parseAtmWeights(value, atmWeights);
+	}
+	if (name == "audit-interval") {
+		return parseSize(value, auditIntervalMs);
+	}
+	if (name == "record") {
+		recordPath = value;
+		return !value.empty();
+	}
+	if (name == "vip-report") {
+		vipReport = true;
+		return value.empty();
+	}
+	if (name == "hot-accounts") {
+		return parseIdList(value, hotAccounts);
+	}
+	if (name == "log-format") {
+		binaryLog = value == "binary";
+		return value == "binary" || value == "text";
+	}
+	if (name == "socket") {
+		socketPath = value;
+		return !value.empty();
+	}
+	return false;
+}
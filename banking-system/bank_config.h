@@ -0,0 +1,65 @@
+/*
+ * bank_config.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef BANK_CONFIG_H_
+#define BANK_CONFIG_H_
+
+#include <string>
+#include <cstddef>
+#include <vector>
+#include <map>
+#include "task_queue.h"
+
+#define STATUS_INTERVAL_MS 500 // Status tick, a bank state is saved on each one
+#define COMMISSION_INTERVAL_MS 3000 // Period of the commission pass
+#define ATM_ANY -1 // Key of --atm-rate and --atm-weight entries for every ATM without its own
+
+// Commands per second an ATM may start, and how many it may start at once after a pause
+struct AtmRate {
+	size_t perSecond;
+	size_t burst;
+};
+
+// Runtime options given on the command line as --name=value
+struct BankConfig {
+	size_t atmThreads; // Threads multiplexing the ATMs (0 = one thread per ATM)
+	std::string socketPath; // Unix domain socket accepting streamed ATM commands (empty = disabled)
+	bool memoryReport;      // Print resident memory at startup and at exit
+	bool binaryLog;         // Record fixed-size events in log.bin instead of text in log.txt
+	size_t historyDepth;    // Changes kept per account for statements (0 = no history)
+	bool balanceIndex;      // Maintain an index of the accounts ordered by balance
+	size_t statusTop;       // Print only the K richest accounts in the status (0 = all, needs the index)
+	std::vector<int> hotAccounts; // Accounts credited often enough to keep their balance striped per CPU
+	size_t queryThreads;    // Threads answering balance queries from the published snapshot (0 = live reads)
+	size_t maxStalenessMs;  // Oldest snapshot a query accepts before it falls back to a live read
+	size_t historyRetention; // Restorable states, the ones beyond the in-memory window live on disk (0 = memory only)
+	std::string historyFile; // Snapshot file of the disk tier
+	size_t vipAgingMs;      // Queue wait worth one VIP priority level (0 = strict priority)
+	std::map<int, size_t> vipTargetsMs; // VIP priority -> enqueue-to-start target, served deadline first
+	bool vipReport;         // Print the VIP queue wait per priority to stderr at exit
+	size_t persistentWaitMs; // Longest a failed PERSISTENT command waits for its account to change
+	size_t vipMaxThreads;   // The VIP pool grows up to this many workers under load (0 = fixed size)
+	size_t vipIdleMs;       // Idle time after which a VIP worker above the minimum retires
+	size_t vipQueueCapacity; // Most VIP commands queued at once (0 = unbounded)
+	OverflowPolicy vipOverflow; // What a submission to a full VIP queue does
+	std::string recordPath; // Trace of the applied changes, replayed by ./replay (empty = not recorded)
+	size_t partitions;      // Processes owning a share of the accounts each (0 = this process owns them)
+	std::vector<int> vipCpus;        // Cores the VIP workers are pinned to, one each (empty = not pinned)
+	std::vector<int> atmCpus;        // Cores the ATM threads are pinned to, one each (empty = not pinned)
+	std::vector<int> backgroundCpus; // Cores of the background threads (empty = the ones left over)
+	std::map<int, AtmRate> atmRates;  // ATM id (or ATM_ANY) -> command rate (empty = not limited)
+	std::map<int, size_t> atmWeights; // ATM id (or ATM_ANY) -> share of the VIP queue (empty = FIFO per priority)
+	size_t auditIntervalMs; // Period of the money-conservation audit (0 = no audit job)
+	bool timerJobs;         // Run the periodic commission, status, closure and restore jobs (off while replaying)
+
+	BankConfig();
+
+	// Parse a single "--name=value" option, returns false if it is not recognized
+	bool parseOption(const std::string& option);
+};
+
+#endif /* BANK_CONFIG_H_ */
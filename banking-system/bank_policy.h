@@ -0,0 +1,88 @@
+/*
+ * bank_policy.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef BANK_POLICY_H_
+#define BANK_POLICY_H_
+
+#include "epoch.h"
+
+// Compile-time policies of the account operations (Bank::depositAs, withdrawAs, getBalanceAs
+// and transferAs). Bank::deposit and the others run DefaultPolicy; a mode that needs less
+// uses another instantiation and the branches it does not need are compiled out.
+// Only these four are templated: opening and closing accounts publish a new directory under
+// the bank lock and statements read the account history, which no other mode runs differently.
+
+// How accounts are reached and locked
+struct SharedAccess { // Other threads use the bank too
+	typedef EpochGuard Guard;
+	template <typename A> static void lockWrite(A* account) { account->lockWrite(); }
+	template <typename A> static void unlockWrite(A* account) { account->unlockWrite(); }
+	template <typename A> static void lockRead(A* account) { account->lockRead(); }
+	template <typename A> static void unlockRead(A* account) { account->unlockRead(); }
+};
+
+struct SingleWriterAccess { // The caller is the only thread using the bank, e.g. a replay
+	struct Guard {
+		Guard() {}
+	};
+	template <typename A> static void lockWrite(A*) {}
+	template <typename A> static void unlockWrite(A*) {}
+	template <typename A> static void lockRead(A*) {}
+	template <typename A> static void unlockRead(A*) {}
+};
+
+// Whether operations are written to the transaction log. The account history and the trace
+// record every applied change either way, so statements and replays stay complete.
+struct LoggedEvents {
+	static const bool enabled = true;
+};
+
+struct UnloggedEvents {
+	static const bool enabled = false;
+};
+
+// Which failures are reported
+struct CallerErrors { // All of them unless the caller passes isPersist, as the ATMs always did
+	static bool report(bool isPersist) { return !isPersist; }
+};
+
+struct SilentErrors {
+	static bool report(bool) { return false; }
+};
+
+// Hooks run once per operation
+struct NoInstrumentation {
+	static void applied() {}
+	static void failed() {}
+};
+
+struct CountingInstrumentation { // Per-thread counts, read by the thread that ran the operations
+	static long& appliedCount() { static thread_local long count = 0; return count; }
+	static long& failedCount() { static thread_local long count = 0; return count; }
+	static void applied() { appliedCount()++; }
+	static void failed() { failedCount()++; }
+};
+
+template <class AccessPolicy, class EventPolicy, class ErrorPolicy, class InstrumentPolicy = NoInstrumentation>
+struct BankPolicy {
+	typedef AccessPolicy Access;
+	typedef EventPolicy Events;
+	typedef ErrorPolicy Errors;
+	typedef InstrumentPolicy Instrument;
+
+	// Whether a failure is logged
+	static bool logFailure(bool isPersist) { return Events::enabled && Errors::report(isPersist); }
+};
+
+// The instantiations Bank provides
+typedef BankPolicy<SharedAccess, LoggedEvents, CallerErrors> DefaultPolicy;
+typedef BankPolicy<SharedAccess, LoggedEvents, CallerErrors, CountingInstrumentation> CountedPolicy;
+typedef BankPolicy<SharedAccess, UnloggedEvents, SilentErrors> UnloggedPolicy;
+typedef BankPolicy<SingleWriterAccess, LoggedEvents, CallerErrors> SingleWriterPolicy;
+typedef BankPolicy<SingleWriterAccess, UnloggedEvents, SilentErrors> SingleWriterUnloggedPolicy;
+
+#endif /* BANK_POLICY_H_ */
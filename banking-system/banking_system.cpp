@@ -1,38 +1,92 @@
 #include "banking_system.h"
 #include <iostream>
 #include <fstream>
-#include <sstream>
 #include <unistd.h>
 #include <algorithm>
 #include <string>
+#include <time.h>
+#include <cstdlib>
 
 
 // Account Class Implementation
-Account::Account():id(0), password(""), balance(0) {}
+Account::Account():id(0), password(""), balance(0), credits(nullptr), closed(false), ledger(nullptr) {}
 
 Account::Account(int id, const std::string& password, int balance)
-    : id(id), password(password), balance(balance) {}
+    : id(id), password(password), balance(balance), credits(nullptr), closed(false), ledger(nullptr) {}
 
 Account::Account(const Account& other)
-	: id(other.id),  password(other.password), balance(other.balance) {}
+	: id(other.id),  password(other.password), balance(other.getBalance()), credits(nullptr), closed(false),
+	  ledger(nullptr) {}
+
+Account::~Account() {
+	delete credits;
+}
 
 bool Account::verifyPassword(const std::string& inputPassword) const {
 	return password == inputPassword;
 }
 
 void Account::deposit(int amount) {
-	balance += amount;
+	if (credits != nullptr) {
+		credits->add(amount);
+	} else {
+		balance += amount;
+	}
+	if (ledger != nullptr) {
+		ledger->add(amount);
+	}
+}
+
+void Account::credit(int amount) {
+	if (credits != nullptr) {
+		credits->add(amount);
+	} else {
+		lockWrite();
+		balance += amount;
+		unlockWrite();
+	}
+	if (ledger != nullptr) {
+		ledger->add(amount);
+	}
+}
+
+void Account::makeHot() {
+	if (credits == nullptr) {
+		credits = new StripedCounter();
+	}
+}
+
+bool Account::isHot() const {
+	return credits != nullptr;
+}
+
+void Account::attachLedger(StripedCounter* ledger) {
+	this->ledger = ledger;
+	ledger->add(getBalance());
 }
 
 void Account::withdraw(int amount) {
 	balance -= amount;
+	if (ledger != nullptr) {
+		ledger->add(-amount);
+	}
 }
 
 void Account::setBalance(int amount){
+	long long previous = balance;
+	if (credits != nullptr) {
+		previous += credits->drain(); // The new balance replaces whatever was credited
+	}
 	balance = amount;
+	if (ledger != nullptr) {
+		ledger->add(amount - previous);
+	}
 }
 
 int Account::getBalance() const {
+	if (credits != nullptr) {
+		return static_cast<int>(balance + credits->value());
+	}
 	return balance;
 }
 
@@ -40,7 +94,7 @@ int Account::getId() {
 	return id;
 }
 
-std::string Account::getPassword() const {
+const std::string& Account::getPassword() const {
 	return password;
 }
 
@@ -60,118 +114,520 @@ void Account::unlockRead() {
 	rwLock.releaseReadLock();
 }
 
+void Account::markClosed() {
+	closed.store(true, std::memory_order_release);
+	if (ledger != nullptr) {
+		ledger->add(-getBalance());
+	}
+}
+
+bool Account::isClosed() const {
+	return closed.load(std::memory_order_acquire);
+}
+
 ReadWriteLock& Account::getLogLock() {
     return logLock;
 }
 
+BankState::BankState() : records(nullptr), count(0), capacity(0), takenAt(0) {}
+
+void BankState::reset(size_t newCapacity) {
+	takenAt = monotonicMicros();
+	arena.reset();
+	records = arena.allocateArray<AccountRecord>(newCapacity);
+	count = 0;
+	capacity = newCapacity;
+}
+
+void BankState::add(int id, int balance, const std::string& password) {
+	if (count == capacity) {
+		return; // reset() was given the size of the directory version being copied
+	}
+	AccountRecord& record = records[count++];
+	record.id = id;
+	record.balance = balance;
+	record.password = arena.copyString(password);
+}
+
+const AccountRecord* BankState::find(int id) const {
+	const AccountRecord* it = std::lower_bound(begin(), end(), id,
+			[](const AccountRecord& record, int key) { return record.id < key; });
+	if (it == end() || it->id != id) {
+		return nullptr;
+	}
+	return it;
+}
+
 BankHistory::BankHistory(size_t maxStates)
     : stateHistory(maxStates), currentIndex(0) {
+	for (std::atomic<BankState*>& slot : stateHistory) {
+		slot.store(nullptr, std::memory_order_relaxed);
+	}
+	pthread_mutex_init(&spareMutex, nullptr);
+}
+
+BankHistory::~BankHistory() {
+	for (std::atomic<BankState*>& slot : stateHistory) {
+		delete slot.load(std::memory_order_relaxed);
+	}
+	for (BankState* state : spare) {
+		delete state;
+	}
+	pthread_mutex_destroy(&spareMutex);
 }
 
-void BankHistory::saveState(const BankState& state) {
-	currentIndex = (currentIndex + 1) % MAX_STATES;
-	stateHistory[currentIndex] = state;
+void BankHistory::recycle(void* state, void* history) {
+	BankHistory* self = static_cast<BankHistory*>(history);
+	pthread_mutex_lock(&self->spareMutex);
+	self->spare.push_back(static_cast<BankState*>(state));
+	pthread_mutex_unlock(&self->spareMutex);
 }
 
-BankState BankHistory::getState(int R) const {
-	size_t restoreIndex = (currentIndex + MAX_STATES + 1 - R) % MAX_STATES;
-	return stateHistory[restoreIndex];
+BankState* BankHistory::nextState() {
+	EpochDomain::instance().collect(); // One tick per state, so the ones retired two ticks ago come back
+	BankState* state = nullptr;
+	pthread_mutex_lock(&spareMutex);
+	if (!spare.empty()) {
+		state = spare.back(); // Keeps its arena, a steady account count allocates nothing
+		spare.pop_back();
+	}
+	pthread_mutex_unlock(&spareMutex);
+	return state != nullptr ? state : new BankState();
 }
 
-Bank::Bank(size_t numVIPThreads) : bankAccount(0, "bank_password", 0), running(true), history(120), vipTaskQueue(),
- vipThreadPool(new ThreadPool(vipTaskQueue, numVIPThreads)), totalSavedStates(0) {
-	pthread_create(&statusThread, nullptr, Bank::printStatus, this);
-	pthread_create(&commissionThread, nullptr, Bank::chargeCommission, this);
+void BankHistory::commit(BankState* state) {
+	size_t index = (currentIndex.load(std::memory_order_relaxed) + 1) % MAX_STATES;
+	BankState* oldest = stateHistory[index].exchange(state, std::memory_order_acq_rel);
+	currentIndex.store(index, std::memory_order_release);
+	if (oldest != nullptr) {
+		// Queries and statements may still be reading it
+		EpochDomain::instance().retire(oldest, BankHistory::recycle, this);
+	}
 }
 
-Bank::Bank() : bankAccount(0, "bank_password", 0), running(true), history(120),
-  totalSavedStates(0) {
-	pthread_create(&statusThread, nullptr, Bank::printStatus, this);
-	pthread_create(&commissionThread, nullptr, Bank::chargeCommission, this);
+const BankState& BankHistory::getState(int R) const {
+	size_t restoreIndex = (currentIndex.load(std::memory_order_acquire) + MAX_STATES + 1 - R) % MAX_STATES;
+	return *stateHistory[restoreIndex].load(std::memory_order_acquire);
+}
+
+Bank::Bank(size_t numVIPThreads) : Bank(numVIPThreads, BankConfig()) {}
+
+Bank::Bank(size_t numVIPThreads, const BankConfig& config, PartitionSet* partitions) : config(config), bankAccount(0, "bank_password", 0),
+ history(120), vipTaskQueue(), vipThreadPool(numVIPThreads > 0 ? new ThreadPool(vipTaskQueue, numVIPThreads, THREAD_VIP, "vip worker",
+		 config.vipMaxThreads, config.vipIdleMs * 1000LL) : nullptr),
+ totalSavedStates(0), transactionLog(config.binaryLog), accountHistory(config.historyDepth),
+ balanceIndex(config.balanceIndex), accounts(new AccountDirectory()),
+ queryThreadPool(config.queryThreads > 0 ? new ThreadPool(queryTaskQueue, config.queryThreads, THREAD_BACKGROUND, "query worker") : nullptr),
+ published(nullptr), archive(nullptr), savedSequence(0), recorder(nullptr),
+ partitions(partitions), throttle(config.atmRates) {
+	if (!config.recordPath.empty()) {
+		recorder = new TraceRecorder();
+		if (!recorder->open(config.recordPath)) {
+			std::cerr << "Bank error: cannot record to " << config.recordPath << std::endl;
+			delete recorder; // Keep going without a trace
+			recorder = nullptr;
+		}
+	}
+	if (config.historyRetention > MAX_STATES) {
+		archive = new SnapshotArchive(config.historyFile, config.historyRetention);
+		if (!archive->open()) {
+			delete archive; // Keep going with the in-memory window only
+			archive = nullptr;
+		}
+	}
+	std::map<int, long long> targets;
+	for (const auto& target : config.vipTargetsMs) {
+		targets[target.first] = static_cast<long long>(target.second) * 1000;
+	}
+	vipTaskQueue.setScheduling(static_cast<long long>(config.vipAgingMs) * 1000, targets);
+	vipTaskQueue.setCapacity(config.vipQueueCapacity, config.vipOverflow);
+	if (!config.atmWeights.empty()) {
+		std::map<int, size_t> weights(config.atmWeights);
+		std::map<int, size_t>::iterator others = weights.find(ATM_ANY);
+		size_t otherWeight = others != weights.end() ? others->second : 1;
+		if (others != weights.end()) {
+			weights.erase(others);
+		}
+		vipTaskQueue.setFairShare(weights, otherWeight);
+	}
+	bankAccount.makeHot(); // Every commission lands here
+	bankAccount.attachLedger(audit.balances());
+	accountPool.setNode(ThreadPlacement::instance().getAccountNode());
+	startTimers();
+}
+
+Bank::Bank() : bankAccount(0, "bank_password", 0), history(120), vipThreadPool(nullptr),
+  totalSavedStates(0), transactionLog(false), accountHistory(config.historyDepth), balanceIndex(false),
+  accounts(new AccountDirectory()), queryThreadPool(nullptr), published(nullptr), archive(nullptr), savedSequence(0),
+  recorder(nullptr), partitions(nullptr), throttle(config.atmRates) {
+	bankAccount.makeHot();
+	bankAccount.attachLedger(audit.balances());
+	startTimers();
+}
+
+void Bank::startTimers() {
+	srand(time(nullptr)); // Commission percentages
+	if (!config.timerJobs) {
+		return;
+	}
+	Bank* bank = this;
+	timers.addPeriodic(COMMISSION_INTERVAL_MS * 1000LL, [bank]() { bank->chargeCommission(); });
+	timers.addPeriodic(STATUS_INTERVAL_MS * 1000LL, [bank]() { bank->printStatus(); });
+	timers.addPeriodic(STATUS_INTERVAL_MS * 1000LL, [bank]() { bank->processATMClosures(); });
+	timers.addPeriodic(STATUS_INTERVAL_MS * 1000LL, [bank]() { bank->restoreRequestsHandler(); });
+	if (config.auditIntervalMs > 0) {
+		timers.addPeriodic(config.auditIntervalMs * 1000LL, [bank]() { bank->audit.check(); });
+	}
+	timers.start();
 }
 
 Bank::~Bank() {
 
     stop();
-    pthread_join(statusThread, nullptr);
-    pthread_join(commissionThread, nullptr);
-    for (auto& pair : accounts) {
-        delete pair.second;
+    delete vipThreadPool; // Runs what is still queued before its threads exit
+    delete queryThreadPool;
+    if (recorder != nullptr) {
+        recordFinalBalances(); // Nothing changes the accounts any more
+        delete recorder;
+    }
+    // Accounts deleted earlier may still wait for their epoch to end
+    EpochDomain::instance().synchronize();
+    const AccountDirectory* directory = accounts.load();
+    for (const auto& pair : *directory) {
+        accountPool.destroy(pair.second);
     }
-	 
+    delete directory;
+    delete archive;
 
 }
 
-void Bank::submitVIPTask(int priority, const std::function<void()>& task) {
-    vipThreadPool->submitTask(priority, task);
+VipOutcome::VipOutcome(VipOutcome&& other)
+    : bank(other.bank), done(std::move(other.done)), atmId(other.atmId), settled(other.settled) {
+    other.settled = true; // The moved-from task is not the one that was dropped
 }
 
-void* Bank::chargeCommission(void* arg) {
-    Bank* bank = static_cast<Bank*>(arg);  // Cast the argument back to a Bank pointer
+VipOutcome::~VipOutcome() {
+    if (!settled) {
+        bank->logTransaction(TxEvent::failure(TX_ERROR_VIP_QUEUE_FULL, atmId, 0));
+        done.complete(false);
+    }
+}
 
-    // Seed the random number generator (once per thread)
-    srand(time(nullptr));
+void VipOutcome::complete(bool success) {
+    settled = true;
+    done.complete(success);
+}
 
-    while (bank->running) {
-        // Wait for 3 seconds before charging commission
-        sleep(3);
+// VIP task running a parsed command, a failed persistent one gets a second, logged attempt
+struct VipCommandTask {
+    VipOutcome outcome;
+    BankCommand command;
 
-		// Generate a random percentage between 1% and 5%
-		int percentage = (rand() % 5) + 1;
+    void operator()() {
+        Bank* bank = outcome.getBank();
+        bool success = bank->executeCommand(command, command.isPersistent);
+        if (command.isPersistent && !success) {
+            success = bank->executeCommand(command, false);
+        }
+        outcome.complete(success);
+    }
+};
+
+TaskFunction Bank::vipTask(const BankCommand& command, const CompletionHandle& done) {
+    VipCommandTask task = {VipOutcome(this, command.atmId, done), command};
+    return TaskFunction(std::move(task));
+}
 
-        // Loop through all accounts and charge a random commission
-        for (auto& accountPair : bank->accounts) {
-            Account* account = accountPair.second;
+CompletionHandle Bank::submitVIPTask(int priority, const BankCommand& command, bool mayBlock) {
+    CompletionHandle done = CompletionHandle::create();
+    submitVIPTask(priority, vipTask(command, done), command.atmId, mayBlock);
+    return done;
+}
 
-            // Calculate the commission
-            account->lockWrite();
-			if(account!=nullptr){
-				int commission = std::round(account->getBalance() * percentage / 100.0);
-            	
-				Account* bankA = &bank->bankAccount;
-				// Deduct the commission from the account balance
-            	account->withdraw(commission);
-				bankA->setBalance(bankA->getBalance() + commission);
+void Bank::submitVIPTask(int priority, TaskFunction&& task, int atmId, bool mayBlock) {
+    if (vipThreadPool == nullptr) {
+        task();
+        return;
+    }
+    vipThreadPool->submitTask(priority, std::move(task), atmId, mayBlock);
+}
 
-				bank->logTransaction("Bank: commissions of "+std::to_string(percentage)+" % were charged, bank gained "+std::to_string(commission)+" from account " + std::to_string(account->getId()) + "\n");
-			}
-            account->unlockWrite();
+size_t Bank::atmWeight(int atmId) const {
+    std::map<int, size_t>::const_iterator weight = config.atmWeights.find(atmId);
+    if (weight == config.atmWeights.end()) {
+        weight = config.atmWeights.find(ATM_ANY);
+    }
+    return weight != config.atmWeights.end() ? weight->second : 1;
+}
+
+void Bank::drain() {
+    if (vipThreadPool != nullptr) {
+        vipThreadPool->drain();
+    }
+}
+
+void Bank::reportVIPWaits(FILE* out) {
+    vipTaskQueue.reportWaits(out);
+    if (vipThreadPool != nullptr) {
+        vipThreadPool->report(out);
+    }
+}
+
+bool Bank::awaitCondition(const std::string& command, int atmID, AccountWaiter* waiter) {
+    BankCommand parsed;
+    std::string longPassword; // Not needed to tell what the command waits for
+    BankCommand::parse(command, atmID, parsed, &longPassword);
+    bool needsBalance = parsed.action == 'W' || parsed.action == 'T';
+    switch (parsed.action) {
+    case 'D': case 'W': case 'B': case 'Q': case 'H': case 'L': case 'P': case 'T':
+        break;
+    default:
+        return false;
+    }
+
+    // Which account change could make the command succeed now
+    EpochGuard guard;
+    waiter->accountId = parsed.accountId;
+    waiter->minBalance = WAIT_ACCOUNT_EXISTS;
+    Account* account = directory().find(parsed.accountId);
+    if (account != nullptr && needsBalance) {
+        account->lockRead();
+        int balance = account->getBalance();
+        bool closed = account->isClosed();
+        account->unlockRead();
+        if (!closed && balance >= parsed.amount) {
+            if (parsed.action != 'T' || directory().find(parsed.destId) != nullptr) {
+                return false; // Nothing missing, it failed on the password
+            }
+            waiter->accountId = parsed.destId;
+        } else if (!closed) {
+            waiter->minBalance = parsed.amount;
         }
+    } else if (account != nullptr) {
+        return false;
     }
 
-    return nullptr;
+    waitList.add(waiter);
+
+    // The change may have landed before the waiter was queued
+    account = directory().find(waiter->accountId);
+    if (account != nullptr) {
+        account->lockRead();
+        int balance = account->getBalance();
+        bool closed = account->isClosed();
+        account->unlockRead();
+        if (!closed) {
+            waitList.notify(waiter->accountId, balance);
+        }
+    }
+    return true;
 }
 
-void* Bank::printStatus(void* arg) {
-    Bank* bank = static_cast<Bank*>(arg);  // Cast the 'arg' to Bank*
+void Bank::cancelWait(AccountWaiter* waiter) {
+    waitList.cancel(waiter);
+}
 
-    while (bank->running) {
-        usleep(500000);  // Sleep for 0.5 seconds (500,000 microseconds)
+bool Bank::executeCommand(const BankCommand& command, bool isPersist) {
+    if (partitions != nullptr && command.action != 'R' && command.action != 'C' && command.action != 'S') {
+        return partitions->execute(command, isPersist, this); // Commands on accounts go to their owner
+    }
+    return runCommand(command, std::string(command.password), isPersist); // Fits the small-string buffer
+}
 
-		bank->rwLock.acquireReadLock();
+bool Bank::executeCommand(const BankCommand& command, const std::string& password, bool isPersist) {
+    if (partitions != nullptr && command.action != 'R' && command.action != 'C' && command.action != 'S') {
+        // Only an inline password travels to the partitions, so no partitioned account has a longer one
+        logTransaction(TxEvent::failure(TX_ERROR_PASSWORD_TOO_LONG, command.atmId, command.accountId));
+        return false;
+    }
+    return runCommand(command, password, isPersist);
+}
 
-		// Save the current state before printing
-        bank->saveState();
+bool Bank::runCommand(const BankCommand& command, const std::string& password, bool isPersist) {
+    switch (command.action) {
+    case 'O':
+        return createAccount(command.accountId, password, command.amount, command.atmId, isPersist);
+    case 'Q':
+        return deleteAccount(command.accountId, password, command.atmId, isPersist);
+    case 'D':
+        return deposit(command.accountId, command.amount, password, command.atmId, isPersist);
+    case 'W':
+        return withdraw(command.accountId, command.amount, password, command.atmId, isPersist);
+    case 'B': {
+        // From the published snapshot if it is recent enough, see queryBalance
+        long long maxStaleMs = command.maxStaleMs >= 0 ? command.maxStaleMs
+                : static_cast<long long>(config.maxStalenessMs);
+        return queryBalance(command.accountId, password, command.atmId, isPersist, maxStaleMs * 1000);
+    }
+    case 'H':
+        return statement(command.accountId, password, command.amount, command.atmId, isPersist);
+    case 'T':
+        return transfer(command.accountId, password, command.destId, command.amount, command.atmId, isPersist);
+    case 'L':
+        return login(command.accountId, password, command.atmId, isPersist);
+    case 'P':
+        return balanceAt(command.accountId, password, command.amount, command.atmId, isPersist);
+    case 'S':
+        return totalsAt(command.accountId, command.atmId);
+    case 'R':
+        return addRestoreRequest(command.accountId, command.atmId);
+    case 'C':
+        return requestATMClosure(command.accountId, command.atmId, isPersist);
+    }
+    return false; // Unknown action
+}
+
+void Bank::chargeCommission() {
+	// Generate a random percentage between 1% and 5%
+	int percentage = (rand() % 5) + 1;
+	if (partitions != nullptr) {
+		partitions->chargeCommission(percentage);
+	} else {
+		chargeCommissions(percentage);
+	}
+}
 
-        // Clear the screen and move the cursor to the top-left corner
-        printf("\033[2J\033[1;1H");
+void Bank::chargeCommissions(int percentage) {
+	// Every balance moves, so the index is updated once for the whole pass
+	std::vector<BalanceIndex::Entry> reindex;
 
-        // Print the status of all accounts
-        std::cout << "Current Bank Status\n";
-        for (auto& accountPair : bank->accounts) {
-            Account* account = accountPair.second;
-            std::cout << "Account " << account->getId()
-                      << ": Balance - " << account->getBalance()
-                      << " $, Account Password - " << account->getPassword() << "\n";
+    // Loop through all accounts and charge a random commission
+    EpochGuard guard; // Accounts deleted meanwhile stay allocated until the pass ends
+    for (const auto& accountPair : *accounts.load(std::memory_order_acquire)) {
+        chargeAccount(accountPair.second, percentage, reindex);
+    }
+    balanceIndex.updateBatch(reindex);
+}
+
+bool Bank::chargeCommission(int accountId, int percentage) {
+    EpochGuard guard;
+    Account* account = directory().find(accountId);
+    std::vector<BalanceIndex::Entry> reindex;
+    if (account == nullptr || !chargeAccount(account, percentage, reindex)) {
+        return false;
+    }
+    balanceIndex.updateBatch(reindex);
+    return true;
+}
+
+bool Bank::chargeAccount(Account* account, int percentage, std::vector<BalanceIndex::Entry>& reindex) {
+    // Calculate the commission
+    account->lockWrite();
+    if (account->isClosed()) {
+        account->unlockWrite();
+        return false;
+    }
+    int commission = std::round(account->getBalance() * percentage / 100.0);
+
+    // Deduct the commission from the account balance
+    {
+        MoneyAudit::Change change(audit); // Stays in the bank, no flow to book
+        account->withdraw(commission);
+        bankAccount.credit(commission);
+    }
+
+    TxEvent event = TxEvent::make(TX_COMMISSION, 0, account->getId(), commission, account->getBalance());
+    event.detail.op.otherId = percentage;
+    logTransaction(event);
+    if (balanceIndex.enabled()) {
+        reindex.push_back(std::make_pair(account->getId(), account->getBalance()));
+    }
+    account->unlockWrite();
+    return true;
+}
+
+bool Bank::rollbackAccount(int accountId, int balance) {
+    EpochGuard guard;
+    Account* account = directory().find(accountId);
+    if (account == nullptr) {
+        return false;
+    }
+    account->lockWrite();
+    if (account->isClosed()) {
+        account->unlockWrite();
+        return false;
+    }
+    {
+        MoneyAudit::Change change(audit);
+        audit.restored(balance - account->getBalance());
+        account->setBalance(balance);
+    }
+    balanceIndex.update(accountId, balance);
+    account->unlockWrite();
+    return true;
+}
+
+void Bank::recordFinalBalances() {
+    EpochGuard guard;
+    for (const auto& pair : directory()) {
+        pair.second->lockRead();
+        if (!pair.second->isClosed()) {
+            recorder->final(pair.first, pair.second->getBalance());
         }
+        pair.second->unlockRead();
+    }
+    recorder->finalBank(bankAccount.getBalance());
+}
 
-		bank->rwLock.releaseReadLock();
-	  	bank->processATMClosures();
-		bank->restoreRequestsHandler();
-   
+void Bank::printStatus() {
+	if (partitions != nullptr) {
+		printPartitionStatus();
+		return;
+	}
+	// Save and publish the current state, then print from it without any lock
+    const BankState& state = saveState();
+
+    // Clear the screen and move the cursor to the top-left corner
+    printf("\033[2J\033[1;1H");
+
+    // Print the status of all accounts, or of the richest ones only
+    if (config.statusTop > 0 && balanceIndex.enabled()) {
+        std::vector<BalanceIndex::Entry> top;
+        balanceIndex.top(config.statusTop, top);
+        std::cout << "Current Bank Status (top " << config.statusTop << " by balance)\n";
+        for (const BalanceIndex::Entry& entry : top) {
+            const AccountRecord* record = state.find(entry.first);
+            if (record != nullptr) {
+                std::cout << "Account " << record->id
+                          << ": Balance - " << record->balance
+                          << " $, Account Password - " << record->password << "\n";
+            }
+        }
+    } else {
+    std::cout << "Current Bank Status\n";
+    for (const AccountRecord& record : state) {
+        std::cout << "Account " << record.id
+                  << ": Balance - " << record.balance
+                  << " $, Account Password - " << record.password << "\n";
+    }
+    }
 }
 
-    return nullptr;
+void Bank::printPartitionStatus() {
+    std::vector<PartitionStatusRecord> records;
+    partitions->saveStates(records);
+    saveState(); // Keeps the count of restorable states in step with the partitions
+
+    if (config.statusTop > 0) {
+        std::sort(records.begin(), records.end(), [](const PartitionStatusRecord& a, const PartitionStatusRecord& b) {
+            return a.balance > b.balance;
+        });
+        if (records.size() > config.statusTop) {
+            records.resize(config.statusTop);
+        }
+    }
+
+    printf("\033[2J\033[1;1H");
+    if (config.statusTop > 0) {
+        std::cout << "Current Bank Status (top " << config.statusTop << " by balance)\n";
+    } else {
+        std::cout << "Current Bank Status\n";
+    }
+    for (const PartitionStatusRecord& record : records) {
+        std::cout << "Account " << record.id
+                  << ": Balance - " << record.balance
+                  << " $, Account Password - " << record.password << "\n";
+    }
 }
 
 bool Bank::requestATMClosure(int atmID, int sourceATMID, bool isPersist) {
@@ -182,16 +638,14 @@ bool Bank::requestATMClosure(int atmID, int sourceATMID, bool isPersist) {
 
     if (atmID < 0 || atmID >= static_cast<int>(atms.size()) || atms[atmID] == nullptr) {
 		if(!isPersist){
-					logTransaction("Error " + std::to_string(sourceATMID) +
-					": Your transaction failed – ATM ID " + std::to_string(atmID) + " does not exist\n");
+					logTransaction(TxEvent::atmFailure(TX_ERROR_ATM_MISSING, sourceATMID, atmID));
 		}
 					atmClosureLock.releaseWriteLock();
 					atmLock.releaseReadLock();
 					   return false;
     } else if (!atmStates[atmID]) {
 		if(!isPersist){
-					logTransaction("Error " + std::to_string(sourceATMID) +
-					": Your close operation failed – ATM ID " + std::to_string(atmID) + " is already in a closed state\n");
+					logTransaction(TxEvent::atmFailure(TX_ERROR_ATM_ALREADY_CLOSED, sourceATMID, atmID));
 					}
 					atmClosureLock.releaseWriteLock();
 					atmLock.releaseReadLock();
@@ -207,6 +661,10 @@ bool Bank::requestATMClosure(int atmID, int sourceATMID, bool isPersist) {
 
 
 void Bank::processATMClosures() {
+	// Detach the ATMs under the locks, then wait for them outside so that a command
+	// in flight may still request a closure of its own without deadlocking
+	std::vector<std::pair<int, ATM*>> closing;
+
 	atmClosureLock.acquireWriteLock();
 	atmLock.acquireWriteLock();
 
@@ -220,22 +678,12 @@ void Bank::processATMClosures() {
 
 if (atmStates[atmID]){
 
-		        ReadWriteLock& Lock = atms[atmID]->getATMLock();
-            Lock.acquireWriteLock(); // Lock the ATM-specific lock
-
         atmStates[atmID] = false; // Mark as closed
-        atms[atmID]->closeATM(); // Signal the ATM to close
-        atms[atmID]->join();      // Ensure the thread is joined
-
-        delete atms[atmID];       // Free memory for the ATM object
+        closing.push_back(std::make_pair(atmID, atms[atmID]));
         atms[atmID] = nullptr;    // Set the pointer to nullptr
-
-        logTransaction("Bank: ATM " + std::to_string(atmID) + " successfully closed\n");
-Lock.releaseWriteLock(); 
             
  } else {
-	logTransaction("Error " + std::to_string(sourceATMID) +
-					": Your transaction failed – ATM ID " + std::to_string(atmID) + " does not exist\n");
+	logTransaction(TxEvent::atmFailure(TX_ERROR_ATM_MISSING, sourceATMID, atmID));
 
  }
 
@@ -244,22 +692,44 @@ Lock.releaseWriteLock();
 
     atmClosureLock.releaseWriteLock();
     atmLock.releaseWriteLock();
+
+    for (const auto& entry : closing) {
+        ATM* atm = entry.second;
+        atm->closeATM(); // Signal the ATM to close, it is woken up if it is pacing
+
+        ReadWriteLock& Lock = atm->getATMLock();
+        Lock.acquireWriteLock(); // Wait for a command in flight, no new one starts once `stop` is set
+        Lock.releaseWriteLock();
+
+        atm->join();      // Ensure the thread is joined
+        sessions.forgetATM(atm->getId());
+        if (atmOwned[entry.first]) {
+            delete atm;       // Free memory for the ATM object
+        }
+
+        TxEvent event = TxEvent::make(TX_ATM_CLOSED, 0, 0);
+        event.detail.op.otherId = entry.first;
+        logTransaction(event);
+    }
 }
 
 
 
-void Bank::registerATM(ATM* atm) {
+int Bank::registerATM(ATM* atm, bool owned) {
 	atmLock.acquireWriteLock();
+	int atmIndex = atms.size();
 	atms.push_back(atm);
 	atmStates.push_back(true); // Mark as open
+	atmOwned.push_back(owned);
 	atmLock.releaseWriteLock();
+	return atmIndex;
 }
 
 
 bool Bank::addRestoreRequest(int R, int atmId) {
 	restoreLock.acquireWriteLock();
 
-	if (R < 1 || R > static_cast<int>(totalSavedStates)){
+	if (R < 1 || static_cast<size_t>(R) > restorableStates()){
 		restoreLock.releaseWriteLock();
 		return false;
 	}
@@ -284,44 +754,187 @@ void Bank::restoreRequestsHandler() {
 
 }
 
-BankState Bank::getCurrentState() {
-    BankState currentState;
-
-    // Deep copy: copy the actual Account objects
-    for (const auto& accountPair : accounts) {
-        currentState.accounts[accountPair.first] = *accountPair.second;  // Copy Account by value
+long long Bank::getCurrentState(BankState& state) {
+	EpochGuard guard;
+	const AccountDirectory& current = directory();
+	state.reset(current.size());
+
+    // Copy the values out of the live accounts, ids come sorted from the directory
+    // A deleted account stays listed until deleteAccount unpublishes it, it is already gone
+    long long total = 0;
+    for (const auto& accountPair : current) {
+        if (accountPair.second->isClosed()) {
+            continue;
+        }
+        int balance = accountPair.second->getBalance();
+        state.add(accountPair.first, balance, accountPair.second->getPassword());
+        total += balance;
     }
-
-    return currentState;
+    return total;
 }
 
 void Bank::applyState(const BankState& state) {
 	rwLock.acquireWriteLock();
-    // Step 1: Update or restore accounts in the current state
-	 for (const auto& pair : state.accounts) {
-	        const int& id = pair.first;
-	        const Account& restoredAccount = pair.second;
+	MoneyAudit::Change change(audit); // Every balance the rollback sets is booked as restored
+	const AccountDirectory* current = accounts.load(std::memory_order_relaxed);
+	int64_t rolledBackAt = TxEvent::make(TX_ROLLBACK, 0, 0).timestamp; // Of the statement entries it adds
 
-	        if (accounts.find(id) != accounts.end()) {
+    // Step 1: Update or restore accounts in the current state
+	std::vector<AccountDirectory::Entry> restored;
+	restored.reserve(state.size());
+	 for (const AccountRecord& restoredAccount : state) {
+	        const int& id = restoredAccount.id;
+
+	        Account* account = current->find(id);
+	        if (account != nullptr) {
+	            account->lockWrite();
+	            if (account->isClosed()) {
+	                // Deleted but not unpublished yet, its deleteAccount books and retires it
+	                account->unlockWrite();
+	                account = nullptr;
+	            }
+	        }
+	        if (account != nullptr) {
 	            // Update existing account
-	            accounts[id]->setBalance(restoredAccount.getBalance());
+	            int previous = account->getBalance();
+	            audit.restored(restoredAccount.balance - previous);
+	            account->setBalance(restoredAccount.balance);
+	            if (restoredAccount.balance != previous) {
+	                accountHistory.restored(id, restoredAccount.balance - previous, restoredAccount.balance, rolledBackAt);
+	            }
+	            if (recorder != nullptr) {
+	                recorder->setBalance(id, restoredAccount.balance);
+	            }
+	            account->unlockWrite();
 	        } else {
 	            // Add account from restored state
-	            accounts[id] = new Account(restoredAccount);
+	            account = allocateAccount(id, restoredAccount.password, restoredAccount.balance);
+	            audit.restored(restoredAccount.balance);
+	            accountHistory.restored(id, restoredAccount.balance, restoredAccount.balance, rolledBackAt);
+	            if (recorder != nullptr) {
+	                recorder->opened(id, restoredAccount.password, restoredAccount.balance); // Unreachable until published
+	            }
 	        }
+	        restored.push_back(AccountDirectory::Entry(id, account)); // Snapshots are sorted by id
 	    }
 
-    // Step 2: Remove accounts not present in the restored state
-    for (auto it = accounts.begin(); it != accounts.end();) {
-        if (state.accounts.find(it->first) == state.accounts.end()) {
-			delete it->second;
-            it = accounts.erase(it); // Remove account
-        } else {
-            ++it;
+    // Step 2: Close accounts not present in the restored state, commands that
+    // already hold them see the flag once they get the account lock
+    std::vector<Account*> removed;
+    for (const auto& pair : *current) {
+        if (state.find(pair.first) == nullptr) {
+            pair.second->lockWrite();
+            if (pair.second->isClosed()) {
+                pair.second->unlockWrite(); // Already deleted, see above
+                continue;
+            }
+            audit.restored(-pair.second->getBalance());
+            pair.second->markClosed();
+            accountHistory.forget(pair.first); // Under the account lock, as in deleteAccount
+            if (recorder != nullptr) {
+                recorder->closed(pair.first);
+            }
+            pair.second->unlockWrite();
+            removed.push_back(pair.second);
+        }
+    }
+    publishDirectory(new AccountDirectory(restored));
+
+    // Accounts may have been destroyed and recreated, every ATM has to log in again
+    sessions.clear();
+
+    // A restore changes any number of balances, reindex everything in one go
+    if (balanceIndex.enabled()) {
+        std::vector<BalanceIndex::Entry> all;
+        all.reserve(state.size());
+        for (const AccountRecord& record : state) {
+            all.push_back(std::make_pair(record.id, record.balance));
         }
+        balanceIndex.rebuild(all);
     }
 	rwLock.releaseWriteLock();
 
+    for (Account* account : removed) {
+        retireAccount(account);
+    }
+}
+
+const AccountDirectory& Bank::directory() const {
+	return *accounts.load(std::memory_order_acquire);
+}
+
+void Bank::publishDirectory(AccountDirectory* next) {
+	const AccountDirectory* previous = accounts.exchange(next, std::memory_order_acq_rel);
+	EpochDomain::instance().retire(const_cast<AccountDirectory*>(previous), Bank::reclaimDirectory, nullptr);
+}
+
+void Bank::retireAccount(Account* account) {
+	EpochDomain::instance().retire(account, Bank::reclaimAccount, this);
+}
+
+void Bank::reclaimDirectory(void* directory, void*) {
+	delete static_cast<AccountDirectory*>(directory);
+}
+
+void Bank::reclaimAccount(void* account, void* bank) {
+	static_cast<Bank*>(bank)->accountPool.destroy(static_cast<Account*>(account));
+}
+
+Account* Bank::findAccount(int accountId, const std::string& password, int atmID, bool& authenticated) {
+	authenticated = false;
+	if (password == SESSION_PASSWORD) {
+		Account* account = sessions.find(atmID, accountId);
+		if (account != nullptr && !account->isClosed()) {
+			authenticated = true;
+			return account;
+		}
+	}
+	return directory().find(accountId);
+}
+
+Account* Bank::lockAccount(int accountId, const std::string& password, int atmID, bool write, bool& authenticated) {
+	return lockAccountAs<DefaultPolicy>(accountId, password, atmID, write, authenticated);
+}
+
+bool Bank::login(int accountId, const std::string& password, int atmID, bool isPersist) {
+	EpochGuard guard;
+	Account* account = directory().find(accountId);
+	if (account != nullptr) {
+		account->lockRead();
+		if (account->isClosed()) {
+			account->unlockRead();
+			account = nullptr;
+		}
+	}
+	if (account == nullptr) {
+		if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
+		}
+		return false;
+	}
+
+	if (!account->verifyPassword(password)) {
+		if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
+		}
+		account->unlockRead();
+		return false;
+	}
+
+	// Opened under the account lock, a delete or restore closes the account and drops it afterwards
+	sessions.open(atmID, accountId, account);
+	account->unlockRead();
+	logTransaction(TxEvent::make(TX_LOGIN, atmID, accountId, 0, 0));
+	return true;
+}
+
+Account* Bank::allocateAccount(int id, const std::string& password, int balance) {
+	Account* account = accountPool.create(id, password, balance);
+	account->attachLedger(audit.balances());
+	if (std::find(config.hotAccounts.begin(), config.hotAccounts.end(), id) != config.hotAccounts.end()) {
+		account->makeHot();
+	}
+	return account;
 }
 
 bool Bank::createAccount(int id, const std::string& password, int balance, int atmID, bool isPersist) {
@@ -329,26 +942,39 @@ bool Bank::createAccount(int id, const std::string& password, int balance, int a
 	rwLock.acquireWriteLock();
 
 	// Check if the account already exists
-	if (accounts.find(id) != accounts.end()) {
+	// A deleted account is gone even while it waits to be unpublished, the new one replaces it
+	const AccountDirectory& current = directory();
+	Account* existing = current.find(id);
+	if (existing != nullptr && !existing->isClosed()) {
 
 		if(!isPersist){
 			// Log the error message
-			logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account with the same id exists\n");
+			logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_EXISTS, atmID, id));
 		}
 		rwLock.releaseWriteLock();
 		return false; // Account creation failed
 	}
 
-	// Create a new account and insert it into the map
-	Account* newAccount = new Account(id, password, balance);
-	accounts[id] = newAccount;
+	// Create a new account and publish a directory that contains it
+	// The opening is logged before any command that finds the account can change it
+	// Published inside the change, a saved state that counts its balance also lists it
+	Account* newAccount;
+	{
+		MoneyAudit::Change change(audit);
+		newAccount = allocateAccount(id, password, balance);
+		audit.deposited(balance);
+		newAccount->lockWrite();
+		publishDirectory(current.with(id, newAccount));
+	}
+	balanceIndex.update(id, balance);
 
-	logTransaction(
-				std::to_string(atmID) + ": New account id is " + std::to_string(id)
-						+ " with password " + password + " and initial balance "
-						+ std::to_string(balance) + "\n");
+	TxEvent event = TxEvent::make(TX_ACCOUNT_OPENED, atmID, id, 0, balance);
+	password.copy(event.detail.password, TX_PASSWORD_CAPACITY); // log.bin appends the rest if it does not fit
+	logTransaction(event, password.c_str());
+	newAccount->unlockWrite();
 	// Release the lock on the accounts map
 	rwLock.releaseWriteLock();
+	waitList.notify(id, balance);
 	return true;
 }
 
@@ -356,25 +982,20 @@ bool Bank::deleteAccount(int id, const std::string& password,int atmID, bool isP
 
 	Account* account = nullptr;
 
-	//Read lock to check existence of the account
-	rwLock.acquireReadLock();
-	auto it = accounts.find(id);
-	if (it == accounts.end()) {
+	//Lock the specific account to ensure no operations are ongoing
+	EpochGuard guard;
+	bool authenticated = false;
+	account = lockAccount(id, password, atmID, true, authenticated);
+	if (account == nullptr) {
 		if(!isPersist){
-		logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(id)+" does not exist\n");
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, id));
 		}
-		rwLock.releaseReadLock();
 		return false; // Account does not exist
 	}
-	account = it->second;
-
-	//Lock the specific account to ensure no operations are ongoing
-	account->lockWrite();
-	rwLock.releaseReadLock();
 
-	if (!account->verifyPassword(password)) {
+	if (!authenticated && !account->verifyPassword(password)) {
 		if(!isPersist){
-		logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – password for account id "+std::to_string(id)+" is incorrect\n");
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, id));
 		}
 		account->unlockWrite();
 		return false; // Incorrect password
@@ -382,490 +1003,1041 @@ bool Bank::deleteAccount(int id, const std::string& password,int atmID, bool isP
 
 	int balance = account->getBalance();
 
-	//Safely remove and delete the account
+	// Commands waiting for the account lock find it closed from now on, and saved states
+	// leave it out while it is still listed, as its balance has left the running total
+	{
+		MoneyAudit::Change change(audit);
+		account->markClosed();
+		audit.withdrew(balance);
+	}
+	logTransaction(TxEvent::make(TX_ACCOUNT_CLOSED, atmID, id, 0, balance));
+	accountHistory.forget(id); // Still under the account lock, no change can be appended meanwhile
+	balanceIndex.remove(id);
+	account->unlockWrite();
+
+	//Safely remove the account, it is freed once no command can still reach it
 	rwLock.acquireWriteLock();
-	accounts.erase(it);
+	if (directory().find(id) == account) { // Unless a new account or a rollback took the id meanwhile
+		publishDirectory(directory().without(id));
+	}
+	sessions.forgetAccount(id, account);
 	rwLock.releaseWriteLock();
-
-	//Release account lock and delete the account
-	logTransaction(std::to_string(atmID)+": Account "+std::to_string(id)+" is now closed. Balance was "+std::to_string(balance)+"\n");
-	account->unlockWrite();
-	delete account;
+	retireAccount(account);
 
 	return true;
 }
 
 bool Bank::deposit(int accountId, int amount, const std::string& password, int atmID, bool isPersist) {
+	return depositAs<DefaultPolicy>(accountId, amount, password, atmID, isPersist);
+}
+
+template <class Policy>
+Account* Bank::lockAccountAs(int accountId, const std::string& password, int atmID, bool write, bool& authenticated) {
+	typedef typename Policy::Access Access;
+	Account* account = findAccount(accountId, password, atmID, authenticated);
+	if (account == nullptr) {
+		return nullptr;
+	}
+	if (write) {
+		Access::lockWrite(account);
+	} else {
+		Access::lockRead(account);
+	}
+	if (account->isClosed()) { // Deleted between the lookup and the lock
+		if (write) {
+			Access::unlockWrite(account);
+		} else {
+			Access::unlockRead(account);
+		}
+		return nullptr;
+	}
+	return account;
+}
+
+template <class Policy>
+void Bank::logTransactionAs(const TxEvent& event) {
+	if (recorder != nullptr) {
+		recorder->record(event); // In the order the changes were applied, see TraceRecorder
+	}
+	if (Policy::Events::enabled) {
+		transactionLog.record(event);
+	}
+	accountHistory.record(event); // Called under the locks of the accounts the event changes
+}
+
+template <class Policy>
+bool Bank::depositAs(int accountId, int amount, const std::string& password, int atmID, bool isPersist) {
+	typedef typename Policy::Access Access;
 	Account* account = nullptr;
 
-	//Acquire a read lock to locate the account
-	rwLock.acquireReadLock();
-	auto it = accounts.find(accountId);
-	if (it == accounts.end()) {
+	//Locate and lock the account, the epoch keeps it allocated
+	typename Access::Guard guard;
+	bool authenticated = false;
+	account = lockAccountAs<Policy>(accountId, password, atmID, true, authenticated);
+	if (account == nullptr) {
 
-		if(!isPersist){
+		if(Policy::logFailure(isPersist)){
 		// Log the error: incorrect password
-		logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(accountId)+" does not exist\n");
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
 		}
-		rwLock.releaseReadLock();
+		Policy::Instrument::failed();
 		return false;
 	}
-	account = it->second;
-
-	account->lockWrite();
-	rwLock.releaseReadLock();
 
 	//Verify the password
-	if (!account->verifyPassword(password)) {
+	if (!authenticated && !account->verifyPassword(password)) {
 
-		if(!isPersist){
+		if(Policy::logFailure(isPersist)){
 		// Log the error: incorrect password
-		logTransaction("Error: Deposit failed for account ID " + std::to_string(accountId) +
-				" - incorrect password\n");
+		logTransaction(TxEvent::failure(TX_ERROR_DEPOSIT_PASSWORD, atmID, accountId));
 		}
-		account->unlockWrite();
+		Access::unlockWrite(account);
+		Policy::Instrument::failed();
 		return false;
 	}
 	//Perform the deposit
-	account->deposit(amount);
+	{
+		MoneyAudit::Change change(audit);
+		account->deposit(amount);
+		audit.deposited(amount);
+	}
 
 	// Log the successful deposit
-	logTransaction( std::to_string(atmID) + ": Account "
-			+ std::to_string(accountId) + " new balance is "
-			+ std::to_string(account->getBalance()) +" after "
-			+ std::to_string(amount) + " $ was deposited\n");
+	int balance = account->getBalance();
+	logTransactionAs<Policy>(TxEvent::make(TX_DEPOSIT, atmID, accountId, amount, balance));
+	balanceIndex.update(accountId, balance);
 
 
 	//Unlock the account
-	account->unlockWrite();
+	Access::unlockWrite(account);
+	waitList.notify(accountId, balance);
+	Policy::Instrument::applied();
 	return true;
 }
 
 bool Bank::withdraw(int accountId, int amount, const std::string& password, int atmID, bool isPersist) {
+	return withdrawAs<DefaultPolicy>(accountId, amount, password, atmID, isPersist);
+}
+
+template <class Policy>
+bool Bank::withdrawAs(int accountId, int amount, const std::string& password, int atmID, bool isPersist) {
+	typedef typename Policy::Access Access;
 	Account* account = nullptr;
 
-	// Step 1: Acquire a read lock to locate the account
-	rwLock.acquireReadLock();
-	auto it = accounts.find(accountId);
-	if (it == accounts.end()) {
-		if(!isPersist){
+	// Step 1: Locate and lock the account, the epoch keeps it allocated
+	typename Access::Guard guard;
+	bool authenticated = false;
+	account = lockAccountAs<Policy>(accountId, password, atmID, true, authenticated);
+	if (account == nullptr) {
+		if(Policy::logFailure(isPersist)){
 		// Log the error: account does not exist
-		logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(accountId)+" does not exist\n");
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
 		}
-		rwLock.releaseReadLock();
+		Policy::Instrument::failed();
 
 		return false;
 	}
-	account = it->second;
-
-	account->lockWrite();
-	rwLock.releaseReadLock();
 
 	//Verify the password
-	if (!account->verifyPassword(password)) {
+	if (!authenticated && !account->verifyPassword(password)) {
 
-		if(!isPersist){
+		if(Policy::logFailure(isPersist)){
 		// Log the error: incorrect password
-		logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – password for account id "+std::to_string(accountId)+" is incorrect\n");
-		account->unlockWrite();
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
 		}
+		Access::unlockWrite(account);
+		Policy::Instrument::failed();
 		return false;
 	}
 	//Check if the account has sufficient balance
 	if (account->getBalance() < amount) {
-		if(!isPersist){
+		if(Policy::logFailure(isPersist)){
 		// Log the error: insufficient balance
-		logTransaction(
-				"Error " + std::to_string(atmID)
-						+ ": Your transaction failed – account id "
-						+ std::to_string(accountId) + " balance is lower than "
-						+ std::to_string(amount) + "\n");
+		logTransaction(TxEvent::failure(TX_ERROR_LOW_BALANCE, atmID, accountId, amount));
 		}
-		account->unlockWrite();
+		Access::unlockWrite(account);
+		Policy::Instrument::failed();
 
 		return false;
 	}
 
 	//Perform the withdrawal
-	account->withdraw(amount);
+	{
+		MoneyAudit::Change change(audit);
+		account->withdraw(amount);
+		audit.withdrew(amount);
+	}
 
 	// Log the successful withdrawal
-
-	logTransaction( std::to_string(atmID) + ": Account "
-				+ std::to_string(accountId) + " new balance is "
-				+ std::to_string(account->getBalance()) +" after "
-				+ std::to_string(amount) + " $ was withdrawn\n");
+	logTransactionAs<Policy>(TxEvent::make(TX_WITHDRAW, atmID, accountId, amount, account->getBalance()));
+	balanceIndex.update(accountId, account->getBalance());
 
 	//Unlock the account
-	account->unlockWrite();
+	Access::unlockWrite(account);
+	Policy::Instrument::applied();
 
 	return true;
 }
 
 bool Bank::getBalance(int accountId, const std::string& password, int atmID, bool isPersist) {
+	return getBalanceAs<DefaultPolicy>(accountId, password, atmID, isPersist);
+}
+
+template <class Policy>
+bool Bank::getBalanceAs(int accountId, const std::string& password, int atmID, bool isPersist) {
+    typedef typename Policy::Access Access;
     Account* account = nullptr;
 
-    //Acquire a read lock to locate the account
-    rwLock.acquireReadLock();
-    auto it = accounts.find(accountId);
-    if (it == accounts.end()) {
+    //Locate and lock the account, the epoch keeps it allocated
+    typename Access::Guard guard;
+    bool authenticated = false;
+    account = lockAccountAs<Policy>(accountId, password, atmID, false, authenticated);
+    if (account == nullptr) {
 
-        // Log the error: account does not exist
-        logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(accountId)+" does not exist\n");
-        rwLock.releaseReadLock();
+        // Log the error: account does not exist, even for a persistent command
+        if (Policy::logFailure(false)) {
+        logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
+        }
+        Policy::Instrument::failed();
         return false;
     }
 
-    account = it->second;
-    account->lockRead();
-    rwLock.releaseReadLock();
-
     //Verify the password
-    if (!account->verifyPassword(password)) {
-    	if(!isPersist){
+    if (!authenticated && !account->verifyPassword(password)) {
+    	if(Policy::logFailure(isPersist)){
         // Log the error: incorrect password
-		logTransaction(
-				"Error " + std::to_string(atmID)
-						+ ": Your transaction failed – password for account id "
-						+ std::to_string(accountId) + " is incorrect\n");
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
     	}
-		  account->unlockRead();
+		  Access::unlockRead(account);
+        Policy::Instrument::failed();
 
         return false;
     }
 
     //Retrieve the balance
     int balance = account->getBalance();
+    if (Policy::Events::enabled) {
 	account->getLogLock().acquireWriteLock();
 	// Log the successful balance check
-	logTransaction(
-			std::to_string(atmID) + ": Account " + std::to_string(accountId)
-					+ " balance is " + std::to_string(balance) + "\n");
+	logTransactionAs<Policy>(TxEvent::make(TX_BALANCE, atmID, accountId, 0, balance));
 	account->getLogLock().releaseWriteLock();
+    } else {
+	logTransactionAs<Policy>(TxEvent::make(TX_BALANCE, atmID, accountId, 0, balance)); // Still traced
+    }
 
     //Unlock the account
-    account->unlockRead();
+    Access::unlockRead(account);
+    Policy::Instrument::applied();
 
     return true; // Return the balance
 }
 
+bool Bank::statement(int accountId, const std::string& password, int count, int atmID, bool isPersist) {
+    Account* account = nullptr;
+
+    //Locate and lock the account, the epoch keeps it allocated
+    EpochGuard guard;
+    bool authenticated = false;
+    account = lockAccount(accountId, password, atmID, false, authenticated);
+    if (account == nullptr) {
+        if(!isPersist){
+        logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
+        }
+        return false;
+    }
+
+    //Verify the password
+    if (!authenticated && !account->verifyPassword(password)) {
+    	if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
+    	}
+		account->unlockRead();
+        return false;
+    }
+
+    // Copy the entries out, the account lock keeps new ones from being appended meanwhile
+    std::vector<HistoryEntry> entries;
+    accountHistory.latest(accountId, count > 0 ? count : 0, entries);
+
+	account->getLogLock().acquireWriteLock();
+    for (const HistoryEntry& entry : entries) {
+        TxEvent event = TxEvent::make(TX_STATEMENT, atmID, accountId, entry.amount, entry.balance);
+        event.timestamp = entry.timestamp;
+        event.detail.op.otherId = entry.otherId;
+        event.detail.op.entryType = entry.type;
+        logTransaction(event);
+    }
+	account->getLogLock().releaseWriteLock();
+
+    account->unlockRead();
+    return true;
+}
+
 bool Bank::transfer(int srcId, const std::string& password, int destId, int amount, int atmID, bool isPersist) {
+    return transferAs<DefaultPolicy>(srcId, password, destId, amount, atmID, isPersist);
+}
+
+template <class Policy>
+bool Bank::transferAs(int srcId, const std::string& password, int destId, int amount, int atmID, bool isPersist) {
+    typedef typename Policy::Access Access;
     Account* srcAccount = nullptr;
     Account* destAccount = nullptr;
 
     //Locate both source and destination accounts
-    rwLock.acquireReadLock();
+    typename Access::Guard guard;
 
-    auto srcIt = accounts.find(srcId);
-    auto destIt = accounts.find(destId);
+    bool authenticated = false;
+    srcAccount = findAccount(srcId, password, atmID, authenticated);
+    destAccount = directory().find(destId);
 
-    if (srcIt == accounts.end() || destIt == accounts.end()) {
+    if (srcAccount == nullptr || destAccount == nullptr) {
 
         // Log the error: one or both accounts do not exist
-        if (srcIt == accounts.end()) {
-        	if(!isPersist){
-        	logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(srcId)+" does not exist\n");
+        if (srcAccount == nullptr) {
+        	if(Policy::logFailure(isPersist)){
+        	logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, srcId));
         	}
-        	rwLock.releaseReadLock();
+        	Policy::Instrument::failed();
         	return false;
         }
-        if (destIt == accounts.end()) {
-        	if(!isPersist){
-        	logTransaction("Error "+std::to_string(atmID)+": Your transaction failed – account id "+std::to_string(destId)+" does not exist\n");
+        if (destAccount == nullptr) {
+        	if(Policy::logFailure(isPersist)){
+        	logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, destId));
         	}
-        	rwLock.releaseReadLock();
+        	Policy::Instrument::failed();
         	return false;
         }
     }
-    srcAccount = srcIt->second;
-    destAccount = destIt->second;
 
-    //Lock accounts in consistent order to avoid deadlocks
-	if (srcId < destId) {
-		srcAccount->lockWrite();
-		destAccount->lockWrite();
+    //Lock accounts in consistent order to avoid deadlocks, a transfer to itself locks its account once
+    auto unlockBoth = [srcAccount, destAccount]() {
+        Access::unlockWrite(srcAccount);
+        if (destAccount != srcAccount) {
+            Access::unlockWrite(destAccount);
+        }
+    };
+	if (srcAccount == destAccount) {
+		Access::lockWrite(srcAccount);
+	} else if (srcId < destId) {
+		Access::lockWrite(srcAccount);
+		Access::lockWrite(destAccount);
 	} else {
-		destAccount->lockWrite();
-		srcAccount->lockWrite();
+		Access::lockWrite(destAccount);
+		Access::lockWrite(srcAccount);
 	}
 
-	rwLock.releaseReadLock();
+	// Either one may have been deleted before we got its lock
+	if (srcAccount->isClosed() || destAccount->isClosed()) {
+		if(Policy::logFailure(isPersist)){
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID,
+				srcAccount->isClosed() ? srcId : destId));
+		}
+		unlockBoth();
+		Policy::Instrument::failed();
+		return false;
+	}
 
 	//Verify the source account's password
-	if (!srcAccount->verifyPassword(password)) {
-		if(!isPersist){
-		logTransaction(
-				"Error " + std::to_string(atmID)
-						+ ": Your transaction failed – password for account id "
-						+ std::to_string(srcId) + " is incorrect\n");
+	if (!authenticated && !srcAccount->verifyPassword(password)) {
+		if(Policy::logFailure(isPersist)){
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, srcId));
 		}
-		srcAccount->unlockWrite();
-		destAccount->unlockWrite();
+		unlockBoth();
+		Policy::Instrument::failed();
 		return false;
 	}
 
     //Check for sufficient balance in the source account
     if (srcAccount->getBalance() < amount) {
-    	if(!isPersist){
+    	if(Policy::logFailure(isPersist)){
         // Log the error: insufficient balance
-        logTransaction(
-        				"Error " + std::to_string(atmID)
-        						+ ": Your transaction failed – account id "
-        						+ std::to_string(srcId) + " balance is lower than "
-        						+ std::to_string(amount) + "\n");
+        logTransaction(TxEvent::failure(TX_ERROR_LOW_BALANCE, atmID, srcId, amount));
     	}
-        srcAccount->unlockWrite();
-        destAccount->unlockWrite();
+        unlockBoth();
+        Policy::Instrument::failed();
         return false;
     }
 
     //Perform the transfer
-    srcAccount->withdraw(amount);
-    destAccount->deposit(amount);
+    {
+        MoneyAudit::Change change(audit); // Moves between accounts, no flow to book
+        srcAccount->withdraw(amount);
+        destAccount->deposit(amount);
+    }
 
     // Log the successful transfer
-    logTransaction(std::to_string(atmID) + ": Transfer "
-			+ std::to_string(amount) + " from account "
-			+ std::to_string(srcId) + " to account "
-			+ std::to_string(destId) + " new account balance is "
-			+ std::to_string(srcAccount->getBalance())
-	+ " new target account balance is "
-	+ std::to_string(destAccount->getBalance()) + "\n");
+    TxEvent event = TxEvent::make(TX_TRANSFER, atmID, srcId, amount, srcAccount->getBalance());
+    event.detail.op.otherId = destId;
+    event.detail.op.otherBalance = destAccount->getBalance();
+    logTransactionAs<Policy>(event);
+    balanceIndex.update(srcId, srcAccount->getBalance());
+    balanceIndex.update(destId, destAccount->getBalance());
+    int destBalance = destAccount->getBalance();
 
     //Unlock both accounts
-    srcAccount->unlockWrite();
-    destAccount->unlockWrite();
+    unlockBoth();
+    waitList.notify(destId, destBalance);
 
+    Policy::Instrument::applied();
     return true;
 	
 }
 
+// The policies other modes run the operations with, see bank_policy.h
+#define BANK_INSTANTIATE_POLICY(Policy) \
+	template bool Bank::depositAs<Policy>(int, int, const std::string&, int, bool); \
+	template bool Bank::withdrawAs<Policy>(int, int, const std::string&, int, bool); \
+	template bool Bank::getBalanceAs<Policy>(int, const std::string&, int, bool); \
+	template bool Bank::transferAs<Policy>(int, const std::string&, int, int, int, bool);
+
+BANK_INSTANTIATE_POLICY(CountedPolicy)
+BANK_INSTANTIATE_POLICY(UnloggedPolicy)
+BANK_INSTANTIATE_POLICY(SingleWriterPolicy)
+BANK_INSTANTIATE_POLICY(SingleWriterUnloggedPolicy)
+
+bool Bank::hasAccount(int id) {
+    EpochGuard guard;
+    Account* account = directory().find(id);
+    if (account == nullptr) {
+        return false;
+    }
+    account->lockRead();
+    bool open = !account->isClosed();
+    account->unlockRead();
+    return open;
+}
+
+bool Bank::prepareDebit(const BankCommand& command, bool destExists, bool isPersist, int& balance) {
+    std::string password(command.password);
+    int srcId = command.accountId;
+    int atmID = command.atmId;
+
+    // Same checks in the same order as transfer, the destination's vote stands in for its lookup
+    EpochGuard guard;
+    bool authenticated = false;
+    Account* srcAccount = lockAccount(srcId, password, atmID, true, authenticated);
+    if (srcAccount == nullptr || !destExists) {
+        if (!isPersist) {
+            logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, srcAccount == nullptr ? srcId : command.destId));
+        }
+        if (srcAccount != nullptr) {
+            srcAccount->unlockWrite();
+        }
+        return false;
+    }
+    if (!authenticated && !srcAccount->verifyPassword(password)) {
+        if (!isPersist) {
+            logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, srcId));
+        }
+        srcAccount->unlockWrite();
+        return false;
+    }
+    if (srcAccount->getBalance() < command.amount) {
+        if (!isPersist) {
+            logTransaction(TxEvent::failure(TX_ERROR_LOW_BALANCE, atmID, srcId, command.amount));
+        }
+        srcAccount->unlockWrite();
+        return false;
+    }
+    {
+        MoneyAudit::Change change(audit);
+        srcAccount->withdraw(command.amount);
+        audit.moved(-command.amount); // Reserved for the destination's partition
+    }
+    balance = srcAccount->getBalance();
+    balanceIndex.update(srcId, balance);
+    srcAccount->unlockWrite();
+    return true;
+}
+
+bool Bank::commitCredit(const BankCommand& command, int& balance) {
+    EpochGuard guard;
+    Account* destAccount = directory().find(command.destId);
+    if (destAccount == nullptr) {
+        return false;
+    }
+    destAccount->lockWrite();
+    if (destAccount->isClosed()) {
+        destAccount->unlockWrite();
+        return false;
+    }
+    {
+        MoneyAudit::Change change(audit);
+        destAccount->deposit(command.amount);
+        audit.moved(command.amount);
+    }
+    balance = destAccount->getBalance();
+
+    // The source's process logs the transfer, only the credit side is kept here
+    TxEvent event = TxEvent::make(TX_TRANSFER, command.atmId, command.accountId, command.amount, 0);
+    event.detail.op.otherId = command.destId;
+    event.detail.op.otherBalance = balance;
+    accountHistory.recordSide(event, command.destId);
+    balanceIndex.update(command.destId, balance);
+    destAccount->unlockWrite();
+    waitList.notify(command.destId, balance);
+    return true;
+}
+
+void Bank::abortDebit(const BankCommand& command) {
+    EpochGuard guard;
+    Account* srcAccount = directory().find(command.accountId);
+    if (srcAccount == nullptr) {
+        return;
+    }
+    srcAccount->lockWrite();
+    if (!srcAccount->isClosed()) {
+        MoneyAudit::Change change(audit);
+        srcAccount->deposit(command.amount);
+        audit.moved(command.amount); // The reservation comes back
+        balanceIndex.update(command.accountId, srcAccount->getBalance());
+    }
+    int balance = srcAccount->getBalance();
+    srcAccount->unlockWrite();
+    waitList.notify(command.accountId, balance);
+}
+
+void Bank::commitDebit(const BankCommand& command, int balance, int destBalance) {
+    TxEvent event = TxEvent::make(TX_TRANSFER, command.atmId, command.accountId, command.amount, balance);
+    event.detail.op.otherId = command.destId;
+    event.detail.op.otherBalance = destBalance;
+
+    // Under the source's lock, so its history stays in the order of its changes
+    EpochGuard guard;
+    Account* srcAccount = directory().find(command.accountId);
+    if (srcAccount != nullptr) {
+        srcAccount->lockWrite();
+    }
+    transactionLog.record(event);
+    accountHistory.recordSide(event, command.accountId);
+    if (srcAccount != nullptr) {
+        srcAccount->unlockWrite();
+    }
+}
+
+bool Bank::balanceAt(int accountId, const std::string& password, int ticksAgo, int atmID, bool isPersist) {
+	AccountRecord found = {0, 0, nullptr};
+	bool passwordMatches = false;
+	bool known = readHistory(ticksAgo, [&](const BankState& state) {
+		const AccountRecord* record = state.find(accountId); // Binary search, nothing is copied
+		if (record != nullptr) {
+			found = *record;
+			passwordMatches = password == record->password;
+		}
+	});
+	if (!known) {
+		logTransaction(TxEvent::failure(TX_ERROR_NO_STATE, atmID, accountId, ticksAgo));
+		return false;
+	}
+	if (found.password == nullptr) {
+		if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, atmID, accountId));
+		}
+		return false;
+	}
+
+	bool authenticated = password == SESSION_PASSWORD && sessions.find(atmID, accountId) != nullptr;
+	if (!authenticated && !passwordMatches) {
+		if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
+		}
+		return false;
+	}
+	logTransaction(TxEvent::make(TX_BALANCE_AT, atmID, accountId, ticksAgo, found.balance));
+	return true;
+}
+
+bool Bank::historyTotals(int ticksAgo, int& accounts, long long& total) {
+	total = 0;
+	accounts = 0;
+	return readHistory(ticksAgo, [&](const BankState& state) {
+		for (const AccountRecord& record : state) {
+			total += record.balance;
+		}
+		accounts = static_cast<int>(state.size());
+	});
+}
+
+bool Bank::totalsAt(int ticksAgo, int atmID) {
+	long long total = 0;
+	int count = 0;
+	bool known = partitions != nullptr ? partitions->totals(ticksAgo, count, total)
+			: historyTotals(ticksAgo, count, total);
+	if (!known) {
+		logTransaction(TxEvent::failure(TX_ERROR_NO_STATE, atmID, 0, ticksAgo));
+		return false;
+	}
+	TxEvent event = TxEvent::make(TX_TOTALS_AT, atmID, 0, ticksAgo, static_cast<int>(total & 0xffffffffLL));
+	event.detail.op.otherId = count;
+	event.detail.op.otherBalance = static_cast<int>(total >> 32);
+	logTransaction(event);
+	return true;
+}
+
+void Bank::topAccounts(size_t k, std::vector<BalanceIndex::Entry>& out) const {
+    balanceIndex.top(k, out);
+}
+
+void Bank::accountsInRange(int low, int high, std::vector<BalanceIndex::Entry>& out) const {
+    balanceIndex.range(low, high, out);
+}
+
 void Bank::stop() {
-    // Set the running flag to false to signal threads to stop
-    running = false;
+    // Wakes the timer thread and waits for the job it may be running
+    timers.stop();
 }
 
-void Bank::saveState() {
-	history.saveState(getCurrentState());
+const BankState& Bank::saveState() {
+	BankState& state = *history.nextState();
+	long long quiet = audit.mark();
+	long long total = getCurrentState(state) + bankAccount.getBalance();
+	audit.checkSnapshot(quiet, total); // Balances changed without booking show up here
+	if (!config.timerJobs) {
+		audit.check(); // No audit job runs, so audit on every saved state instead
+	}
+	history.commit(&state);
+	if (recorder != nullptr) {
+		recorder->tick();
+	}
+	published.store(&state, std::memory_order_release);
 	if (totalSavedStates < MAX_STATES) {
         totalSavedStates++;
     }
+	savedSequence.fetch_add(1, std::memory_order_release);
+	if (archive != nullptr) {
+		archive->append(savedSequence, state); // Copied, written out by the archive's own thread
+	}
+	return state;
 }
 
-void Bank::restore(int R, int atmID) {
-	applyState(history.getState(R));
+size_t Bank::restorableStates() const {
+	if (archive == nullptr) {
+		return totalSavedStates;
+	}
+	size_t saved = savedSequence.load(std::memory_order_acquire);
+	size_t onDisk = saved < config.historyRetention ? saved : config.historyRetention;
+	return onDisk > totalSavedStates ? onDisk : totalSavedStates;
+}
 
-	logTransaction(std::to_string(atmID)+": Rollback to " +std::to_string(R)+" bank iterations ago was completed successfully \n");
+// Balance query answered by the query pool, stored inline in the task
+struct BalanceQueryTask {
+    Bank* bank;
+    Completion* completion;
+    long long maxStaleMicros;
+    int accountId;
+    int atmId;
+    bool isPersist;
+    char password[COMMAND_PASSWORD_CAPACITY];
+
+    void operator()() {
+        completion->complete(bank->snapshotBalance(accountId, password, atmId, isPersist, maxStaleMicros));
+    }
+};
 
+bool Bank::queryBalance(int accountId, const std::string& password, int atmID, bool isPersist, long long maxStaleMicros) {
+	if (queryThreadPool == nullptr || password.size() >= COMMAND_PASSWORD_CAPACITY) {
+		return getBalance(accountId, password, atmID, isPersist);
+	}
+
+	Completion completion;
+	BalanceQueryTask task = {this, &completion, maxStaleMicros, accountId, atmID, isPersist, {0}};
+	password.copy(task.password, COMMAND_PASSWORD_CAPACITY - 1);
+	queryThreadPool->submitTask(0, TaskFunction(task));
+	return completion.wait();
+}
+
+bool Bank::snapshotBalance(int accountId, const std::string& password, int atmID, bool isPersist, long long maxStaleMicros) {
+	EpochGuard guard; // Keeps saveState from reusing the snapshot under us
+	const BankState* state = published.load(std::memory_order_acquire);
+	const AccountRecord* record = nullptr;
+	if (state != nullptr && monotonicMicros() - state->getTakenAt() <= maxStaleMicros) {
+		record = state->find(accountId);
+	}
+	if (record == nullptr) {
+		// Too old, or the account is newer than the snapshot: read it live
+		return getBalance(accountId, password, atmID, isPersist);
+	}
+
+	bool authenticated = password == SESSION_PASSWORD && sessions.find(atmID, accountId) != nullptr;
+	if (!authenticated && password != record->password) {
+		if(!isPersist){
+		logTransaction(TxEvent::failure(TX_ERROR_WRONG_PASSWORD, atmID, accountId));
+		}
+		return false;
+	}
+	logTransaction(TxEvent::make(TX_BALANCE, atmID, accountId, 0, record->balance));
+	return true;
+}
+
+void Bank::restore(int R, int atmID) {
+	bool restored = partitions != nullptr ? partitions->restore(R) : restoreState(R);
+	if (restored) {
+		logTransaction(TxEvent::make(TX_ROLLBACK, atmID, 0, R));
+	}
+}
+
+bool Bank::restoreState(int R) {
+	if (static_cast<size_t>(R) <= totalSavedStates) {
+		EpochGuard guard; // Saved states are reused once no reader is left on them
+		applyState(history.getState(R));
+	} else {
+		// Older than the in-memory window, rebuild it from the snapshot file
+		if (archive == nullptr || !archive->load(savedSequence - R + 1, archivedState)) {
+			return false;
+		}
+		applyState(archivedState);
+	}
+	return true;
 }
 
 // ATM Implementation
 ATM::ATM(int id, const std::string& inputFile, Bank* bank) :
-		id(id), stop(false), inputFile(inputFile), bank(bank) , thread(){
+		id(id), stop(false), inputFile(inputFile), bank(bank) , thread(), threadJoined(false),
+		mode(MODE_IDLE), phase(PHASE_START), finished(false), retryDeadline(0), retryWoken(false), server(nullptr), scheduler(nullptr),
+		scheduleGen(0), inStep(false), wakePending(false), scheduleDone(true) {
 	pthread_mutex_init(&stopMutex, nullptr); // Initialize the mutex
+	pthread_mutex_init(&joinMutex, nullptr);
+	retryWaiter.wake = ATM::wakeForRetry;
+	retryWaiter.ctx = this;
+	retryWaiter.queued = false;
+
+	// Pacing waits are absolute monotonic deadlines
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&stopCond, &attr);
+	pthread_condattr_destroy(&attr);
 }
 
 ATM::~ATM() {
+    bank->cancelWait(&retryWaiter); // Stopped while a persistent command was parked
+    pthread_cond_destroy(&stopCond);
+    pthread_mutex_destroy(&joinMutex);
     pthread_mutex_destroy(&stopMutex); // Destroy the mutex
 }
 
 void ATM::start() {
+	mode = MODE_THREAD;
 	pthread_create(&thread, nullptr, ATM::run, this);
+	ThreadPlacement::instance().place(thread, THREAD_ATM, id - 1, "atm " + std::to_string(id));
 }
 
-void ATM::join() {
-	pthread_join(thread, nullptr);
+void ATM::start(AtmScheduler* atmScheduler) {
+	mode = MODE_SCHEDULED;
+	scheduler = atmScheduler;
+	scheduler->schedule(this, 0);
 }
 
-void* ATM::run(void* arg) {
-	ATM* atm = static_cast<ATM*>(arg);
-	std::ifstream file(atm->inputFile);
+void ATM::attach(AtmServer* atmServer) {
+	mode = MODE_SESSION;
+	server = atmServer;
+}
 
-	if (!file.is_open()) {
-		std::cerr << "Error: Could not open file " << atm->inputFile << "\n";
-		return nullptr;
+void ATM::join() {
+	if (mode == MODE_IDLE) {
+		return;
 	}
+	pthread_mutex_lock(&stopMutex);
+	while (!finished) {
+		pthread_cond_wait(&stopCond, &stopMutex);
+	}
+	pthread_mutex_unlock(&stopMutex);
 
-	std::string line;
-	std::getline(file, line);
-	bool isVIP = line.find("VIP") != std::string::npos;
-
-	// Reset the file stream to the beginning
-	file.clear();              // Clear EOF flag
-	file.seekg(0, std::ios::beg); // Seek to the beginning of the file
+	// The bank joins an ATM it closes and main joins every ATM, possibly at the same time
+	pthread_mutex_lock(&joinMutex);
+	if (mode == MODE_THREAD && !threadJoined) {
+		pthread_join(thread, nullptr);
+		threadJoined = true;
+	}
 
-	if(!isVIP){
-		usleep(100000);
+	// Queued VIP commands still refer to this ATM
+	for (const CompletionHandle& pending : vipPending) {
+		pending.wait();
 	}
-	
+	vipPending.clear();
+	pthread_mutex_unlock(&joinMutex);
+}
 
-	while (std::getline(file, line)) {
-		atm->rwLock.acquireWriteLock();
-		atm->processCommand(line); // Process the transaction
-		pthread_mutex_lock(&atm->stopMutex);
-		if (atm->stop) {
-			atm->rwLock.releaseWriteLock();
-			pthread_mutex_unlock(&atm->stopMutex);
+void* ATM::run(void* arg) {
+	ATM* atm = static_cast<ATM*>(arg);
+
+	long delay;
+	while ((delay = atm->step()) >= 0) {
+		if (delay > 0 && atm->waitForStop(delay)) {
 			break;
 		}
-		atm->rwLock.releaseWriteLock();
-		pthread_mutex_unlock(&atm->stopMutex);
-
-		usleep(100000);
 	}
+	atm->markFinished();
 	return nullptr;
 }
 
-void ATM::processCommand(const std::string& command) {
-    std::istringstream iss(command);
-    std::string action;
+long ATM::step() {
+	switch (phase) {
+	case PHASE_START: {
+		file.open(inputFile.c_str());
+		if (!file.is_open()) {
+			std::cerr << "Error: Could not open file " << inputFile << "\n";
+			phase = PHASE_DONE;
+			return -1;
+		}
+
+		std::string line;
+		std::getline(file, line);
+		bool isVIP = line.find("VIP") != std::string::npos;
+
+		// Reset the file stream to the beginning
+		file.clear();              // Clear EOF flag
+		file.seekg(0, std::ios::beg); // Seek to the beginning of the file
+
+		phase = PHASE_NEXT;
+		return isVIP ? 0 : ATM_LINE_DELAY_US;
+	}
+	case PHASE_NEXT: {
+		// Over its rate the ATM comes back for the next line once it may run it
+		long long throttled = bank->admit(id);
+		if (throttled > 0) {
+			return static_cast<long>(throttled);
+		}
+		std::string line;
+		if (!std::getline(file, line)) {
+			phase = PHASE_DONE;
+			return -1;
+		}
 
+		// Closure takes this lock after raising `stop`, so a command never starts once it waits
+		rwLock.acquireWriteLock();
+		if (isStopped()) {
+			rwLock.releaseWriteLock();
+			phase = PHASE_DONE;
+			return -1;
+		}
+		long delay = processCommand(line); // Process the transaction
+		rwLock.releaseWriteLock();
+		return delay;
+	}
+	case PHASE_RETRY: {
+		bank->cancelWait(&retryWaiter); // Timed out, or already woken
+		rwLock.acquireWriteLock();
+		if (isStopped()) {
+			rwLock.releaseWriteLock();
+			phase = PHASE_DONE;
+			return -1;
+		}
+		// Woken before the deadline: try quietly, and wait for the next change if it still fails
+		long long now = monotonicMicros();
+		if (now < retryDeadline) {
+			if (executeCommand(pendingCommand, true)) {
+				rwLock.releaseWriteLock();
+				phase = PHASE_NEXT;
+				return ATM_COMMAND_DELAY_US + ATM_LINE_DELAY_US;
+			}
+			if (parkRetry()) {
+				rwLock.releaseWriteLock();
+				return static_cast<long>(retryDeadline - now);
+			}
+		}
+		executeCommand(pendingCommand, false); // Retry the command
+		rwLock.releaseWriteLock();
+		phase = PHASE_NEXT;
+		return ATM_COMMAND_DELAY_US + ATM_LINE_DELAY_US;
+	}
+	case PHASE_DONE:
+		break;
+	}
+	return -1;
+}
 
+long ATM::processCommand(const std::string& command) {
     bool isVIP = command.find("VIP") != std::string::npos;
     bool isPersistent = command.find("PERSISTENT") != std::string::npos;
 
 
     // If the command is VIP, submit it to the bank's VIP task queue
     if (isVIP) {
-
-    	size_t vipPos = command.find("VIP=");
-    		size_t start = vipPos + 4; // Position of the number after "VIP="
-    		size_t end = command.find(' ', start); // Find the next space after the number
-    		std::string priorityStr = command.substr(start, end - start); // Extract the numeric part
-    		int priority = std::stoi(priorityStr); // Convert to integer
-    	
-
-    	// Submit the command as a task to the VIP thread pool
-    	bank->submitVIPTask(priority, [this, command, isPersistent]() {
-    	    std::istringstream vipIss(command); // Create a stream for parsing
-    	    std::string vipAction;
-
-    	    // Execute the VIP command
-    	    auto vipExecuteCommand = [&](bool isPersist) -> bool {
-				vipIss >> vipAction;
-    	        if (vipAction == "O") { // Open account
-    	            int accountId, balance;
-    	            std::string password;
-    	            vipIss >> accountId >> password >> balance;
-    	            return bank->createAccount(accountId, password, balance, this->id, isPersist);
-    	        } else if (vipAction == "Q") { // Close account
-    	            int accountId;
-    	            std::string password;
-    	            vipIss >> accountId >> password;
-    	            return bank->deleteAccount(accountId, password, this->id, isPersist);
-    	        } else if (vipAction == "D") { // Deposit
-    	            int accountId, amount;
-    	            std::string password;
-    	            vipIss >> accountId >> password >> amount;
-    	            return bank->deposit(accountId, amount, password, this->id, isPersist);
-    	        } else if (vipAction == "W") { // Withdraw
-    	            int accountId, amount;
-    	            std::string password;
-    	            vipIss >> accountId >> password >> amount;
-    	            return bank->withdraw(accountId, amount, password, this->id, isPersist);
-    	        } else if (vipAction == "T") { // Transfer money
-    	            int srcId, destId, amount;
-    	            std::string password;
-    	            vipIss >> srcId >> password >> destId >> amount;
-    	            return bank->transfer(srcId, password, destId, amount, this->id, isPersist);
-    	        } else if (vipAction == "R") { // Restore Bank
-    	            int iterations;
-    	            vipIss >> iterations;
-    	            return bank->addRestoreRequest(iterations, this->id);
-    	        } else if (vipAction == "C") { // Close ATM
-    	        	int targetATMID;
-    	        	vipIss >> targetATMID;
-    	        	return bank->requestATMClosure(targetATMID, this->id, isPersist);
-    	        }
-    	        return false; // Unknown action
-    	    };
-
-    	    // First attempt to execute the command
-    	    bool vipSuccess = vipExecuteCommand(isPersistent);
-
-    	    // Retry if the command is persistent and failed
-    	    if (isPersistent && !vipSuccess) {
-				vipIss.clear();  // Reset the stream
-    			vipIss.seekg(0); // Rewind the stream to re-parse input
-    	        vipExecuteCommand(false);
-    	    }
-    	});
-    }
-	
-	else {
-    	auto executeCommand = [&](bool isPersist) -> bool {
-			iss >> action;
-    	        if (action == "O") { // Open account
-    	            int accountId, balance;
-    	            std::string password;
-    	            iss >> accountId >> password >> balance;
-    	            return bank->createAccount(accountId, password, balance, this->id, isPersist);
-    	        } else if (action == "Q") { // Close account
-    	            int accountId;
-    	            std::string password;
-    	            iss >> accountId >> password;
-    	            return bank->deleteAccount(accountId, password, this->id, isPersist);
-    	        } else if (action == "D") { // Deposit
-    	            int accountId, amount;
-    	            std::string password;
-    	            iss >> accountId >> password >> amount;
-    	            return bank->deposit(accountId, amount, password, this->id, isPersist);
-    	        } else if (action == "W") { // Withdraw
-    	            int accountId, amount;
-    	            std::string password;
-    	            iss >> accountId >> password >> amount;
-    	            return bank->withdraw(accountId, amount, password, this->id, isPersist);
-    	        } else if (action == "B") { // Check balance
-    	            int accountId;
-    	            std::string password;
-    	            iss >> accountId >> password;
-    	            return bank->getBalance(accountId, password, this->id, isPersist);
-    	        } else if (action == "T") { // Transfer money
-    	            int srcId, destId, amount;
-    	            std::string password;
-    	            iss >> srcId >> password >> destId >> amount;
-    	            return bank->transfer(srcId, password, destId, amount, this->id, isPersist);
-    	        } else if (action == "R") { // Restore Bank
-    	            int iterations;
-    	            iss >> iterations;
-    	            return bank->addRestoreRequest(iterations, this->id);
-    	        } else if (action == "C") { // Close ATM
-    	        	int targetATMID;
-    	        	iss >> targetATMID;
-    	        	return bank->requestATMClosure(targetATMID, this->id,isPersist);
-    	        }
-    	        return false; // Unknown action
-    	    };
-    	// Handle non-VIP commands directly
-    	    bool success = executeCommand(isPersistent);
-    	    sleep(1);
-
-    	    if (isPersistent && !success) {
-				iss.clear();  // Reset the stream
-    iss.seekg(0); // Rewind the stream to re-parse input
-    	        executeCommand(false); // Retry the command
-    	        sleep(1);
-    	    }
+    	submitVIPCommand(command);
+    	return ATM_LINE_DELAY_US;
     }
+
+	// Handle non-VIP commands directly, a failed persistent one is retried on the next step
+	bool success = executeCommand(command, isPersistent);
+	if (isPersistent && !success) {
+		pendingCommand = command;
+		phase = PHASE_RETRY;
+
+		// Wait for the account change the command needs instead of retrying blindly
+		retryDeadline = monotonicMicros() + static_cast<long long>(bank->getConfig().persistentWaitMs) * 1000;
+		if (parkRetry()) {
+			return static_cast<long>(bank->getConfig().persistentWaitMs) * 1000;
+		}
+		retryDeadline = 0;
+		return ATM_COMMAND_DELAY_US;
+	}
+	return ATM_COMMAND_DELAY_US + ATM_LINE_DELAY_US;
+}
+
+int ATM::handleCommand(const std::string& command) {
+	rwLock.acquireWriteLock();
+	if (isStopped()) {
+		rwLock.releaseWriteLock();
+		return COMMAND_CLOSED;
+	}
+
+	int result;
+	if (command.find("VIP") != std::string::npos) {
+		submitVIPCommand(command);
+		result = COMMAND_QUEUED;
+	} else {
+		// Sessions are not paced, so a failed persistent command is retried right away
+		bool isPersistent = command.find("PERSISTENT") != std::string::npos;
+		bool success = executeCommand(command, isPersistent);
+		if (isPersistent && !success) {
+			success = executeCommand(command, false);
+		}
+		result = success ? COMMAND_OK : COMMAND_FAILED;
+	}
+	rwLock.releaseWriteLock();
+	return result;
+}
+
+// VIP task keeping the whole line, for commands whose password does not fit a BankCommand
+struct VipLineTask {
+	VipOutcome outcome;
+	ATM* atm;
+	std::string command;
+
+	void operator()() {
+	    // First attempt to execute the command
+	    bool isPersistent = command.find("PERSISTENT") != std::string::npos;
+	    bool vipSuccess = atm->executeCommand(command, isPersistent);
+
+	    // Retry if the command is persistent and failed
+	    if (isPersistent && !vipSuccess) {
+	        vipSuccess = atm->executeCommand(command, false);
+	    }
+	    outcome.complete(vipSuccess);
+	}
+};
+
+CompletionHandle ATM::submitVIPCommand(const std::string& command) {
+	size_t vipPos = command.find("VIP=");
+	int priority = 0;
+	if (vipPos != std::string::npos) {
+		priority = std::atoi(command.c_str() + vipPos + 4); // The number right after "VIP="
+	}
+
+	// Forget the commands that are done, so the list stays as long as the VIP backlog
+	size_t kept = 0;
+	for (size_t i = 0; i < vipPending.size(); ++i) {
+		if (!vipPending[i].ready()) {
+			vipPending[kept++] = std::move(vipPending[i]);
+		}
+	}
+	vipPending.resize(kept);
+
+	// Only an ATM on its own thread waits for room in a full queue; the scheduler and the
+	// socket server would stall every other ATM they serve, so there the command fails instead
+	bool mayBlock = mode == MODE_THREAD;
+
+	// Parse once here, the task then carries the command inline
+	BankCommand parsed;
+	if (BankCommand::parse(command, id, parsed)) {
+		vipPending.push_back(bank->submitVIPTask(priority, parsed, mayBlock));
+		return vipPending.back();
+	}
+
+	// The password is too long to be stored inline, keep the whole line instead
+	CompletionHandle done = CompletionHandle::create();
+	vipPending.push_back(done);
+	VipLineTask task = {VipOutcome(bank, id, done), this, command};
+	bank->submitVIPTask(priority, TaskFunction(std::move(task)), id, mayBlock);
+	return done;
+}
+
+bool ATM::executeCommand(const std::string& command, bool isPersist) {
+	BankCommand parsed;
+	if (BankCommand::parse(command, id, parsed)) {
+		return bank->executeCommand(parsed, isPersist);
+	}
+	// The password does not fit inline, run the command with it alongside
+	std::string password;
+	BankCommand::parse(command, id, parsed, &password);
+	return bank->executeCommand(parsed, password, isPersist);
+}
+
+bool ATM::isStopped() {
+	pthread_mutex_lock(&stopMutex);
+	bool stopped = stop;
+	pthread_mutex_unlock(&stopMutex);
+	return stopped;
+}
+
+bool ATM::waitForStop(long delayMicros) {
+	long long due = monotonicMicros() + delayMicros;
+	struct timespec deadline;
+	deadline.tv_sec = due / 1000000LL;
+	deadline.tv_nsec = (due % 1000000LL) * 1000;
+
+	pthread_mutex_lock(&stopMutex);
+	while (!stop && !retryWoken && pthread_cond_timedwait(&stopCond, &stopMutex, &deadline) == 0) {
+	}
+	retryWoken = false;
+	bool stopped = stop;
+	pthread_mutex_unlock(&stopMutex);
+	return stopped;
+}
+
+bool ATM::parkRetry() {
+	pthread_mutex_lock(&stopMutex);
+	retryWoken = false;
+	pthread_mutex_unlock(&stopMutex);
+	return bank->awaitCondition(pendingCommand, id, &retryWaiter);
+}
+
+void ATM::wakeForRetry(void* arg) {
+	ATM* atm = static_cast<ATM*>(arg);
+	pthread_mutex_lock(&atm->stopMutex);
+	atm->retryWoken = true;
+	pthread_cond_broadcast(&atm->stopCond); // Cuts the pacing wait of a thread ATM short
+	pthread_mutex_unlock(&atm->stopMutex);
+
+	if (atm->mode == MODE_SCHEDULED) {
+		atm->scheduler->wake(atm);
+	}
+}
+
+void ATM::markFinished() {
+	pthread_mutex_lock(&stopMutex);
+	finished = true;
+	pthread_cond_broadcast(&stopCond);
+	pthread_mutex_unlock(&stopMutex);
 }
 
 void ATM::closeATM() {
 	pthread_mutex_lock(&stopMutex);
 	stop = true; // Signal the ATM to stop
+	pthread_cond_broadcast(&stopCond); // Cut a pacing wait short
 	pthread_mutex_unlock(&stopMutex);
+
+	if (mode == MODE_SCHEDULED) {
+		scheduler->wake(this);
+	} else if (mode == MODE_SESSION) {
+		server->wake(); // The server acknowledges the closure from its event loop
+	}
 }
 
 
-void Bank::logTransaction(const std::string& message) {
-	logLock.acquireWriteLock();
-	std::ofstream logFile("log.txt", std::ios::app); // Open the log file in append mode
-	if (logFile.is_open()) {
-		logFile << message;
-		logFile.close();
+void Bank::logTransaction(const TxEvent& event, const char* password) {
+	if (recorder != nullptr) {
+		recorder->record(event, password); // In the order the changes were applied, see TraceRecorder
 	}
-	logLock.releaseWriteLock();
+	transactionLog.record(event, password);
+	accountHistory.record(event); // Called under the locks of the accounts the event changes
 }
 
 ReadWriteLock& ATM::getATMLock(){
 	return rwLock;
-}
\ No newline at end of file
+}
+
+int ATM::getId() const {
+	return id;
+}
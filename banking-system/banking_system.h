@@ -13,9 +13,34 @@
 #include "read_write_lock.h"
 #include "task_queue.h"
 #include "thread_pool.h"
+#include "atm_scheduler.h"
+#include "atm_server.h"
+#include "arena.h"
+#include "object_pool.h"
+#include "bank_command.h"
+#include "bank_config.h"
+#include "tx_log.h"
+#include "account_history.h"
+#include "balance_index.h"
+#include "striped_counter.h"
+#include "session_table.h"
+#include "account_directory.h"
+#include "epoch.h"
+#include "completion.h"
+#include "snapshot_archive.h"
+#include "timer_service.h"
+#include "wait_list.h"
+#include "trace.h"
+#include "partition.h"
+#include "bank_policy.h"
+#include "money_audit.h"
+#include "atm_throttle.h"
 
 #define MAX_STATES 120
 
+#define ATM_LINE_DELAY_US 100000     // Pause between two lines of an ATM file
+#define ATM_COMMAND_DELAY_US 1000000 // Pause after each non-VIP command attempt
+
 class ATM;
 
 // Account Class
@@ -26,21 +51,33 @@ private:
 	int balance;
 	ReadWriteLock rwLock;
 	ReadWriteLock logLock;
+	StripedCounter* credits; // Credits of a hot account, added to balance on read (nullptr = not hot)
+	std::atomic<bool> closed; // Set under the write lock once the account is deleted
+	StripedCounter* ledger;   // Running total every balance change is added to (nullptr = none)
+
+	Account& operator=(const Account&); // Not assignable
 
 public:
 	Account();
 	Account(int id, const std::string& password, int balance);
 	Account(const Account& other);
+	~Account();
 
 
 
     bool verifyPassword(const std::string& inputPassword) const;
     void deposit(int amount);
+    void credit(int amount);      // Like deposit, but safe without the account lock
+    void makeHot();               // Keep credits in per-CPU stripes from now on
+    void attachLedger(StripedCounter* ledger); // Adds the balance to it, then every change
+    bool isHot() const;
+    void markClosed();            // Takes the balance out of the ledger
+    bool isClosed() const;        // A command that locked a closed account treats it as missing
     void withdraw(int amount);
     void setBalance(int amount);
     int getBalance() const;
     int getId();
-    std::string getPassword() const;
+    const std::string& getPassword() const;
 
     // Lock management methods for both readers and writers
     void lockWrite();
@@ -52,36 +89,71 @@ public:
 
 };
 
-struct BankState {
-    std::map<int, Account> accounts;
+// Account as captured in a snapshot, the password lives in the snapshot's arena
+struct AccountRecord {
+    int id;
+    int balance;
+    const char* password;
 };
 
+// Snapshot of every account sorted by id. All of its memory comes from one
+// arena, so overwriting the snapshot frees the previous content in one shot.
+class BankState {
+private:
+    Arena arena;
+    AccountRecord* records;
+    size_t count;
+    size_t capacity;
+    long long takenAt; // monotonicMicros() when the capture started
+public:
+    BankState();
+    void reset(size_t capacity); // Drops the current content and makes room for `capacity` accounts
+    void add(int id, int balance, const std::string& password); // Ids must come in increasing order
+    const AccountRecord* find(int id) const; // nullptr if the account is not in the snapshot
+    const AccountRecord* begin() const { return records; }
+    const AccountRecord* end() const { return records + count; }
+    size_t size() const { return count; }
+    long long getTakenAt() const { return takenAt; }
+};
+
+// The last MAX_STATES saved states. A slot that drops out of the window is retired through
+// the epoch domain and reused once no reader can still be on it, so saving never waits for
+// a slow reader.
 class BankHistory {
 private:
-    std::vector<BankState> stateHistory;
-    size_t currentIndex;
+    std::vector<std::atomic<BankState*>> stateHistory;
+    std::atomic<size_t> currentIndex; // Newest complete state
+    std::vector<BankState*> spare;     // Retired states ready to be filled again
+    pthread_mutex_t spareMutex;
+
+    static void recycle(void* state, void* history); // Epoch reclaim, back to `spare`
+
+    BankHistory(const BankHistory&);            // Not copyable
+    BankHistory& operator=(const BankHistory&);
 public:
     BankHistory(size_t maxStates);
-    void saveState(const BankState& state);
-    BankState getState(int R) const;
+    ~BankHistory(); // After the epoch domain reclaimed what was retired
+    BankState* nextState(); // A state to fill; commit() then makes it the newest
+    void commit(BankState* state);
+    const BankState& getState(int R) const; // Inside an epoch, unless on the thread that commits
 };
 
 // Bank Class
 class Bank {
 private:
+    BankConfig config;
     Account bankAccount;
-    std::atomic<bool> running;
     BankHistory history;
     TaskQueue vipTaskQueue;           // VIP task queue
-    ThreadPool* vipThreadPool;        // VIP thread pool
+    ThreadPool* vipThreadPool;        // VIP thread pool, nullptr without VIP threads (tasks then run inline)
     size_t totalSavedStates;
+    ObjectPool<Account> accountPool; // Storage of every Account in `accounts`
 
     std::vector<ATM*> atms;                // List of ATM pointers
-	std::map<int, Account*> accounts;
 	std::vector<bool> atmStates;              // Tracks ATM open/closed states
+	std::vector<bool> atmOwned;               // ATMs freed by the bank once closed
 
-    pthread_t commissionThread;
-    pthread_t statusThread;
+    TimerService timers; // Commission, status, ATM closure and restore jobs
 
     std::queue<std::pair<int, int>> restoreRequests;
     std::queue<std::pair<int, int>> atmClosureRequests;
@@ -90,16 +162,55 @@ private:
     ReadWriteLock restoreLock;
 	ReadWriteLock atmLock; //Lock for the atmStates vector and atms vector
 	ReadWriteLock rwLock;
-    ReadWriteLock logLock; // Protects the shared log file
+    TransactionLog transactionLog; // Shared log file, text or binary events
+    AccountHistory accountHistory; // Latest changes of every account, fed by logTransaction
+    BalanceIndex balanceIndex;     // Accounts ordered by balance, when enabled
+    SessionTable sessions;         // ATMs logged in to an account with L
+    // Current id -> Account directory. Commands look accounts up without a lock inside an
+    // epoch; create, delete and restore publish a new version under rwLock and retire the old one.
+    std::atomic<const AccountDirectory*> accounts;
+    TaskQueue queryTaskQueue;
+    ThreadPool* queryThreadPool;      // Answers balance queries from `published`, nullptr if disabled
+    std::atomic<const BankState*> published; // Latest snapshot taken by saveState, read inside an epoch
+    SnapshotArchive* archive;  // Disk tier of the history, nullptr if only the in-memory window is kept
+    std::atomic<uint64_t> savedSequence; // States saved so far, the newest has this sequence number
+    BankState archivedState;   // Scratch state a restore from the archive is rebuilt in
+    WaitList waitList;         // Failed persistent commands waiting for an account to change
+    TraceRecorder* recorder;   // Trace of the applied changes for ./replay, nullptr unless recording
+    PartitionSet* partitions;  // Processes owning the accounts, nullptr if this bank owns them
+    MoneyAudit audit;          // Running totals of the money, booked by every change of a balance
+    AtmThrottle throttle;      // Command rate of each ATM, see admit()
 
 
-    static void* chargeCommission(void* arg);
-    static void* printStatus(void* arg);
-    BankState getCurrentState();
+    void startTimers();
+    void chargeCommission(); // One commission pass over every account
+    // Charges one account under its lock, queueing its new balance for the index
+    bool chargeAccount(Account* account, int percentage, std::vector<BalanceIndex::Entry>& reindex);
+    void recordFinalBalances(); // Closes the trace with the balances it has to replay to
+    void printStatus();      // Saves a state and prints it
+    void printPartitionStatus(); // printStatus of the accounts of every partition
+    long long getCurrentState(BankState& state); // Returns the sum of the balances it copied
     void applyState(const BankState& state);
+    Account* findAccount(int accountId, const std::string& password, int atmID, bool& authenticated); // In an epoch
+    Account* lockAccount(int accountId, const std::string& password, int atmID, bool write, bool& authenticated);
+    template <class Policy>
+    Account* lockAccountAs(int accountId, const std::string& password, int atmID, bool write, bool& authenticated);
+    // logTransaction of an applied operation: the trace and the account history always get it,
+    // the transaction log only if Policy::Events is enabled
+    template <class Policy>
+    void logTransactionAs(const TxEvent& event);
+    const AccountDirectory& directory() const; // Stable inside an epoch or under rwLock
+    void publishDirectory(AccountDirectory* next); // Under the rwLock write lock
+    void retireAccount(Account* account);          // Frees it once no command can reach it
+    static void reclaimDirectory(void* directory, void*);
+    static void reclaimAccount(void* account, void* bank);
+    Account* allocateAccount(int id, const std::string& password, int balance); // From the pool, hot if configured
+    bool runCommand(const BankCommand& command, const std::string& password, bool isPersist); // On this bank's accounts
 
 public:
     Bank(size_t numVIPThreads);
+    // With `partitions` this bank keeps no accounts and routes the account commands to them
+    Bank(size_t numVIPThreads, const BankConfig& config, PartitionSet* partitions = nullptr);
     Bank();
     ~Bank();
 
@@ -108,44 +219,206 @@ public:
     void restoreRequestsHandler();
     bool createAccount(int id, const std::string& password, int balance, int atmID, bool isPersist);
     bool deleteAccount(int id, const std::string& password,int atmID, bool isPersist);
+    bool login(int accountId, const std::string& password, int atmID, bool isPersist); // Opens a session, see SessionTable
 
-    void registerATM(ATM* atm);
+    // Returns the index used to address the ATM in closure requests. An owned ATM is freed by
+    // the bank once closed; the others belong to the caller, who frees them after stop().
+    int registerATM(ATM* atm, bool owned = false);
     bool requestATMClosure(int atmID, int sourceATMID, bool isPersist);
     void processATMClosures();
 
     bool deposit(int accountId, int amount, const std::string& password, int atmID, bool isPersist);
     bool withdraw(int accountId, int amount, const std::string& password, int atmID, bool isPersist);
     bool getBalance(int accountId, const std::string& password, int atmID, bool isPersist);
+    // Balance from the published snapshot if it is at most maxStaleMicros old, answered by the
+    // query pool when there is one; falls back to getBalance otherwise
+    bool queryBalance(int accountId, const std::string& password, int atmID, bool isPersist, long long maxStaleMicros);
+    bool snapshotBalance(int accountId, const std::string& password, int atmID, bool isPersist, long long maxStaleMicros);
+    const BankConfig& getConfig() const { return config; }
+    bool statement(int accountId, const std::string& password, int count, int atmID, bool isPersist); // Logs the last `count` changes
+    bool balanceAt(int accountId, const std::string& password, int ticksAgo, int atmID, bool isPersist); // Logs a past balance
+    bool totalsAt(int ticksAgo, int atmID); // Logs the account count and total balance of a past state
+
+    // Runs reader(state) on the state saved ticksAgo iterations ago, without touching the live
+    // accounts. States of the in-memory window are read in place inside an epoch (an overwritten
+    // slot is retired, not reused, until it ends); older ones are rebuilt from the archive.
+    template <typename Reader>
+    bool readHistory(int ticksAgo, Reader reader) {
+        if (ticksAgo < 1) {
+            return false;
+        }
+        EpochGuard guard;
+        uint64_t saved = savedSequence.load(std::memory_order_acquire);
+        if (static_cast<uint64_t>(ticksAgo) < MAX_STATES && static_cast<uint64_t>(ticksAgo) <= saved) {
+            reader(history.getState(ticksAgo)); // The epoch keeps it from being reused meanwhile
+            return true;
+        }
+        if (archive == nullptr || static_cast<size_t>(ticksAgo) > restorableStates()) {
+            return false;
+        }
+        BankState state;
+        if (!archive->load(saved - ticksAgo + 1, state)) {
+            return false;
+        }
+        reader(state);
+        return true;
+    }
+
     bool transfer(int srcId, const std::string& password, int destId, int amount, int atmID, bool isPersist);
-	void logTransaction(const std::string& message); // Logs transaction to a shared log file
-    void submitVIPTask(int priority, const std::function<void()>& task);
+
+    // The operations above under other compile-time policies (bank_policy.h), instantiated for
+    // the policies defined there. The plain versions run DefaultPolicy.
+    template <class Policy>
+    bool depositAs(int accountId, int amount, const std::string& password, int atmID, bool isPersist);
+    template <class Policy>
+    bool withdrawAs(int accountId, int amount, const std::string& password, int atmID, bool isPersist);
+    template <class Policy>
+    bool getBalanceAs(int accountId, const std::string& password, int atmID, bool isPersist);
+    template <class Policy>
+    bool transferAs(int srcId, const std::string& password, int destId, int amount, int atmID, bool isPersist);
+	// Logs transaction to a shared log file, `password` as in TransactionLog::record
+	void logTransaction(const TxEvent& event, const char* password = nullptr);
+    // Queues a parsed command, stored inline in the task. The handle reports whether it succeeded
+    // (after the retry of a persistent command) and may be dropped by fire-and-forget callers.
+    // Callers on a thread serving other ATMs pass !mayBlock, see TaskQueue::push.
+    CompletionHandle submitVIPTask(int priority, const BankCommand& command, bool mayBlock = true);
+    // Queued on behalf of ATM `atmId`, which shares the VIP queue with the others by its --atm-weight
+    void submitVIPTask(int priority, TaskFunction&& task, int atmId = 0, bool mayBlock = true);
+    // The task submitVIPTask queues for a parsed command, completing `done` once it ran
+    TaskFunction vipTask(const BankCommand& command, const CompletionHandle& done = CompletionHandle());
+    void drain(); // Waits until every VIP task submitted so far has run
+    // Called by an ATM front end before each command: 0 lets it run, otherwise the ATM is over
+    // its --atm-rate and should come back in that many microseconds without running it
+    long long admit(int atmId) { return throttle.acquire(atmId); }
+    size_t atmWeight(int atmId) const; // Share of an ATM from --atm-weight, 1 if it has none
+    // Parks a failed persistent command on the account change it needs (the account to exist,
+    // or a balance of at least its amount). Returns false if no account change can help it,
+    // e.g. a wrong password. The waiter may be woken before this returns.
+    bool awaitCondition(const std::string& command, int atmID, AccountWaiter* waiter);
+    void cancelWait(AccountWaiter* waiter);
+    void reportVIPWaits(FILE* out); // Queue wait of the VIP tasks per priority
+    bool executeCommand(const BankCommand& command, bool isPersist); // Runs a parsed ATM command
+    // Same, for a command whose password did not fit inline (see BankCommand::parse)
+    bool executeCommand(const BankCommand& command, const std::string& password, bool isPersist);
+    // Queries on the balance index, empty unless it is enabled. Entries are (id, balance).
+    void topAccounts(size_t k, std::vector<BalanceIndex::Entry>& out) const;           // Highest balances first
+    void accountsInRange(int low, int high, std::vector<BalanceIndex::Entry>& out) const; // low <= balance <= high
     void stop();
-    void saveState();
+    const BankState& saveState(); // Captures the accounts and publishes the snapshot to queries
+    size_t restorableStates() const; // How far back R may go
     void restore(int R, int atmID);
 
+    // Charges one account the commission of a pass, false if it is closed or missing
+    bool chargeCommission(int accountId, int percentage);
+    // Sets the balance a rollback gave an account, false if it is closed or missing
+    bool rollbackAccount(int accountId, int balance);
+    int bankBalance() const { return bankAccount.getBalance(); } // Commissions gained so far
+
+    // The share of a partition process, see PartitionSet
+    bool isPartitioned() const { return partitions != nullptr; }
+    void chargeCommissions(int percentage); // One commission pass at the given percentage
+    bool restoreState(int R); // Rolls back without logging, false if the state is gone
+    bool historyTotals(int ticksAgo, int& accounts, long long& total); // Of the state ticksAgo
+    bool hasAccount(int id);
+    // Two-phase transfer with the destination in another partition. prepareDebit checks the
+    // source like transfer does and withdraws the amount; abortDebit gives it back and
+    // commitDebit logs the transfer once commitCredit deposited it at the destination.
+    bool prepareDebit(const BankCommand& command, bool destExists, bool isPersist, int& balance);
+    bool commitCredit(const BankCommand& command, int& balance);
+    void abortDebit(const BankCommand& command);
+    void commitDebit(const BankCommand& command, int balance, int destBalance);
+
+};
+
+// Outcome of a queued VIP command. A task destroyed without having run, because a
+// full VIP queue dropped it, fails with a logged error instead of leaving its
+// handle pending forever.
+class VipOutcome {
+private:
+    Bank* bank;
+    CompletionHandle done;
+    int atmId;
+    bool settled;
+
+    VipOutcome(const VipOutcome&);            // Move only, a single copy may report the drop
+    VipOutcome& operator=(const VipOutcome&);
+
+public:
+    VipOutcome(Bank* bank, int atmId, const CompletionHandle& done)
+        : bank(bank), done(done), atmId(atmId), settled(false) {}
+    VipOutcome(VipOutcome&& other);
+    ~VipOutcome();
+
+    Bank* getBank() const { return bank; }
+    void complete(bool success);
 };
 
 // ATM Class
 class ATM {
 private:
+	enum Mode { MODE_IDLE, MODE_THREAD, MODE_SCHEDULED, MODE_SESSION };
+	enum Phase { PHASE_START, PHASE_NEXT, PHASE_RETRY, PHASE_DONE };
+
 	int id;
 	bool stop; // Flag to indicate if the ATM should stop
 	pthread_mutex_t stopMutex;  // Mutex for synchronizing access to the `stop` flag
+	pthread_cond_t stopCond;    // Signaled when the ATM is asked to stop and when it finishes
 	std::string inputFile; //Path to the input file containing the ATM's operations.
 	Bank* bank; //Pointer to the shared Bank object, allowing the ATM to perform transactions.
 	pthread_t thread; // Thread for the ATM
+	pthread_mutex_t joinMutex; // Lets the bank and main both join the ATM
+	bool threadJoined;
     ReadWriteLock rwLock;
 
+	// Execution state, advanced one step at a time by step()
+	Mode mode;
+	Phase phase;
+	bool finished;
+	std::ifstream file;
+	std::string pendingCommand; // Failed persistent command waiting for its retry
+	AccountWaiter retryWaiter;  // Parks pendingCommand on the bank's wait list
+	long long retryDeadline;    // Until when pendingCommand may wait for its account (0 = not parked)
+	bool retryWoken;            // The wait list woke the retry, under stopMutex
+
+	AtmServer* server; // Connection front-end driving a session ATM
+
+	// Scheduler bookkeeping, protected by the scheduler's mutex
+	AtmScheduler* scheduler;
+	unsigned scheduleGen;
+	bool inStep;
+	bool wakePending;
+	bool scheduleDone;
+
 	static void* run(void* arg);
-	void processCommand(const std::string& command); // Processes a single command
+	static void wakeForRetry(void* atm); // AccountWaiter callback
+	bool parkRetry();                    // Parks pendingCommand, false if no account change can help it
+	long processCommand(const std::string& command); // Processes a single command, returns the pacing delay
+	bool executeCommand(const std::string& command, bool isPersist); // Parses and runs a command against the bank
+	CompletionHandle submitVIPCommand(const std::string& command); // Hands a VIP command to the bank's VIP pool
+	std::vector<CompletionHandle> vipPending; // VIP commands that may still be queued, join() waits for them
+	bool isStopped();
+	bool waitForStop(long delayMicros); // Sleeps unless closed meanwhile, returns true if the ATM was closed
+	void markFinished();
+
+	friend class AtmScheduler;
+	friend class AtmServer;
+	friend struct VipLineTask;
 
 public:
+	// Outcome of a command run through handleCommand()
+	enum CommandResult { COMMAND_FAILED, COMMAND_OK, COMMAND_QUEUED, COMMAND_CLOSED };
+
 	ATM(int id, const std::string& inputFile, Bank* bank);
 	 ~ATM();
-	void start();
+	void start();                        // Run the ATM on its own thread
+	void start(AtmScheduler* scheduler); // Run the ATM as a state machine on a shared scheduler
+	void attach(AtmServer* server);      // Run the ATM as a session whose commands arrive through handleCommand()
+	long step();                         // Runs the next step, returns the delay before the next one or -1 when done
+	int handleCommand(const std::string& command); // Runs one command without pacing, returns a CommandResult
 	void join();
 	void closeATM();
     ReadWriteLock& getATMLock(); 
+    int getId() const;
 
 };
 
@@ -0,0 +1,186 @@
+/*
+ * bench.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+// Micro-benchmarks of the bank's hot paths: make bench && ./bench
+// Heap allocations are counted per thread by replacing the global operator new.
+#include "banking_system.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <functional>
+#include <new>
+#include <queue>
+#include <string>
+
+static thread_local long allocations = 0;
+
+void* operator new(size_t size) {
+	allocations++;
+	void* memory = std::malloc(size == 0 ? 1 : size);
+	if (memory == nullptr) {
+		throw std::bad_alloc();
+	}
+	return memory;
+}
+
+void operator delete(void* memory) noexcept {
+	std::free(memory);
+}
+
+struct BenchResult {
+	const char* name;
+	long iterations;
+	double nsPerOp;
+	double allocationsPerOp;
+};
+
+static std::vector<BenchResult> results;
+
+// Runs `op` `iterations` times and records its time and allocations per call
+template <typename Op>
+static void bench(const char* name, long iterations, Op op) {
+	op(); // Warm up caches, buffers and lazily created state
+	long before = allocations;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (long i = 0; i < iterations; ++i) {
+		op();
+	}
+	std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now();
+	BenchResult result = {name, iterations,
+			std::chrono::duration<double, std::nano>(end - start).count() / iterations,
+			static_cast<double>(allocations - before) / iterations};
+	results.push_back(result);
+}
+
+// The task representation VIP commands used before: a std::function capturing the line
+struct LegacyTask {
+	int priority;
+	std::function<void()> fn;
+	bool operator<(const LegacyTask& other) const { return priority > other.priority; }
+};
+
+int main() {
+	const long iterations = 200000;
+	const std::string line = "D 1 secret 10 PERSISTENT VIP=3";
+
+	// The timer thread is off in every bank below, so the rows run alone on their accounts
+	BankConfig quiet;
+	quiet.timerJobs = false;
+
+	{
+		Bank bank(0, quiet); // No VIP workers, tasks are run on this thread
+		bank.createAccount(1, "secret", 0, 0, false);
+
+		// Both representations run the same command, parsed once here, so only the task
+		// machinery differs
+		BankCommand parsed;
+		BankCommand::parse(line, 1, parsed);
+		parsed.action = '\0';
+		parsed.isPersistent = false;
+
+		// Same locking as TaskQueue so that only the task representation differs
+		std::priority_queue<LegacyTask> legacyQueue;
+		ReadWriteLock legacyLock;
+		pthread_cond_t legacyCond;
+		pthread_cond_init(&legacyCond, nullptr);
+		bench("vip submit+dispatch (std::function)", iterations, [&]() {
+			std::string command = line;
+			bool isPersistent = false;
+			LegacyTask task = {3, [command, isPersistent, &bank, &parsed]() {
+				(void)command;
+				bank.executeCommand(parsed, isPersistent);
+			}};
+			pthread_mutex_lock(legacyLock.getUnderlyingMutex());
+			legacyQueue.push(task);
+			pthread_cond_signal(&legacyCond);
+			pthread_mutex_unlock(legacyLock.getUnderlyingMutex());
+			pthread_mutex_lock(legacyLock.getUnderlyingMutex());
+			LegacyTask top = legacyQueue.top();
+			legacyQueue.pop();
+			pthread_mutex_unlock(legacyLock.getUnderlyingMutex());
+			top.fn();
+		});
+		pthread_cond_destroy(&legacyCond);
+
+		TaskQueue queue;
+		bench("vip submit+dispatch (inline task)", iterations, [&]() {
+			queue.push(Task(3, bank.vipTask(parsed)));
+			Task task = queue.pop();
+			task.fn();
+		});
+
+		bench("vip submit+await (completion handle)", iterations, [&]() {
+			CompletionHandle done = CompletionHandle::create();
+			queue.push(Task(3, bank.vipTask(parsed, done)));
+			Task task = queue.pop();
+			task.fn();
+			done.wait();
+		});
+
+		bench("vip deposit end to end (text log)", iterations / 10, [&]() {
+			BankCommand command;
+			BankCommand::parse(line, 1, command);
+			queue.push(Task(3, bank.vipTask(command)));
+			Task task = queue.pop();
+			task.fn();
+		});
+		queue.pollShutDown();
+	}
+
+	{
+		BankConfig config = quiet;
+		config.binaryLog = true;
+		Bank bank(0, config);
+		bank.createAccount(1, "secret", 0, 0, false);
+
+		TaskQueue queue;
+		bench("vip deposit end to end (binary log)", iterations / 10, [&]() {
+			BankCommand command;
+			BankCommand::parse(line, 1, command);
+			queue.push(Task(3, bank.vipTask(command)));
+			Task task = queue.pop();
+			task.fn();
+		});
+		queue.pollShutDown();
+	}
+
+	{
+		// The same deposit and transfer under each compile-time policy (bank_policy.h)
+		Bank bank(0, quiet);
+		bank.createAccount(1, "secret", 0, 0, false);
+		bank.createAccount(2, "secret", 0, 0, false);
+		const std::string password = "secret";
+
+		bench("deposit (default policy)", iterations / 10, [&]() {
+			bank.deposit(1, 1, password, 1, false);
+		});
+		bench("deposit (counted)", iterations / 10, [&]() {
+			bank.depositAs<CountedPolicy>(1, 1, password, 1, false);
+		});
+		bench("deposit (no log)", iterations, [&]() {
+			bank.depositAs<UnloggedPolicy>(1, 1, password, 1, false);
+		});
+		bench("deposit (single writer, no log)", iterations, [&]() {
+			bank.depositAs<SingleWriterUnloggedPolicy>(1, 1, password, 1, false);
+		});
+		bench("transfer (default policy)", iterations / 10, [&]() {
+			bank.transfer(1, password, 2, 1, 1, false);
+		});
+		bench("transfer (no log)", iterations, [&]() {
+			bank.transferAs<UnloggedPolicy>(1, password, 2, 1, 1, false);
+		});
+		bench("transfer (single writer, no log)", iterations, [&]() {
+			bank.transferAs<SingleWriterUnloggedPolicy>(1, password, 2, 1, 1, false);
+		});
+	}
+
+	std::printf("\n%-40s %10s %12s %14s\n", "benchmark", "ops", "ns/op", "allocs/op");
+	for (const BenchResult& result : results) {
+		std::printf("%-40s %10ld %12.1f %14.2f\n", result.name, result.iterations, result.nsPerOp,
+				result.allocationsPerOp);
+	}
+	return 0;
+}
@@ -0,0 +1,88 @@
+/*
+ * completion.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "completion.h"
+#include "object_pool.h"
+#include <utility>
+
+// Leaked so that handles released while the process exits still find it
+static ObjectPool<Completion>& completionPool() {
+	static ObjectPool<Completion>* pool = new ObjectPool<Completion>();
+	return *pool;
+}
+
+Completion::Completion() : done(false), result(false), refs(0) {
+	pthread_mutex_init(&mutex, nullptr);
+	pthread_cond_init(&cond, nullptr);
+}
+
+Completion::~Completion() {
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+void Completion::complete(bool success) {
+	pthread_mutex_lock(&mutex);
+	result = success;
+	done = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex); // The waiter may free the object from here on
+}
+
+bool Completion::wait() {
+	pthread_mutex_lock(&mutex);
+	while (!done) {
+		pthread_cond_wait(&cond, &mutex);
+	}
+	bool success = result;
+	pthread_mutex_unlock(&mutex);
+	return success;
+}
+
+bool Completion::ready() {
+	pthread_mutex_lock(&mutex);
+	bool isDone = done;
+	pthread_mutex_unlock(&mutex);
+	return isDone;
+}
+
+CompletionHandle CompletionHandle::create() {
+	Completion* completion = completionPool().create();
+	completion->refs.store(1, std::memory_order_relaxed);
+	return CompletionHandle(completion);
+}
+
+CompletionHandle::CompletionHandle(const CompletionHandle& other) : completion(other.completion) {
+	if (completion != nullptr) {
+		completion->refs.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+CompletionHandle& CompletionHandle::operator=(CompletionHandle other) {
+	std::swap(completion, other.completion);
+	return *this;
+}
+
+void CompletionHandle::release() {
+	if (completion != nullptr && completion->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+		completionPool().destroy(completion);
+	}
+	completion = nullptr;
+}
+
+void CompletionHandle::complete(bool success) const {
+	if (completion != nullptr) {
+		completion->complete(success);
+	}
+}
+
+bool CompletionHandle::wait() const {
+	return completion != nullptr && completion->wait();
+}
+
+bool CompletionHandle::ready() const {
+	return completion != nullptr && completion->ready();
+}
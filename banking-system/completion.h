@@ -0,0 +1,64 @@
+/*
+ * completion.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef COMPLETION_H_
+#define COMPLETION_H_
+
+#include <atomic>
+#include <pthread.h>
+
+// One-shot result of work handed to another thread. The submitter blocks in
+// wait() until the worker calls complete(); it may then destroy the object.
+class Completion {
+private:
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool done;
+	bool result;
+	std::atomic<int> refs; // Handles sharing a pooled completion, see CompletionHandle
+
+	friend class CompletionHandle;
+
+	Completion(const Completion&);            // Not copyable
+	Completion& operator=(const Completion&);
+
+public:
+	Completion();
+	~Completion();
+
+	void complete(bool success);
+	bool wait(); // Returns what complete() was given
+	bool ready(); // complete() was called, wait() would not block
+};
+
+// Shared reference to a Completion taken from a process-wide pool, so unlike
+// std::future it costs no heap allocation once the pool is warm. The worker keeps
+// one copy and completes it, the submitter keeps another and waits on it or drops
+// it; the completion goes back to the pool with the last copy.
+class CompletionHandle {
+private:
+	Completion* completion;
+
+	explicit CompletionHandle(Completion* completion) : completion(completion) {}
+	void release();
+
+public:
+	CompletionHandle() : completion(nullptr) {}
+	CompletionHandle(const CompletionHandle& other);
+	CompletionHandle(CompletionHandle&& other) : completion(other.completion) { other.completion = nullptr; }
+	CompletionHandle& operator=(CompletionHandle other);
+	~CompletionHandle() { release(); }
+
+	static CompletionHandle create();
+
+	bool valid() const { return completion != nullptr; }
+	void complete(bool success) const; // No-op on an empty handle
+	bool wait() const;                 // An empty handle counts as failed
+	bool ready() const;
+};
+
+#endif /* COMPLETION_H_ */
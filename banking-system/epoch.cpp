@@ -0,0 +1,135 @@
+/*
+ * epoch.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "epoch.h"
+#include <sched.h>
+
+#define EPOCH_COLLECT_THRESHOLD 32 // Retired objects that trigger a reclamation pass
+
+// Slot of the calling thread, handed back to the domain when the thread exits
+struct EpochThreadState {
+	EpochDomain::Slot* slot;
+	unsigned int depth; // Nesting of enter() calls
+
+	EpochThreadState() : slot(nullptr), depth(0) {}
+	~EpochThreadState() {
+		if (slot != nullptr) {
+			slot->epoch.store(0, std::memory_order_release);
+			slot->inUse.store(false, std::memory_order_release);
+		}
+	}
+};
+
+static thread_local EpochThreadState threadState;
+
+EpochDomain::EpochDomain() : globalEpoch(1), slots(nullptr) {
+	pthread_mutex_init(&limboMutex, nullptr);
+}
+
+EpochDomain& EpochDomain::instance() {
+	// Deliberately never destroyed: threads release their slot at exit, possibly after main returns
+	static EpochDomain* domain = new EpochDomain();
+	return *domain;
+}
+
+EpochDomain::Slot* EpochDomain::acquireSlot() {
+	for (Slot* slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+		bool expected = false;
+		if (!slot->inUse.load(std::memory_order_relaxed) &&
+				slot->inUse.compare_exchange_strong(expected, true, std::memory_order_acquire)) {
+			return slot;
+		}
+	}
+
+	Slot* slot = new Slot();
+	slot->epoch.store(0, std::memory_order_relaxed);
+	slot->inUse.store(true, std::memory_order_relaxed);
+	slot->next = slots.load(std::memory_order_relaxed);
+	while (!slots.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {
+	}
+	return slot;
+}
+
+void EpochDomain::enter() {
+	if (threadState.depth++ > 0) {
+		return;
+	}
+	if (threadState.slot == nullptr) {
+		threadState.slot = acquireSlot();
+	}
+	// The announcement must be visible before any shared pointer is read, and must
+	// name the epoch that is current once it is visible
+	unsigned long epoch;
+	do {
+		epoch = globalEpoch.load(std::memory_order_relaxed);
+		threadState.slot->epoch.store(epoch, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+	} while (globalEpoch.load(std::memory_order_relaxed) != epoch);
+}
+
+void EpochDomain::exit() {
+	if (--threadState.depth > 0) {
+		return;
+	}
+	threadState.slot->epoch.store(0, std::memory_order_release);
+}
+
+bool EpochDomain::tryAdvance() {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	unsigned long current = globalEpoch.load(std::memory_order_relaxed);
+	for (Slot* slot = slots.load(std::memory_order_acquire); slot != nullptr; slot = slot->next) {
+		unsigned long epoch = slot->epoch.load(std::memory_order_acquire);
+		if (epoch != 0 && epoch != current) {
+			return false; // A reader is still in the previous epoch
+		}
+	}
+	return globalEpoch.compare_exchange_strong(current, current + 1);
+}
+
+void EpochDomain::collectLocked() {
+	tryAdvance();
+	unsigned long current = globalEpoch.load(std::memory_order_acquire);
+
+	// Readers are at most one epoch behind, anything retired two epochs ago is unreachable
+	size_t kept = 0;
+	for (size_t i = 0; i < limbo.size(); ++i) {
+		if (limbo[i].epoch + 2 <= current) {
+			limbo[i].reclaim(limbo[i].object, limbo[i].context);
+		} else {
+			limbo[kept++] = limbo[i];
+		}
+	}
+	limbo.resize(kept);
+}
+
+void EpochDomain::retire(void* object, ReclaimFunction reclaim, void* context) {
+	Retired retired = {object, reclaim, context, globalEpoch.load(std::memory_order_acquire)};
+	pthread_mutex_lock(&limboMutex);
+	limbo.push_back(retired);
+	if (limbo.size() >= EPOCH_COLLECT_THRESHOLD) {
+		collectLocked();
+	}
+	pthread_mutex_unlock(&limboMutex);
+}
+
+void EpochDomain::collect() {
+	pthread_mutex_lock(&limboMutex);
+	collectLocked();
+	pthread_mutex_unlock(&limboMutex);
+}
+
+void EpochDomain::synchronize() {
+	pthread_mutex_lock(&limboMutex);
+	while (!limbo.empty()) {
+		collectLocked();
+		if (!limbo.empty()) {
+			pthread_mutex_unlock(&limboMutex);
+			sched_yield(); // Let the readers of the current epoch leave
+			pthread_mutex_lock(&limboMutex);
+		}
+	}
+	pthread_mutex_unlock(&limboMutex);
+}
@@ -0,0 +1,75 @@
+/*
+ * epoch.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef EPOCH_H_
+#define EPOCH_H_
+
+#include <atomic>
+#include <vector>
+#include <pthread.h>
+
+// Epoch-based reclamation. Readers bracket their access to shared objects with
+// enter()/exit() (or an EpochGuard). Writers unlink an object and retire() it,
+// and it is reclaimed only once every reader that could still see it has left.
+// There is one domain per process, so each thread needs a single slot.
+class EpochDomain {
+public:
+	typedef void (*ReclaimFunction)(void* object, void* context);
+
+private:
+	struct Slot {
+		std::atomic<unsigned long> epoch; // Epoch the thread entered, 0 while outside
+		std::atomic<bool> inUse;          // Owned by a live thread
+		Slot* next;
+		char padding[64 - sizeof(std::atomic<unsigned long>) - sizeof(std::atomic<bool>) - sizeof(Slot*)];
+	};
+
+	struct Retired {
+		void* object;
+		ReclaimFunction reclaim;
+		void* context;
+		unsigned long epoch; // Global epoch when it was retired
+	};
+
+	std::atomic<unsigned long> globalEpoch;
+	std::atomic<Slot*> slots; // Never freed, released slots are reused by new threads
+	std::vector<Retired> limbo;
+	pthread_mutex_t limboMutex;
+
+	EpochDomain();
+	EpochDomain(const EpochDomain&);            // Not copyable
+	EpochDomain& operator=(const EpochDomain&);
+
+	Slot* acquireSlot();
+	bool tryAdvance();                // Moves the global epoch on if no reader lags behind
+	void collectLocked();             // Reclaims what no reader can reach, limboMutex held
+
+	friend struct EpochThreadState;
+
+public:
+	static EpochDomain& instance();
+
+	void enter(); // Nests
+	void exit();
+
+	void retire(void* object, ReclaimFunction reclaim, void* context);
+	void synchronize(); // Returns once everything retired so far is reclaimed, must be called outside enter()
+	void collect(); // Reclaims what no reader can reach any more, without waiting for the others
+};
+
+// Keeps the calling thread inside the epoch for the lifetime of the guard
+class EpochGuard {
+public:
+	EpochGuard() { EpochDomain::instance().enter(); }
+	~EpochGuard() { EpochDomain::instance().exit(); }
+
+private:
+	EpochGuard(const EpochGuard&);
+	EpochGuard& operator=(const EpochGuard&);
+};
+
+#endif /* EPOCH_H_ */
@@ -0,0 +1,27 @@
+/*
+ * logcat.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+// Renders a binary transaction log (log.bin) in the text format of log.txt
+#include "tx_log.h"
+#include <cstdio>
+#include <string>
+
+int main(int argc, char* argv[]) {
+	const char* path = argc > 1 ? argv[1] : "log.bin";
+	FILE* in = std::fopen(path, "rb");
+	if (in == nullptr) {
+		std::fprintf(stderr, "logcat: cannot open %s\n", path);
+		return 1;
+	}
+
+	TxEvent event;
+	std::string password; // Of an opening whose password did not fit in its record
+	while (readTxEvent(in, event, password)) {
+		renderTxEvent(event, stdout, password.empty() ? nullptr : password.c_str());
+	}
+	std::fclose(in);
+	return 0;
+}
@@ -1,4 +1,9 @@
 #include "banking_system.h"
+#include "bank_config.h"
+#include "atm_scheduler.h"
+#include "atm_server.h"
+#include "memory_stats.h"
+#include "thread_placement.h"
 #include <iostream>
 #include <fstream>
 #include <vector>
@@ -8,36 +13,103 @@
 
 
 int main(int argc, char* argv[]) {
+	// Split "--name=value" options from the positional arguments
+	BankConfig config;
+	std::vector<std::string> args;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg.compare(0, 2, "--") == 0) {
+			if (!config.parseOption(arg)) {
+				std::cerr << "Bank error: illegal arguments\n";
+				return 1;
+			}
+		} else {
+			args.push_back(arg);
+		}
+	}
+
 	// Check if there are not enough arguments
-	if (argc < 3) { // At least 1 VIP thread and 1 ATM input file are required
+	if (args.size() < 2 && !(args.size() == 1 && !config.socketPath.empty())) {
+		return 1; // At least 1 VIP thread and 1 ATM input file (or a socket) are required
+	}
+
+	// SIGINT / SIGTERM stop the socket front-end, block them before any thread starts
+	if (!config.socketPath.empty()) {
+		AtmServer::blockSignals();
+	}
+	// Pin the threads as they are created, before the partitions fork
+	if (!ThreadPlacement::instance().configure(config)) {
+		std::cerr << "Bank error: illegal arguments\n";
 		return 1;
-	} 
+	}
 	// Parse the number of VIP threads
-	size_t numVIPThreads = std::stoi(argv[1]);
+	size_t numVIPThreads = std::stoi(args[0]);
 	
+	// Fork the partition processes while this one has no other thread yet
+	PartitionSet* partitions = nullptr;
+	if (config.partitions > 0) {
+		partitions = new PartitionSet(config);
+		if (!partitions->start()) {
+			std::cerr << "Bank error: cannot start the partitions\n";
+			delete partitions;
+			return 1;
+		}
+	}
+
 	// Initialize the Bank system with VIP threads
-	Bank bank(numVIPThreads);
+	Bank bank(numVIPThreads, config, partitions);
 	
 	// Number of ATM input files
-	int numATMs = argc - 2;
+	int numATMs = args.size() - 1;
 
 
 	// Check if all input files are valid before proceeding
-	for (int i = 2; i < argc; ++i) {
-		std::ifstream file(argv[i]);
+	for (size_t i = 1; i < args.size(); ++i) {
+		std::ifstream file(args[i]);
 		if (!file.is_open()) {
 			std::cerr << "Bank error: illegal arguments\n";
+			bank.stop();
+			delete partitions;
 			return 1;
 		}
 	}
 
+	if (config.memoryReport) {
+		reportMemory("at startup");
+	}
+
+	// Multiplex the ATMs on a few threads instead of one thread each when asked to
+	AtmScheduler* scheduler = nullptr;
+	if (config.atmThreads > 0) {
+		scheduler = new AtmScheduler(config.atmThreads);
+	}
+
 	// Create and start ATMs
 	std::vector<ATM*> atms;
 	for (int i = 0; i < numATMs; ++i) {
-		ATM* atm = new ATM(i+1, argv[i + 2], &bank);
+		ATM* atm = new ATM(i+1, args[i + 1], &bank);
 		atms.push_back(atm);
 		bank.registerATM(atm); // Register the ATM with the bank
-		atm->start();
+		if (scheduler != nullptr) {
+			atm->start(scheduler);
+		} else {
+			atm->start();
+		}
+	}
+
+	// This thread serves the socket's ATMs, otherwise it only waits for the others
+	ThreadPlacement::instance().place(pthread_self(), config.socketPath.empty() ? THREAD_BACKGROUND : THREAD_ATM,
+			numATMs, "main");
+	ThreadPlacement::instance().report(stderr);
+
+	// Serve streamed ATM connections until SIGINT / SIGTERM
+	if (!config.socketPath.empty()) {
+		AtmServer server(&bank, config.socketPath);
+		if (!server.open()) {
+			std::cerr << "Bank error: cannot listen on " << config.socketPath << "\n";
+		} else {
+			server.run();
+		}
 	}
 
 	// Wait for ATM threads to finish
@@ -45,8 +117,20 @@ int main(int argc, char* argv[]) {
 		
 		atm->join();
 		atm->closeATM();
-		delete atm;
+	}
+	bank.drain(); // Every queued VIP command runs before the bank stops
+	if (config.vipReport) {
+		bank.reportVIPWaits(stderr);
+	}
+	if (config.memoryReport) {
+		reportMemory("at exit");
 	}
 bank.stop();
+	// The bank's closure processing may still reach the ATMs until it is stopped
+	for (ATM* atm : atms) {
+		delete atm;
+	}
+	delete scheduler;
+	delete partitions; // Each partition serves what is queued and exits
 	return 0;
-}
\ No newline at end of file
+}
@@ -0,0 +1,39 @@
+/*
+ * memory_stats.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "memory_stats.h"
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Reads one "<field>: <value> kB" line of /proc/self/status
+static long readStatusField(const std::string& field) {
+	std::ifstream status("/proc/self/status");
+	std::string line;
+	while (std::getline(status, line)) {
+		if (line.compare(0, field.size(), field) == 0 && line.size() > field.size() && line[field.size()] == ':') {
+			std::istringstream iss(line.substr(field.size() + 1));
+			long value = 0;
+			iss >> value;
+			return value;
+		}
+	}
+	return 0;
+}
+
+long residentMemoryKB() {
+	return readStatusField("VmRSS");
+}
+
+long peakResidentMemoryKB() {
+	return readStatusField("VmHWM");
+}
+
+void reportMemory(const char* when) {
+	std::cerr << "Bank memory " << when << ": resident " << residentMemoryKB()
+			<< " kB, peak " << peakResidentMemoryKB() << " kB\n";
+}
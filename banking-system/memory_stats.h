@@ -0,0 +1,18 @@
+/*
+ * memory_stats.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef MEMORY_STATS_H_
+#define MEMORY_STATS_H_
+
+// Current and peak resident set size of the process in kB, 0 if unavailable
+long residentMemoryKB();
+long peakResidentMemoryKB();
+
+// Prints both figures to stderr, tagged with the point of the run they were taken at
+void reportMemory(const char* when);
+
+#endif /* MEMORY_STATS_H_ */
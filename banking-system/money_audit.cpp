@@ -0,0 +1,107 @@
+/*
+ * money_audit.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "money_audit.h"
+#include "atm_scheduler.h"
+#include <atomic>
+#include <cstdio>
+
+MoneyAudit::Change::Change(MoneyAudit& audit) : audit(audit) {
+	audit.started.add(1);
+	std::atomic_thread_fence(std::memory_order_seq_cst); // Counted before any balance moves
+}
+
+MoneyAudit::Change::~Change() {
+	std::atomic_thread_fence(std::memory_order_seq_cst); // Every move visible before it counts as done
+	audit.finished.add(1);
+}
+
+MoneyAudit::MoneyAudit() : cleanChanges(0), cleanAt(monotonicMicros()), reported(0), alertCount(0) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+MoneyAudit::~MoneyAudit() {
+	pthread_mutex_destroy(&mutex);
+}
+
+bool MoneyAudit::settle(long long& expected, long long& actual, long long& changes) {
+	for (int attempt = 0; attempt < AUDIT_SETTLE_ATTEMPTS; ++attempt) {
+		// The counters only grow, so if as many changes had begun after the reads as had
+		// finished before them, none was in flight while they ran
+		long long done = finished.value();
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		expected = deposits.value() - withdrawals.value() + restores.value() + moves.value();
+		actual = held.value();
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+		if (started.value() == done) {
+			changes = done;
+			return true;
+		}
+	}
+	return false;
+}
+
+void MoneyAudit::alert(const char* expectedWhat, long long expected, const char* actualWhat, long long actual,
+		long long changes) {
+	// Under the mutex. A discrepancy is reported once, not on every audit that still sees it.
+	if (actual - expected == reported) {
+		return;
+	}
+	reported = actual - expected;
+	alertCount++;
+	fprintf(stderr, "Bank audit: money is not conserved, %s %lld but %s %lld (%+lld), "
+			"somewhere in changes %lld..%lld, %.1f s after the last clean audit\n",
+			expectedWhat, expected, actualWhat, actual, actual - expected, cleanChanges, changes,
+			(monotonicMicros() - cleanAt) / 1e6);
+}
+
+bool MoneyAudit::check() {
+	long long expected;
+	long long actual;
+	long long changes;
+	if (!settle(expected, actual, changes)) {
+		return true; // Too busy to find a quiet moment, the next audit tries again
+	}
+	pthread_mutex_lock(&mutex);
+	bool balanced = expected == actual;
+	if (balanced) {
+		cleanChanges = changes;
+		cleanAt = monotonicMicros();
+		reported = 0;
+	} else {
+		alert("the flows come to", expected, "the balances hold", actual, changes);
+	}
+	pthread_mutex_unlock(&mutex);
+	return balanced;
+}
+
+long long MoneyAudit::mark() {
+	long long done = finished.value();
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return done;
+}
+
+bool MoneyAudit::checkSnapshot(long long mark, long long total) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	if (started.value() != mark) {
+		return true; // Changes ran during the capture, its sum proves nothing
+	}
+	pthread_mutex_lock(&mutex);
+	long long expected = held.value();
+	bool balanced = expected == total;
+	if (!balanced) {
+		alert("the running total is", expected, "the saved state sums to", total, mark);
+	}
+	pthread_mutex_unlock(&mutex);
+	return balanced;
+}
+
+long long MoneyAudit::alerts() {
+	pthread_mutex_lock(&mutex);
+	long long count = alertCount;
+	pthread_mutex_unlock(&mutex);
+	return count;
+}
@@ -0,0 +1,80 @@
+/*
+ * money_audit.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef MONEY_AUDIT_H_
+#define MONEY_AUDIT_H_
+
+#include <pthread.h>
+#include "striped_counter.h"
+
+#define AUDIT_INTERVAL_MS 1000   // Default period of the audit job
+#define AUDIT_SETTLE_ATTEMPTS 64 // Reads an audit tries before giving up on a moment without changes
+
+// Running totals of the money entering and leaving the bank, checked against a running total
+// of the balances. Every account adds its balance changes to balances() (see
+// Account::attachLedger) and the bank books the matching flow, so at any moment without a
+// change in flight
+//     deposits - withdrawals + restores + moves == balances (the bank account included)
+// All of them are striped counters: a change costs a few uncontended adds and a check reads
+// O(stripes) words, whatever the account count. Changes are bracketed by Change so a check
+// can tell a quiet moment from one where a change was half done.
+class MoneyAudit {
+private:
+	StripedCounter deposits;    // Opening balances and deposits
+	StripedCounter withdrawals; // Withdrawals and the balances of closed accounts
+	StripedCounter restores;    // Net change of the balances set by rollbacks
+	StripedCounter moves;       // Net money received from other partitions
+	StripedCounter held;        // Sum of every balance, kept by the accounts themselves
+	StripedCounter started;     // Changes begun
+	StripedCounter finished;    // Changes done
+
+	pthread_mutex_t mutex;      // Report state below
+	long long cleanChanges;     // Changes done at the last audit that balanced
+	long long cleanAt;          // monotonicMicros() of that audit
+	long long reported;         // Discrepancy of the last alert, 0 once balanced again
+	long long alertCount;
+
+	bool settle(long long& expected, long long& actual, long long& changes); // False if never quiet
+	void alert(const char* expectedWhat, long long expected, const char* actualWhat, long long actual,
+			long long changes); // Under the mutex
+
+	MoneyAudit(const MoneyAudit&);            // Not copyable
+	MoneyAudit& operator=(const MoneyAudit&);
+
+public:
+	// Brackets one change of the money, from before the first balance moves until after its flow is booked
+	class Change {
+	private:
+		MoneyAudit& audit;
+	public:
+		explicit Change(MoneyAudit& audit);
+		~Change();
+	};
+
+	MoneyAudit();
+	~MoneyAudit();
+
+	StripedCounter* balances() { return &held; }
+	void deposited(long long amount) { deposits.add(amount); }
+	void withdrew(long long amount) { withdrawals.add(amount); }
+	void restored(long long delta) { restores.add(delta); }
+	void moved(long long delta) { moves.add(delta); }
+
+	// Compares the flows with the balances at a quiet moment, alerts (to stderr) with the
+	// changes and the time since the last clean audit if they differ. False on an alert.
+	bool check();
+
+	// A capture of every balance calls mark() before it starts and checkSnapshot() with the
+	// sum it read; if no change ran meanwhile the sum must equal the running total, which
+	// catches balances changed behind the accounts' backs
+	long long mark();
+	bool checkSnapshot(long long mark, long long total);
+
+	long long alerts();
+};
+
+#endif /* MONEY_AUDIT_H_ */
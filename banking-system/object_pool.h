@@ -0,0 +1,116 @@
+/*
+ * object_pool.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef OBJECT_POOL_H_
+#define OBJECT_POOL_H_
+
+#include <new>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <type_traits>
+#include <pthread.h>
+#include "thread_placement.h"
+
+// Slab allocator for objects of one type. Objects never move, freed slots are
+// reused through a free list and slabs are only returned when the pool dies.
+template <typename T>
+class ObjectPool {
+private:
+	union Slot {
+		Slot* next; // Link in the free list while the slot is unused
+		typename std::aligned_storage<sizeof(T), alignof(T)>::type storage;
+	};
+
+	std::vector<Slot*> slabs;
+	Slot* freeList;
+	size_t slabSize;   // Objects per slab
+	size_t liveCount;
+	int node;          // NUMA node the slabs prefer, -1 = plain heap memory
+	pthread_mutex_t mutex;
+
+	void* acquire() {
+		pthread_mutex_lock(&mutex);
+		if (freeList == nullptr) {
+			Slot* slab = node < 0 ? new Slot[slabSize]
+					: static_cast<Slot*>(ThreadPlacement::allocate(sizeof(Slot) * slabSize, node));
+			if (slab == nullptr) {
+				pthread_mutex_unlock(&mutex);
+				throw std::bad_alloc();
+			}
+			slabs.push_back(slab);
+			for (size_t i = slabSize; i > 0; --i) {
+				slab[i - 1].next = freeList;
+				freeList = &slab[i - 1];
+			}
+		}
+		Slot* slot = freeList;
+		freeList = slot->next;
+		liveCount++;
+		pthread_mutex_unlock(&mutex);
+		return slot;
+	}
+
+	void release(void* memory) {
+		Slot* slot = static_cast<Slot*>(memory);
+		pthread_mutex_lock(&mutex);
+		slot->next = freeList;
+		freeList = slot;
+		liveCount--;
+		pthread_mutex_unlock(&mutex);
+	}
+
+	ObjectPool(const ObjectPool&);            // Not copyable
+	ObjectPool& operator=(const ObjectPool&);
+
+public:
+	explicit ObjectPool(size_t slabSize = 64) : freeList(nullptr), slabSize(slabSize), liveCount(0), node(-1) {
+		pthread_mutex_init(&mutex, nullptr);
+	}
+
+	// Every object must have been destroyed before the pool goes away
+	~ObjectPool() {
+		for (Slot* slab : slabs) {
+			if (node < 0) {
+				delete[] slab;
+			} else {
+				ThreadPlacement::release(slab, sizeof(Slot) * slabSize);
+			}
+		}
+		pthread_mutex_destroy(&mutex);
+	}
+
+	// Takes the slabs from `node` (see ThreadPlacement), only before the first create()
+	void setNode(int node) {
+		if (slabs.empty()) {
+			this->node = node;
+		}
+	}
+
+	template <typename... Args>
+	T* create(Args&&... args) {
+		void* memory = acquire();
+		try {
+			return new (memory) T(std::forward<Args>(args)...);
+		} catch (...) {
+			release(memory);
+			throw;
+		}
+	}
+
+	void destroy(T* object) {
+		if (object != nullptr) {
+			object->~T();
+			release(object);
+		}
+	}
+
+	size_t live() const { return liveCount; }
+	size_t capacity() const { return slabs.size() * slabSize; }
+};
+
+#endif /* OBJECT_POOL_H_ */
@@ -0,0 +1,482 @@
+/*
+ * partition.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "partition.h"
+#include "banking_system.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <csignal>
+#include <ctime>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+// Locks shared with another process are robust: a partition that dies holding one
+// leaves it to the next owner instead of blocking everyone forever
+static void initSharedMutex(pthread_mutex_t* mutex) {
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	pthread_mutex_init(mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+
+static void lockShared(pthread_mutex_t* mutex) {
+	if (pthread_mutex_lock(mutex) == EOWNERDEAD) {
+		pthread_mutex_consistent(mutex);
+	}
+}
+
+// Waits up to `millis` for the semaphore, false on timeout
+static bool waitShared(sem_t* semaphore, long millis) {
+	struct timespec deadline;
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += millis / 1000;
+	deadline.tv_nsec += (millis % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while (sem_timedwait(semaphore, &deadline) != 0) {
+		if (errno != EINTR) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static void* mapShared(size_t size) {
+	void* memory = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	return memory == MAP_FAILED ? nullptr : memory;
+}
+
+PartitionSet::PartitionSet(const BankConfig& config) : config(config), count(config.partitions),
+		replies(nullptr), down(config.partitions, false), started(false) {
+	pthread_mutex_init(&downMutex, nullptr);
+	pthread_mutex_init(&slotMutex, nullptr);
+	pthread_cond_init(&slotCond, nullptr);
+	for (int slot = PARTITION_REPLY_SLOTS - 1; slot >= 0; --slot) {
+		freeSlots.push_back(slot);
+	}
+}
+
+PartitionSet::~PartitionSet() {
+	stop();
+	for (PartitionChannel* channel : channels) {
+		munmap(channel, sizeof(PartitionChannel));
+	}
+	if (replies != nullptr) {
+		munmap(replies, sizeof(PartitionReply) * PARTITION_REPLY_SLOTS);
+	}
+	pthread_mutex_destroy(&downMutex);
+	pthread_mutex_destroy(&slotMutex);
+	pthread_cond_destroy(&slotCond);
+}
+
+bool PartitionSet::start() {
+	replies = static_cast<PartitionReply*>(mapShared(sizeof(PartitionReply) * PARTITION_REPLY_SLOTS));
+	if (replies == nullptr) {
+		return false;
+	}
+	for (size_t slot = 0; slot < PARTITION_REPLY_SLOTS; ++slot) {
+		sem_init(&replies[slot].ready, 1, 0);
+	}
+	// The status pages are only touched as far as they are filled
+	for (size_t i = 0; i < count; ++i) {
+		PartitionChannel* channel = static_cast<PartitionChannel*>(mapShared(sizeof(PartitionChannel)));
+		if (channel == nullptr) {
+			return false;
+		}
+		initSharedMutex(&channel->mutex);
+		sem_init(&channel->queued, 1, 0);
+		sem_init(&channel->free, 1, PARTITION_RING_SIZE);
+		channel->head = 0;
+		channel->count = 0;
+		channel->shutdown = false;
+		channel->statusCount = 0;
+		channels.push_back(channel);
+	}
+
+	std::fflush(nullptr); // Nothing buffered is written twice
+	for (size_t i = 0; i < count; ++i) {
+		pid_t pid = fork();
+		if (pid < 0) {
+			return false;
+		}
+		if (pid == 0) {
+			serve(i, channels[i], replies, config); // Does not return
+		}
+		pids.push_back(pid);
+	}
+	started = true;
+	return true;
+}
+
+void PartitionSet::stop() {
+	if (!started) {
+		return;
+	}
+	started = false;
+	for (size_t i = 0; i < count; ++i) {
+		PartitionChannel* channel = channels[i];
+		lockShared(&channel->mutex);
+		channel->shutdown = true;
+		pthread_mutex_unlock(&channel->mutex);
+		for (size_t worker = 0; worker < PARTITION_WORKERS; ++worker) {
+			sem_post(&channel->queued); // Found with an empty ring, it tells a worker to exit
+		}
+	}
+	for (size_t i = 0; i < count; ++i) {
+		if (alive(i)) {
+			waitpid(pids[i], nullptr, 0);
+		}
+	}
+}
+
+size_t PartitionSet::owner(int accountId) const {
+	long partitions = static_cast<long>(count);
+	return static_cast<size_t>(((accountId % partitions) + partitions) % partitions);
+}
+
+int PartitionSet::acquireSlot() {
+	pthread_mutex_lock(&slotMutex);
+	while (freeSlots.empty()) {
+		pthread_cond_wait(&slotCond, &slotMutex);
+	}
+	int slot = freeSlots.back();
+	freeSlots.pop_back();
+	pthread_mutex_unlock(&slotMutex);
+	return slot;
+}
+
+void PartitionSet::releaseSlot(int slot) {
+	pthread_mutex_lock(&slotMutex);
+	freeSlots.push_back(slot);
+	pthread_cond_signal(&slotCond);
+	pthread_mutex_unlock(&slotMutex);
+}
+
+bool PartitionSet::alive(size_t partition) {
+	pthread_mutex_lock(&downMutex);
+	if (!down[partition] && waitpid(pids[partition], nullptr, WNOHANG) != 0) {
+		down[partition] = true; // Exited and reaped, or not ours any more
+	}
+	bool up = !down[partition];
+	pthread_mutex_unlock(&downMutex);
+	return up;
+}
+
+bool PartitionSet::send(size_t partition, PartitionRequest& request) {
+	pthread_mutex_lock(&downMutex);
+	bool gone = down[partition]; // Known to be gone, fail without waiting on it
+	pthread_mutex_unlock(&downMutex);
+	if (gone) {
+		return false;
+	}
+
+	PartitionChannel* channel = channels[partition];
+	while (!waitShared(&channel->free, PARTITION_POLL_MS)) {
+		if (!alive(partition)) {
+			return false;
+		}
+	}
+	lockShared(&channel->mutex);
+	channel->ring[(channel->head + channel->count) % PARTITION_RING_SIZE] = request;
+	channel->count++;
+	pthread_mutex_unlock(&channel->mutex);
+	sem_post(&channel->queued);
+	return true;
+}
+
+bool PartitionSet::wait(size_t partition, int slot, PartitionResult& result) {
+	PartitionReply* reply = &replies[slot];
+	while (!waitShared(&reply->ready, PARTITION_POLL_MS)) {
+		if (!alive(partition)) {
+			return false;
+		}
+	}
+	result = reply->result;
+	return true;
+}
+
+bool PartitionSet::call(size_t partition, int op, const BankCommand& command, bool isPersist,
+		PartitionResult& result, int arg, int arg2) {
+	PartitionRequest request;
+	request.op = op;
+	request.slot = acquireSlot();
+	request.isPersist = isPersist;
+	request.arg = arg;
+	request.arg2 = arg2;
+	request.command = command;
+	bool answered = send(partition, request) && wait(partition, request.slot, result);
+	releaseSlot(request.slot);
+	return answered;
+}
+
+bool PartitionSet::callAll(int op, int arg, std::vector<PartitionResult>& results) {
+	// Queue the request everywhere first, so the partitions work on it in parallel
+	std::vector<int> slots(count);
+	std::vector<bool> sent(count);
+	BankCommand none;
+	std::memset(&none, 0, sizeof(none));
+	for (size_t i = 0; i < count; ++i) {
+		PartitionRequest request;
+		request.op = op;
+		request.slot = slots[i] = acquireSlot();
+		request.isPersist = true;
+		request.arg = arg;
+		request.arg2 = 0;
+		request.command = none;
+		sent[i] = send(i, request);
+	}
+	bool all = true;
+	results.resize(count);
+	for (size_t i = 0; i < count; ++i) {
+		if (!sent[i] || !wait(i, slots[i], results[i])) {
+			results[i].success = false;
+			all = false;
+		}
+		releaseSlot(slots[i]);
+	}
+	return all;
+}
+
+bool PartitionSet::execute(const BankCommand& command, bool isPersist, Bank* bank) {
+	gate.acquireReadLock();
+	bool success;
+	if (command.action == 'T') {
+		success = transfer(command, isPersist, bank);
+	} else {
+		PartitionResult result;
+		success = call(owner(command.accountId), PARTITION_EXECUTE, command, isPersist, result);
+		if (!success) {
+			bank->logTransaction(TxEvent::failure(TX_ERROR_PARTITION_DOWN, command.atmId, command.accountId));
+		} else {
+			success = result.success;
+		}
+	}
+	gate.releaseReadLock();
+	return success;
+}
+
+bool PartitionSet::transfer(const BankCommand& command, bool isPersist, Bank* bank) {
+	size_t source = owner(command.accountId);
+	size_t target = owner(command.destId);
+	PartitionResult result;
+	if (source == target) {
+		if (!call(source, PARTITION_EXECUTE, command, isPersist, result)) {
+			bank->logTransaction(TxEvent::failure(TX_ERROR_PARTITION_DOWN, command.atmId, command.accountId));
+			return false;
+		}
+		return result.success;
+	}
+
+	// Phase 1: the destination votes, the source checks like a local transfer and withdraws
+	PartitionResult vote;
+	if (!call(target, PARTITION_HAS_ACCOUNT, command, isPersist, vote)) {
+		bank->logTransaction(TxEvent::failure(TX_ERROR_PARTITION_DOWN, command.atmId, command.destId));
+		return false;
+	}
+	PartitionResult debit;
+	if (!call(source, PARTITION_PREPARE_DEBIT, command, isPersist, debit, vote.success ? 1 : 0)) {
+		bank->logTransaction(TxEvent::failure(TX_ERROR_PARTITION_DOWN, command.atmId, command.accountId));
+		return false;
+	}
+	if (!debit.success) {
+		return false; // The source logged why
+	}
+
+	// Phase 2: credit the destination, then complete the debit or undo it
+	PartitionResult credit;
+	bool reached = call(target, PARTITION_COMMIT_CREDIT, command, isPersist, credit);
+	if (!reached || !credit.success) {
+		call(source, PARTITION_ABORT_DEBIT, command, isPersist, result);
+		if (!reached) {
+			bank->logTransaction(TxEvent::failure(TX_ERROR_PARTITION_DOWN, command.atmId, command.destId));
+		} else if (!isPersist) {
+			bank->logTransaction(TxEvent::failure(TX_ERROR_ACCOUNT_MISSING, command.atmId, command.destId));
+		}
+		return false;
+	}
+	call(source, PARTITION_COMMIT_DEBIT, command, isPersist, result, debit.balance, credit.balance);
+	return true;
+}
+
+void PartitionSet::chargeCommission(int percentage) {
+	std::vector<PartitionResult> results;
+	gate.acquireWriteLock();
+	callAll(PARTITION_COMMISSION, percentage, results);
+	gate.releaseWriteLock();
+}
+
+void PartitionSet::saveStates(std::vector<PartitionStatusRecord>& out) {
+	std::vector<PartitionResult> results;
+	gate.acquireWriteLock(); // No command is half way through a partition
+	callAll(PARTITION_SAVE_STATE, 0, results);
+	gate.releaseWriteLock();
+
+	// Only the coordinator asks for status pages, one tick at a time
+	out.clear();
+	for (size_t i = 0; i < count; ++i) {
+		if (results[i].success) {
+			out.insert(out.end(), channels[i]->status, channels[i]->status + channels[i]->statusCount);
+		}
+	}
+	std::sort(out.begin(), out.end(), [](const PartitionStatusRecord& a, const PartitionStatusRecord& b) {
+		return a.id < b.id;
+	});
+}
+
+bool PartitionSet::restore(int R) {
+	std::vector<PartitionResult> results;
+	gate.acquireWriteLock();
+	bool restored = callAll(PARTITION_RESTORE, R, results);
+	gate.releaseWriteLock();
+	for (const PartitionResult& result : results) {
+		restored = restored && result.success;
+	}
+	return restored;
+}
+
+bool PartitionSet::totals(int ticksAgo, int& accounts, long long& total) {
+	std::vector<PartitionResult> results;
+	gate.acquireReadLock();
+	bool known = callAll(PARTITION_TOTALS, ticksAgo, results);
+	gate.releaseReadLock();
+	accounts = 0;
+	total = 0;
+	for (const PartitionResult& result : results) {
+		known = known && result.success;
+		accounts += result.count;
+		total += result.total;
+	}
+	return known;
+}
+
+// One thread of a partition process
+struct PartitionWorker {
+	Bank* bank;
+	PartitionChannel* channel;
+	PartitionReply* replies;
+	pthread_t thread;
+};
+
+static void dispatch(Bank* bank, PartitionChannel* channel, const PartitionRequest& request, PartitionResult& result) {
+	const BankCommand& command = request.command;
+	switch (request.op) {
+	case PARTITION_EXECUTE:
+		result.success = bank->executeCommand(command, request.isPersist);
+		break;
+	case PARTITION_HAS_ACCOUNT:
+		result.success = bank->hasAccount(command.destId);
+		break;
+	case PARTITION_PREPARE_DEBIT:
+		result.success = bank->prepareDebit(command, request.arg != 0, request.isPersist, result.balance);
+		break;
+	case PARTITION_COMMIT_CREDIT:
+		result.success = bank->commitCredit(command, result.balance);
+		break;
+	case PARTITION_ABORT_DEBIT:
+		bank->abortDebit(command);
+		result.success = true;
+		break;
+	case PARTITION_COMMIT_DEBIT:
+		bank->commitDebit(command, request.arg, request.arg2);
+		result.success = true;
+		break;
+	case PARTITION_COMMISSION:
+		bank->chargeCommissions(request.arg);
+		result.success = true;
+		break;
+	case PARTITION_SAVE_STATE: {
+		const BankState& state = bank->saveState();
+		size_t filled = 0;
+		for (const AccountRecord& record : state) {
+			if (filled == PARTITION_STATUS_CAPACITY) {
+				break; // The rest is left out of the status, the state itself is complete
+			}
+			PartitionStatusRecord& out = channel->status[filled++];
+			out.id = record.id;
+			out.balance = record.balance;
+			std::strncpy(out.password, record.password, COMMAND_PASSWORD_CAPACITY - 1);
+			out.password[COMMAND_PASSWORD_CAPACITY - 1] = '\0';
+		}
+		channel->statusCount = filled;
+		result.success = true;
+		break;
+	}
+	case PARTITION_RESTORE:
+		result.success = bank->restoreState(request.arg);
+		break;
+	case PARTITION_TOTALS:
+		result.success = bank->historyTotals(request.arg, result.count, result.total);
+		break;
+	}
+}
+
+void* PartitionSet::workerThread(void* arg) {
+	PartitionWorker* worker = static_cast<PartitionWorker*>(arg);
+	PartitionChannel* channel = worker->channel;
+	while (true) {
+		while (sem_wait(&channel->queued) != 0) {
+			// Interrupted, wait again
+		}
+		lockShared(&channel->mutex);
+		if (channel->count == 0) {
+			bool exit = channel->shutdown; // The wake-up of a shutdown, everything queued was served
+			pthread_mutex_unlock(&channel->mutex);
+			if (exit) {
+				return nullptr;
+			}
+			continue;
+		}
+		PartitionRequest request = channel->ring[channel->head];
+		channel->head = (channel->head + 1) % PARTITION_RING_SIZE;
+		channel->count--;
+		pthread_mutex_unlock(&channel->mutex);
+		sem_post(&channel->free);
+
+		PartitionResult result;
+		std::memset(&result, 0, sizeof(result));
+		dispatch(worker->bank, channel, request, result);
+
+		PartitionReply* reply = &worker->replies[request.slot];
+		reply->result = result;
+		sem_post(&reply->ready); // Publishes the result
+	}
+}
+
+void PartitionSet::serve(size_t index, PartitionChannel* channel, PartitionReply* replies, BankConfig config) {
+	prctl(PR_SET_PDEATHSIG, SIGKILL); // Never outlive the coordinator
+
+	// The coordinator runs the ticks, the ATMs and the VIP queue
+	config.partitions = 0;
+	config.timerJobs = false;
+	config.socketPath.clear();
+	config.recordPath.clear();
+	config.historyFile += ".p" + std::to_string(index);
+
+	Bank* bank = new Bank(0, config);
+	PartitionWorker workers[PARTITION_WORKERS];
+	for (size_t i = 0; i < PARTITION_WORKERS; ++i) {
+		workers[i].bank = bank;
+		workers[i].channel = channel;
+		workers[i].replies = replies;
+		pthread_create(&workers[i].thread, nullptr, workerThread, &workers[i]);
+		ThreadPlacement::instance().place(workers[i].thread, THREAD_ATM, index * PARTITION_WORKERS + i,
+				"partition " + std::to_string(index) + " worker " + std::to_string(i));
+	}
+	ThreadPlacement::instance().report(stderr); // This process's own threads
+	for (size_t i = 0; i < PARTITION_WORKERS; ++i) {
+		pthread_join(workers[i].thread, nullptr);
+	}
+	delete bank; // Flushes the log
+	_exit(0);
+}
@@ -0,0 +1,141 @@
+/*
+ * partition.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef PARTITION_H_
+#define PARTITION_H_
+
+#include <vector>
+#include <cstddef>
+#include <pthread.h>
+#include <semaphore.h>
+#include <sys/types.h>
+#include "bank_command.h"
+#include "bank_config.h"
+#include "read_write_lock.h"
+
+#define PARTITION_RING_SIZE 256          // Requests queued per partition
+#define PARTITION_REPLY_SLOTS 128        // Requests in flight across all partitions
+#define PARTITION_WORKERS 4              // Threads serving the ring in each partition process
+#define PARTITION_STATUS_CAPACITY 65536  // Accounts a partition reports per status tick
+#define PARTITION_POLL_MS 100            // How often a caller checks that a silent partition is alive
+
+class Bank;
+
+// What a partition process is asked to do
+enum PartitionOp {
+	PARTITION_EXECUTE,       // Run `command` as this process's bank would
+	PARTITION_HAS_ACCOUNT,   // Transfer vote of the destination: does `command.destId` exist
+	PARTITION_PREPARE_DEBIT, // Transfer phase 1 on the source: check and withdraw, `arg` is the vote
+	PARTITION_COMMIT_CREDIT, // Transfer phase 2 on the destination: deposit
+	PARTITION_ABORT_DEBIT,   // Transfer phase 2 on the source: give the withdrawn amount back
+	PARTITION_COMMIT_DEBIT,  // Transfer phase 2 on the source: log it, `arg`/`arg2` are the balances
+	PARTITION_COMMISSION,    // Commission pass at `arg` percent
+	PARTITION_SAVE_STATE,    // Save a state and copy it to the status page
+	PARTITION_RESTORE,       // Roll back to the state `arg` ticks ago
+	PARTITION_TOTALS         // Account count and total balance `arg` ticks ago
+};
+
+struct PartitionRequest {
+	int op;       // PartitionOp
+	int slot;     // Reply slot the caller waits on
+	bool isPersist;
+	int arg;
+	int arg2;
+	BankCommand command; // Plain data, copied between the processes as is
+};
+
+struct PartitionResult {
+	bool success;
+	int balance;
+	int count;
+	long long total;
+};
+
+// Where a partition posts the result of one request. The processes wake each other with
+// semaphores only: posting one never waits on the other side, even if it died mid-wait,
+// which a process-shared condition variable cannot promise.
+struct PartitionReply {
+	sem_t ready;
+	PartitionResult result;
+};
+
+struct PartitionStatusRecord {
+	int id;
+	int balance;
+	char password[COMMAND_PASSWORD_CAPACITY]; // Routed commands carry at most this much
+};
+
+// Shared memory between the coordinator and one partition process
+struct PartitionChannel {
+	pthread_mutex_t mutex; // Robust, a partition dying with it held leaves it to the next owner
+	sem_t queued;          // Requests in the ring, plus one wake-up per worker on shutdown
+	sem_t free;            // Empty places in the ring
+	size_t head;
+	size_t count;
+	bool shutdown; // Serve what is queued, then exit
+	PartitionRequest ring[PARTITION_RING_SIZE];
+	size_t statusCount; // Filled in by PARTITION_SAVE_STATE
+	PartitionStatusRecord status[PARTITION_STATUS_CAPACITY];
+};
+
+// Splits the accounts over processes, account id modulo the partition count picks the owner.
+// Each partition process runs its own Bank over its share; this process (the coordinator)
+// keeps the ATMs and routes their commands through shared-memory rings. A transfer between
+// partitions is two-phase: the destination votes, the source reserves the amount, then the
+// destination is credited and the source completes or gives the amount back. Ticks,
+// commissions and rollbacks go to every partition under the write side of a gate that each
+// command holds for reading, so the states saved on a tick form one consistent cut and
+// line up across partitions. A partition that dies only fails the commands it owns.
+class PartitionSet {
+private:
+	BankConfig config;
+	size_t count;
+	std::vector<pid_t> pids;
+	std::vector<PartitionChannel*> channels;
+	PartitionReply* replies; // PARTITION_REPLY_SLOTS, shared by every partition
+	std::vector<bool> down;  // Partitions known to be gone
+	pthread_mutex_t downMutex;
+	std::vector<int> freeSlots;
+	pthread_mutex_t slotMutex;
+	pthread_cond_t slotCond;
+	ReadWriteLock gate; // Commands read, ticks, commissions and rollbacks write
+	bool started;
+
+	int acquireSlot();
+	void releaseSlot(int slot);
+	bool alive(size_t partition);
+	bool send(size_t partition, PartitionRequest& request); // False if the partition is gone
+	bool wait(size_t partition, int slot, PartitionResult& result);
+	bool call(size_t partition, int op, const BankCommand& command, bool isPersist,
+			PartitionResult& result, int arg = 0, int arg2 = 0);
+	bool callAll(int op, int arg, std::vector<PartitionResult>& results); // False if any partition failed
+	bool transfer(const BankCommand& command, bool isPersist, Bank* bank);
+	static void serve(size_t index, PartitionChannel* channel, PartitionReply* replies, BankConfig config);
+	static void* workerThread(void* arg);
+
+	PartitionSet(const PartitionSet&);            // Not copyable
+	PartitionSet& operator=(const PartitionSet&);
+
+public:
+	PartitionSet(const BankConfig& config);
+	~PartitionSet(); // Stops the partitions
+
+	// Forks the partition processes. Call it before this process starts any thread.
+	bool start();
+	void stop(); // Lets every partition finish what is queued and waits for it to exit
+
+	size_t owner(int accountId) const;
+	// Runs a command on the account(s) it names, failures are logged through `bank`
+	bool execute(const BankCommand& command, bool isPersist, Bank* bank);
+	void chargeCommission(int percentage);
+	// Saves a state in every partition and returns their accounts, sorted by id
+	void saveStates(std::vector<PartitionStatusRecord>& out);
+	bool restore(int R); // Every partition rolls back to the state R ticks ago
+	bool totals(int ticksAgo, int& accounts, long long& total);
+};
+
+#endif /* PARTITION_H_ */
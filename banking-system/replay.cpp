@@ -0,0 +1,149 @@
+/*
+ * replay.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+// Re-executes a trace recorded with --record=PATH through the bank as fast as it can, one
+// change after the other, then checks the balances against the recorded ones:
+//   ./replay [options] <trace>
+// The options are the ones of ./bank (e.g. --log-format, --balance-index), so a run can be
+// replayed against other settings or another build to compare throughput. --single-writer
+// runs the account operations without their locks (SingleWriterPolicy), as nothing else
+// touches the bank during a replay.
+#include "banking_system.h"
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+
+int main(int argc, char* argv[]) {
+	BankConfig config;
+	const char* path = nullptr;
+	bool singleWriter = false;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--single-writer") {
+			singleWriter = true;
+		} else if (arg.compare(0, 2, "--") == 0) {
+			if (!config.parseOption(arg)) {
+				std::fprintf(stderr, "replay: unknown option %s\n", argv[i]);
+				return 1;
+			}
+		} else {
+			path = argv[i];
+		}
+	}
+	if (path == nullptr) {
+		std::fprintf(stderr, "usage: replay [options] <trace>\n");
+		return 1;
+	}
+	TraceReader reader;
+	if (!reader.open(path)) {
+		std::fprintf(stderr, "replay: %s is not a trace\n", path);
+		return 1;
+	}
+	config.recordPath.clear(); // Never record the replay itself
+	config.timerJobs = false;  // The recorded ticks and commissions are replayed instead
+
+	Bank bank(0, config);
+	std::map<int, std::string> passwords; // Of every account opened so far
+	std::map<int, int> expected;          // Recorded final balances
+	int expectedBank = 0;
+	long changes = 0;
+	TraceRecord record;
+	std::string password;
+
+	auto start = std::chrono::steady_clock::now();
+	auto end = start;
+	while (reader.next(record, password)) {
+		int atm = record.atmId;
+		switch (record.kind) {
+		case TRACE_OPEN:
+			passwords[record.accountId] = password;
+			bank.createAccount(record.accountId, password, record.amount, atm, false);
+			break;
+		case TRACE_CLOSE:
+			bank.deleteAccount(record.accountId, passwords[record.accountId], atm, false);
+			break;
+		case TRACE_DEPOSIT:
+			if (singleWriter) {
+				bank.depositAs<SingleWriterPolicy>(record.accountId, record.amount, passwords[record.accountId], atm, false);
+			} else {
+				bank.deposit(record.accountId, record.amount, passwords[record.accountId], atm, false);
+			}
+			break;
+		case TRACE_WITHDRAW:
+			if (singleWriter) {
+				bank.withdrawAs<SingleWriterPolicy>(record.accountId, record.amount, passwords[record.accountId], atm, false);
+			} else {
+				bank.withdraw(record.accountId, record.amount, passwords[record.accountId], atm, false);
+			}
+			break;
+		case TRACE_TRANSFER:
+			if (singleWriter) {
+				bank.transferAs<SingleWriterPolicy>(record.accountId, passwords[record.accountId], record.otherId,
+						record.amount, atm, false);
+			} else {
+				bank.transfer(record.accountId, passwords[record.accountId], record.otherId, record.amount, atm, false);
+			}
+			break;
+		case TRACE_BALANCE:
+		case TRACE_FAILED: // Changed nothing when it was recorded, only its lookup is repeated
+			if (singleWriter) {
+				bank.getBalanceAs<SingleWriterPolicy>(record.accountId, passwords[record.accountId], atm, true);
+			} else {
+				bank.getBalance(record.accountId, passwords[record.accountId], atm, true);
+			}
+			break;
+		case TRACE_COMMISSION:
+			bank.chargeCommission(record.accountId, record.amount);
+			break;
+		case TRACE_SET:
+			bank.rollbackAccount(record.accountId, record.amount);
+			break;
+		case TRACE_TICK:
+			bank.saveState();
+			break;
+		case TRACE_ROLLBACK:
+			break; // Its balances were recorded one account at a time
+		case TRACE_FINAL:
+			expected[record.accountId] = record.amount;
+			continue;
+		case TRACE_FINAL_BANK:
+			expectedBank = record.amount;
+			continue;
+		}
+		changes++;
+		end = std::chrono::steady_clock::now();
+	}
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	std::printf("replayed %ld records in %.3f s (%.0f records/s)\n", changes, seconds,
+			seconds > 0 ? changes / seconds : 0.0);
+
+	// Nothing runs concurrently any more, a saved state holds the final balances
+	const BankState& state = bank.saveState();
+	int mismatches = 0;
+	for (const auto& pair : expected) {
+		const AccountRecord* found = state.find(pair.first);
+		if (found == nullptr || found->balance != pair.second) {
+			std::fprintf(stderr, "replay: account %d has %d $, recorded %d $\n", pair.first,
+					found == nullptr ? 0 : found->balance, pair.second);
+			mismatches++;
+		}
+	}
+	if (state.size() != expected.size()) {
+		std::fprintf(stderr, "replay: %zu accounts, recorded %zu\n", state.size(), expected.size());
+		mismatches++;
+	}
+	if (bank.bankBalance() != expectedBank) {
+		std::fprintf(stderr, "replay: bank has %d $, recorded %d $\n", bank.bankBalance(), expectedBank);
+		mismatches++;
+	}
+	if (mismatches > 0) {
+		return 1;
+	}
+	std::printf("final balances of %zu accounts match\n", expected.size());
+	return 0;
+}
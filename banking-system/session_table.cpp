@@ -0,0 +1,59 @@
+/*
+ * session_table.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "session_table.h"
+
+SessionTable::SessionTable() {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+SessionTable::~SessionTable() {
+	pthread_mutex_destroy(&mutex);
+}
+
+void SessionTable::open(int atmId, int accountId, Account* account) {
+	pthread_mutex_lock(&mutex);
+	sessions[key(atmId, accountId)] = account;
+	pthread_mutex_unlock(&mutex);
+}
+
+Account* SessionTable::find(int atmId, int accountId) const {
+	pthread_mutex_lock(&mutex);
+	auto it = sessions.find(key(atmId, accountId));
+	Account* account = it == sessions.end() ? nullptr : it->second;
+	pthread_mutex_unlock(&mutex);
+	return account;
+}
+
+void SessionTable::forgetAccount(int accountId, const Account* account) {
+	pthread_mutex_lock(&mutex);
+	for (auto it = sessions.begin(); it != sessions.end();) {
+		if (static_cast<int>(it->first & 0xffffffffLL) == accountId && it->second == account) {
+			it = sessions.erase(it);
+		} else {
+			++it;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void SessionTable::forgetATM(int atmId) {
+	pthread_mutex_lock(&mutex);
+	for (auto it = sessions.begin(); it != sessions.end();) {
+		if (static_cast<int>(it->first >> 32) == atmId) {
+			it = sessions.erase(it);
+		} else {
+			++it;
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void SessionTable::clear() {
+	pthread_mutex_lock(&mutex);
+	sessions.clear();
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,46 @@
+/*
+ * session_table.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef SESSION_TABLE_H_
+#define SESSION_TABLE_H_
+
+#include <unordered_map>
+#include <pthread.h>
+
+class Account;
+
+// Password given by a command to use the session its ATM opened on the account
+#define SESSION_PASSWORD "*"
+
+// Logged-in (ATM, account) pairs. A session is opened once the password was checked
+// and caches the Account, so later commands of that ATM skip both the password
+// comparison and the accounts map lookup. The bank drops sessions whenever the
+// cached Account may go away: account deletion, restore and ATM closure.
+class SessionTable {
+private:
+	std::unordered_map<long long, Account*> sessions; // (atm id, account id) -> account
+	mutable pthread_mutex_t mutex;
+
+	static long long key(int atmId, int accountId) {
+		return (static_cast<long long>(atmId) << 32) | static_cast<unsigned int>(accountId);
+	}
+
+	SessionTable(const SessionTable&);            // Not copyable
+	SessionTable& operator=(const SessionTable&);
+
+public:
+	SessionTable();
+	~SessionTable();
+
+	void open(int atmId, int accountId, Account* account); // Replaces an existing session
+	Account* find(int atmId, int accountId) const;          // nullptr if not logged in
+	void forgetAccount(int accountId, const Account* account); // Only the sessions on that account
+	void forgetATM(int atmId);
+	void clear();
+};
+
+#endif /* SESSION_TABLE_H_ */
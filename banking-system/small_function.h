@@ -0,0 +1,108 @@
+/*
+ * small_function.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef SMALL_FUNCTION_H_
+#define SMALL_FUNCTION_H_
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <type_traits>
+
+// Move-only void() callable stored inline in a fixed-size buffer.
+// Unlike std::function it never allocates: a callable that does not fit is a compile error.
+template <size_t Capacity>
+class SmallFunction {
+private:
+	typename std::aligned_storage<Capacity, alignof(std::max_align_t)>::type storage;
+	void (*invokeFn)(void* callable);
+	void (*moveFn)(void* dest, void* src); // Move-constructs into dest and destroys src
+	void (*destroyFn)(void* callable);
+
+	template <typename F>
+	static void invokeImpl(void* callable) {
+		(*static_cast<F*>(callable))();
+	}
+
+	template <typename F>
+	static void moveImpl(void* dest, void* src) {
+		new (dest) F(std::move(*static_cast<F*>(src)));
+		static_cast<F*>(src)->~F();
+	}
+
+	template <typename F>
+	static void destroyImpl(void* callable) {
+		static_cast<F*>(callable)->~F();
+	}
+
+	void moveFrom(SmallFunction& other) {
+		invokeFn = other.invokeFn;
+		moveFn = other.moveFn;
+		destroyFn = other.destroyFn;
+		if (invokeFn != nullptr) {
+			moveFn(&storage, &other.storage);
+			other.invokeFn = nullptr;
+			other.moveFn = nullptr;
+			other.destroyFn = nullptr;
+		}
+	}
+
+public:
+	SmallFunction() : invokeFn(nullptr), moveFn(nullptr), destroyFn(nullptr) {}
+
+	SmallFunction(std::nullptr_t) : invokeFn(nullptr), moveFn(nullptr), destroyFn(nullptr) {}
+
+	template <typename F, typename = typename std::enable_if<
+			!std::is_same<typename std::decay<F>::type, SmallFunction>::value>::type>
+	SmallFunction(F&& callable) {
+		typedef typename std::decay<F>::type Callable;
+		static_assert(sizeof(Callable) <= Capacity, "callable does not fit in SmallFunction");
+		static_assert(alignof(Callable) <= alignof(std::max_align_t), "callable is over-aligned");
+		new (&storage) Callable(std::forward<F>(callable));
+		invokeFn = &invokeImpl<Callable>;
+		moveFn = &moveImpl<Callable>;
+		destroyFn = &destroyImpl<Callable>;
+	}
+
+	SmallFunction(SmallFunction&& other) {
+		moveFrom(other);
+	}
+
+	SmallFunction& operator=(SmallFunction&& other) {
+		if (this != &other) {
+			reset();
+			moveFrom(other);
+		}
+		return *this;
+	}
+
+	SmallFunction(const SmallFunction&) = delete;
+	SmallFunction& operator=(const SmallFunction&) = delete;
+
+	~SmallFunction() {
+		reset();
+	}
+
+	void reset() {
+		if (destroyFn != nullptr) {
+			destroyFn(&storage);
+		}
+		invokeFn = nullptr;
+		moveFn = nullptr;
+		destroyFn = nullptr;
+	}
+
+	explicit operator bool() const {
+		return invokeFn != nullptr;
+	}
+
+	void operator()() {
+		invokeFn(&storage);
+	}
+};
+
+#endif /* SMALL_FUNCTION_H_ */
@@ -0,0 +1,341 @@
+/*
+ * snapshot_archive.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "snapshot_archive.h"
+#include "banking_system.h"
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#define ARCHIVE_MAGIC 0x31534842u // "BHS1"
+#define ARCHIVE_BASE 0u
+#define ARCHIVE_DELTA 1u
+#define ARCHIVE_REMOVED 1u        // Entry flag: the account is gone in this state
+
+struct ArchiveRecordHeader {
+	uint32_t magic;
+	uint32_t kind;
+	uint64_t sequence;
+	uint32_t count;   // Entries in the payload
+	uint32_t size;    // Payload bytes
+};
+
+struct ArchiveEntryHeader {
+	int32_t id;
+	int32_t balance;
+	uint8_t flags;
+	uint8_t reserved;
+	uint16_t passwordLength; // Followed by the password bytes
+};
+
+SnapshotArchive::SnapshotArchive(const std::string& path, size_t retention)
+	: path(path), retention(retention), fd(-1), fileSize(0), map(nullptr), mapSize(0),
+	  lastAppended(0), failed(false), stopping(false), writer(), writerStarted(false) {
+	pthread_mutex_init(&indexMutex, nullptr);
+	pthread_cond_init(&indexCond, nullptr);
+	pthread_mutex_init(&queueMutex, nullptr);
+	pthread_cond_init(&queueCond, nullptr);
+}
+
+SnapshotArchive::~SnapshotArchive() {
+	if (writerStarted) {
+		pthread_mutex_lock(&queueMutex);
+		stopping = true;
+		pthread_cond_signal(&queueCond);
+		pthread_mutex_unlock(&queueMutex);
+		pthread_join(writer, nullptr);
+	}
+	if (map != nullptr) {
+		munmap(const_cast<char*>(map), mapSize);
+	}
+	if (fd >= 0) {
+		close(fd);
+	}
+	pthread_cond_destroy(&queueCond);
+	pthread_mutex_destroy(&queueMutex);
+	pthread_cond_destroy(&indexCond);
+	pthread_mutex_destroy(&indexMutex);
+}
+
+bool SnapshotArchive::open() {
+	fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (fd < 0) {
+		perror("Bank error: history file");
+		return false;
+	}
+	writerStarted = pthread_create(&writer, nullptr, SnapshotArchive::writerThread, this) == 0;
+	if (writerStarted) {
+		ThreadPlacement::instance().place(writer, THREAD_BACKGROUND, 0, "history writer");
+	}
+	return writerStarted;
+}
+
+void SnapshotArchive::encode(std::string& out, int id, int balance, uint8_t flags, const char* password, size_t length) {
+	ArchiveEntryHeader entry;
+	entry.id = id;
+	entry.balance = balance;
+	entry.flags = flags;
+	entry.reserved = 0;
+	entry.passwordLength = static_cast<uint16_t>(length);
+	out.append(reinterpret_cast<const char*>(&entry), sizeof(entry));
+	out.append(password, length);
+}
+
+void SnapshotArchive::append(uint64_t sequence, const BankState& state) {
+	Pending pending;
+	pending.sequence = sequence;
+	pending.count = static_cast<uint32_t>(state.size());
+	pending.entries.reserve(state.size() * (sizeof(ArchiveEntryHeader) + 8));
+	for (const AccountRecord& record : state) {
+		encode(pending.entries, record.id, record.balance, 0, record.password, std::strlen(record.password));
+	}
+
+	pthread_mutex_lock(&indexMutex);
+	lastAppended = sequence;
+	pthread_mutex_unlock(&indexMutex);
+
+	pthread_mutex_lock(&queueMutex);
+	queue.push_back(std::move(pending));
+	pthread_cond_signal(&queueCond);
+	pthread_mutex_unlock(&queueMutex);
+}
+
+void* SnapshotArchive::writerThread(void* arg) {
+	SnapshotArchive* archive = static_cast<SnapshotArchive*>(arg);
+	pthread_mutex_lock(&archive->queueMutex);
+	while (true) {
+		while (archive->queue.empty() && !archive->stopping) {
+			pthread_cond_wait(&archive->queueCond, &archive->queueMutex);
+		}
+		if (archive->queue.empty()) {
+			break; // Stopping and everything is written
+		}
+		Pending pending = std::move(archive->queue.front());
+		archive->queue.pop_front();
+		pthread_mutex_unlock(&archive->queueMutex);
+
+		archive->write(pending);
+
+		pthread_mutex_lock(&archive->queueMutex);
+	}
+	pthread_mutex_unlock(&archive->queueMutex);
+	return nullptr;
+}
+
+bool SnapshotArchive::writeRecord(int file, uint32_t kind, uint64_t sequence, const std::string& payload, uint32_t count) {
+	ArchiveRecordHeader header;
+	header.magic = ARCHIVE_MAGIC;
+	header.kind = kind;
+	header.sequence = sequence;
+	header.count = count;
+	header.size = static_cast<uint32_t>(payload.size());
+
+	std::string record(reinterpret_cast<const char*>(&header), sizeof(header));
+	record += payload;
+	size_t written = 0;
+	while (written < record.size()) {
+		ssize_t n = ::write(file, record.data() + written, record.size() - written);
+		if (n < 0) {
+			perror("Bank error: history file");
+			return false;
+		}
+		written += n;
+	}
+	return true;
+}
+
+void SnapshotArchive::write(const Pending& pending) {
+	// Decode the state, it becomes `previous` for the next delta
+	Accounts current;
+	const char* pos = pending.entries.data();
+	for (uint32_t i = 0; i < pending.count; ++i) {
+		ArchiveEntryHeader entry;
+		std::memcpy(&entry, pos, sizeof(entry));
+		pos += sizeof(entry);
+		Account& account = current[entry.id];
+		account.balance = entry.balance;
+		account.password.assign(pos, entry.passwordLength);
+		pos += entry.passwordLength;
+	}
+
+	pthread_mutex_lock(&indexMutex);
+	bool isBase = index.empty() || index.size() - index.back().base >= ARCHIVE_BASE_INTERVAL;
+	pthread_mutex_unlock(&indexMutex);
+
+	uint32_t kind = ARCHIVE_BASE;
+	uint32_t count = pending.count;
+	const std::string* payload = &pending.entries;
+	std::string delta;
+	if (!isBase) {
+		// Accounts that changed or appeared, then the ones that are gone
+		kind = ARCHIVE_DELTA;
+		count = 0;
+		for (const auto& pair : current) {
+			auto it = previous.find(pair.first);
+			if (it == previous.end() || it->second.balance != pair.second.balance ||
+					it->second.password != pair.second.password) {
+				encode(delta, pair.first, pair.second.balance, 0, pair.second.password.data(), pair.second.password.size());
+				count++;
+			}
+		}
+		for (const auto& pair : previous) {
+			if (current.find(pair.first) == current.end()) {
+				encode(delta, pair.first, 0, ARCHIVE_REMOVED, "", 0);
+				count++;
+			}
+		}
+		payload = &delta;
+	}
+
+	if (failed || !writeRecord(fd, kind, pending.sequence, *payload, count)) {
+		pthread_mutex_lock(&indexMutex);
+		failed = true;
+		pthread_cond_broadcast(&indexCond);
+		pthread_mutex_unlock(&indexMutex);
+		return;
+	}
+	previous.swap(current);
+
+	pthread_mutex_lock(&indexMutex);
+	IndexEntry entry;
+	entry.sequence = pending.sequence;
+	entry.offset = fileSize;
+	entry.base = isBase ? index.size() : index.back().base;
+	index.push_back(entry);
+	fileSize += sizeof(ArchiveRecordHeader) + payload->size();
+	if (retention > 0 && index.size() >= 2 * retention && index.size() - retention > ARCHIVE_BASE_INTERVAL) {
+		compact();
+	}
+	pthread_cond_broadcast(&indexCond);
+	pthread_mutex_unlock(&indexMutex);
+}
+
+bool SnapshotArchive::remap() {
+	if (mapSize >= fileSize) {
+		return true;
+	}
+	if (map != nullptr) {
+		munmap(const_cast<char*>(map), mapSize);
+		map = nullptr;
+		mapSize = 0;
+	}
+	void* mapped = mmap(nullptr, fileSize, PROT_READ, MAP_SHARED, fd, 0);
+	if (mapped == MAP_FAILED) {
+		perror("Bank error: history file");
+		return false;
+	}
+	map = static_cast<const char*>(mapped);
+	mapSize = fileSize;
+	return true;
+}
+
+bool SnapshotArchive::materialize(size_t position, Accounts& out) {
+	if (!remap()) {
+		return false;
+	}
+	out.clear();
+	for (size_t i = index[position].base; i <= position; ++i) {
+		ArchiveRecordHeader header;
+		std::memcpy(&header, map + index[i].offset, sizeof(header));
+		const char* pos = map + index[i].offset + sizeof(header);
+		for (uint32_t n = 0; n < header.count; ++n) {
+			ArchiveEntryHeader entry;
+			std::memcpy(&entry, pos, sizeof(entry));
+			pos += sizeof(entry);
+			if (entry.flags & ARCHIVE_REMOVED) {
+				out.erase(entry.id);
+			} else {
+				Account& account = out[entry.id];
+				account.balance = entry.balance;
+				account.password.assign(pos, entry.passwordLength);
+			}
+			pos += entry.passwordLength;
+		}
+	}
+	return true;
+}
+
+void SnapshotArchive::compact() {
+	// Rewrite the file from a base of the oldest state we keep, the records after it stay as they are
+	size_t first = index.size() - retention;
+	Accounts oldest;
+	if (!materialize(first, oldest)) {
+		return;
+	}
+	std::string payload;
+	for (const auto& pair : oldest) {
+		encode(payload, pair.first, pair.second.balance, 0, pair.second.password.data(), pair.second.password.size());
+	}
+
+	std::string tmpPath = path + ".tmp";
+	int tmp = ::open(tmpPath.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_APPEND, 0644);
+	if (tmp < 0) {
+		perror("Bank error: history file");
+		return;
+	}
+	size_t tailOffset = first + 1 < index.size() ? index[first + 1].offset : fileSize;
+	bool ok = writeRecord(tmp, ARCHIVE_BASE, index[first].sequence, payload, static_cast<uint32_t>(oldest.size()));
+	size_t headSize = sizeof(ArchiveRecordHeader) + payload.size();
+	size_t written = 0;
+	while (ok && written < fileSize - tailOffset) {
+		ssize_t n = ::write(tmp, map + tailOffset + written, fileSize - tailOffset - written);
+		if (n < 0) {
+			perror("Bank error: history file");
+			ok = false;
+		} else {
+			written += n;
+		}
+	}
+	if (!ok || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		close(tmp);
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	// Rebase the index on the new file
+	std::vector<IndexEntry> rebased;
+	rebased.reserve(retention);
+	for (size_t i = first; i < index.size(); ++i) {
+		IndexEntry entry = index[i];
+		entry.offset = i == first ? 0 : entry.offset - tailOffset + headSize;
+		entry.base = entry.base <= first ? 0 : entry.base - first;
+		rebased.push_back(entry);
+	}
+	index.swap(rebased);
+	munmap(const_cast<char*>(map), mapSize);
+	map = nullptr;
+	mapSize = 0;
+	close(fd);
+	fd = tmp;
+	fileSize = headSize + written;
+}
+
+bool SnapshotArchive::load(uint64_t sequence, BankState& out) {
+	pthread_mutex_lock(&indexMutex);
+	// The writer may still be behind by a few states
+	while (!failed && sequence <= lastAppended && (index.empty() || index.back().sequence < sequence)) {
+		pthread_cond_wait(&indexCond, &indexMutex);
+	}
+	if (index.empty() || sequence < index.front().sequence || sequence > index.back().sequence) {
+		pthread_mutex_unlock(&indexMutex);
+		return false;
+	}
+
+	Accounts accounts;
+	bool ok = materialize(sequence - index.front().sequence, accounts);
+	pthread_mutex_unlock(&indexMutex);
+	if (!ok) {
+		return false;
+	}
+
+	out.reset(accounts.size());
+	for (const auto& pair : accounts) {
+		out.add(pair.first, pair.second.balance, pair.second.password);
+	}
+	return true;
+}
@@ -0,0 +1,92 @@
+/*
+ * snapshot_archive.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef SNAPSHOT_ARCHIVE_H_
+#define SNAPSHOT_ARCHIVE_H_
+
+#include <map>
+#include <deque>
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+class BankState;
+
+#define ARCHIVE_BASE_INTERVAL 64 // A full base every that many snapshots, deltas in between
+
+// Disk tier of the bank history. Every saved state is handed to append(), copied,
+// and written by a background thread to an append-only file as either a full base
+// or a delta against the previous state. load() rebuilds a state from the mapped
+// file by reading its base and at most ARCHIVE_BASE_INTERVAL - 1 deltas.
+// States older than the retention are dropped by rewriting the file from a new base.
+class SnapshotArchive {
+private:
+	struct Account {
+		int balance;
+		std::string password;
+	};
+	typedef std::map<int, Account> Accounts; // By id
+
+	struct Pending {
+		uint64_t sequence;
+		std::string entries; // Records encoded as in a base
+		uint32_t count;
+	};
+
+	struct IndexEntry {
+		uint64_t sequence;
+		size_t offset; // Of the record header in the file
+		size_t base;   // Index of the base the record builds on
+	};
+
+	std::string path;
+	size_t retention;         // States kept (0 = all)
+	int fd;
+	size_t fileSize;          // Bytes written, visible to load() once indexed
+	const char* map;          // Read-only mapping of the file
+	size_t mapSize;
+
+	std::vector<IndexEntry> index; // Contiguous sequences, oldest first
+	uint64_t lastAppended;         // Newest sequence handed to append()
+	bool failed;                   // A write failed, nothing more gets indexed
+	pthread_mutex_t indexMutex;
+	pthread_cond_t indexCond;      // Signaled when a record is indexed
+
+	std::deque<Pending> queue;
+	pthread_mutex_t queueMutex;
+	pthread_cond_t queueCond;
+	bool stopping;
+	pthread_t writer;
+	bool writerStarted;
+
+	Accounts previous;        // Last state written, deltas are taken against it (writer thread only)
+
+	static void* writerThread(void* arg);
+	void write(const Pending& pending);
+	bool writeRecord(int file, uint32_t kind, uint64_t sequence, const std::string& payload, uint32_t count);
+	void compact();
+	bool remap();                                       // indexMutex held
+	bool materialize(size_t position, Accounts& out);   // indexMutex held
+	static void encode(std::string& out, int id, int balance, uint8_t flags, const char* password, size_t length);
+
+	SnapshotArchive(const SnapshotArchive&);            // Not copyable
+	SnapshotArchive& operator=(const SnapshotArchive&);
+
+public:
+	SnapshotArchive(const std::string& path, size_t retention);
+	~SnapshotArchive(); // Writes out what is still queued
+
+	bool open(); // Starts a fresh file, false on error
+
+	void append(uint64_t sequence, const BankState& state);
+	bool load(uint64_t sequence, BankState& out); // False if the state is not retained
+};
+
+#endif /* SNAPSHOT_ARCHIVE_H_ */
@@ -0,0 +1,46 @@
+/*
+ * striped_counter.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "striped_counter.h"
+#include <sched.h>
+#include <pthread.h>
+#include <functional>
+
+StripedCounter::StripedCounter() {
+	for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+		stripes[i].value.store(0, std::memory_order_relaxed);
+	}
+}
+
+size_t StripedCounter::stripeIndex() {
+	int cpu = sched_getcpu();
+	if (cpu < 0) {
+		// No per-CPU id available, spread by thread instead
+		static thread_local size_t threadHash = std::hash<pthread_t>()(pthread_self());
+		return threadHash & (COUNTER_STRIPES - 1);
+	}
+	return static_cast<size_t>(cpu) & (COUNTER_STRIPES - 1);
+}
+
+void StripedCounter::add(long long amount) {
+	stripes[stripeIndex()].value.fetch_add(amount, std::memory_order_relaxed);
+}
+
+long long StripedCounter::value() const {
+	long long total = 0;
+	for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+		total += stripes[i].value.load(std::memory_order_relaxed);
+	}
+	return total;
+}
+
+long long StripedCounter::drain() {
+	long long total = 0;
+	for (size_t i = 0; i < COUNTER_STRIPES; ++i) {
+		total += stripes[i].value.exchange(0, std::memory_order_relaxed);
+	}
+	return total;
+}
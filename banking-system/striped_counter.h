@@ -0,0 +1,42 @@
+/*
+ * striped_counter.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef STRIPED_COUNTER_H_
+#define STRIPED_COUNTER_H_
+
+#include <atomic>
+#include <cstddef>
+
+#define COUNTER_STRIPES 16 // Power of two, more than the cores we expect to share a counter
+#define CACHE_LINE_SIZE 64
+
+// Counter split into per-CPU partial sums, each on its own cache line.
+// add() touches only the stripe of the calling CPU so concurrent writers do not
+// bounce a shared line; value() adds up the stripes.
+class StripedCounter {
+private:
+	struct Stripe {
+		std::atomic<long long> value;
+		char padding[CACHE_LINE_SIZE - sizeof(std::atomic<long long>)];
+	};
+
+	Stripe stripes[COUNTER_STRIPES];
+
+	static size_t stripeIndex();
+
+	StripedCounter(const StripedCounter&);            // Not copyable
+	StripedCounter& operator=(const StripedCounter&);
+
+public:
+	StripedCounter();
+
+	void add(long long amount);
+	long long value() const; // Exact once the writers are quiet, a valid total in between
+	long long drain();       // Moves every stripe to zero and returns what they held
+};
+
+#endif /* STRIPED_COUNTER_H_ */
@@ -1,35 +1,198 @@
 
 #include "task_queue.h"
+#include "atm_scheduler.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <time.h>
+
+WaitStats::WaitStats() : count(0), missed(0), totalMicros(0), maxMicros(0) {
+    std::memset(buckets, 0, sizeof(buckets));
+}
+
+void WaitStats::record(long long waitMicros, bool missedTarget) {
+    count++;
+    missed += missedTarget ? 1 : 0;
+    totalMicros += waitMicros;
+    maxMicros = std::max(maxMicros, waitMicros);
+    int bucket = 0;
+    while (bucket < WAIT_BUCKETS - 1 && waitMicros >= (1LL << bucket)) {
+        ++bucket;
+    }
+    buckets[bucket]++;
+}
+
+long long WaitStats::percentile(double q) const {
+    unsigned long rank = static_cast<unsigned long>(q * count);
+    unsigned long seen = 0;
+    for (int bucket = 0; bucket < WAIT_BUCKETS; ++bucket) {
+        seen += buckets[bucket];
+        if (seen > rank) {
+            return std::min(1LL << bucket, maxMicros);
+        }
+    }
+    return maxMicros;
+}
 
 TaskQueue::TaskQueue() {
-    pthread_cond_init(&cond, nullptr);
+    // Idle waits are timed on the monotonic clock, see pop(maxWaitMicros, idle)
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&cond, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&notFull, nullptr);
+    tasks.reserve(256); // Bursts below this never grow the heap
 }
 
 TaskQueue::~TaskQueue() {
+    pthread_cond_destroy(&notFull);
     pthread_cond_destroy(&cond);
 }
 
-void TaskQueue::push(const Task& task) {
+void TaskQueue::setScheduling(long long aging, const std::map<int, long long>& priorityTargets) {
+    pthread_mutex_lock(rwLock.getUnderlyingMutex());
+    agingMicros = aging;
+    targets = priorityTargets;
+    pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+}
+
+void TaskQueue::setCapacity(size_t maxTasks, OverflowPolicy policy) {
+    pthread_mutex_lock(rwLock.getUnderlyingMutex());
+    capacity = maxTasks;
+    overflow = policy;
+    pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+}
+
+void TaskQueue::setFairShare(const std::map<int, size_t>& flowWeights, size_t otherWeight) {
+    pthread_mutex_lock(rwLock.getUnderlyingMutex());
+    fair = true;
+    weights = flowWeights;
+    defaultWeight = otherWeight;
+    pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+}
+
+void TaskQueue::reportWaits(FILE* out) {
+    pthread_mutex_lock(rwLock.getUnderlyingMutex());
+    if (capacity > 0) {
+        std::fprintf(out, "VIP queue: capacity %zu, %lu shed, %lu rejected\n", capacity, shedCount, rejectedCount);
+    }
+    for (const auto& entry : waits) {
+        const WaitStats& stats = entry.second;
+        std::fprintf(out, "VIP=%d: %lu tasks, wait mean %.3f ms, p50 %.3f ms, p99 %.3f ms, max %.3f ms",
+                entry.first, stats.count, stats.totalMicros / 1000.0 / stats.count,
+                stats.percentile(0.5) / 1000.0, stats.percentile(0.99) / 1000.0, stats.maxMicros / 1000.0);
+        std::map<int, long long>::const_iterator target = targets.find(entry.first);
+        if (target != targets.end()) {
+            std::fprintf(out, ", %lu over the %.3f ms target", stats.missed, target->second / 1000.0);
+        }
+        std::fprintf(out, "\n");
+    }
+    pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+}
+
+int TaskQueue::push(Task&& task, bool mayBlock) {
+    long long now = monotonicMicros();
+    Task dropped; // Destroyed once the mutex is released
+    int droppedCount = 0;
     pthread_mutex_lock(rwLock.getUnderlyingMutex()); 
-    tasks.push(task);
+    task.enqueuedAt = now;
+    task.seq = pushed++;
+    std::map<int, long long>::const_iterator target = targets.find(task.priority);
+    if (target != targets.end()) {
+        task.due = now + target->second;
+    } else if (agingMicros > 0) {
+        task.due = now + task.priority * agingMicros;
+    }
+    if (fair) {
+        // Starts when its flow's previous task finishes, or now in virtual time if the flow had none queued
+        FairClock& clock = fairClocks[task.priority];
+        unsigned long long& finish = clock.finish[task.flow];
+        std::map<int, size_t>::const_iterator weight = weights.find(task.flow);
+        task.fairTag = std::max(clock.virtualTime, finish);
+        finish = task.fairTag + FAIR_TASK_COST / (weight != weights.end() ? weight->second : defaultWeight);
+    }
+
+    if (capacity > 0 && overflow == OVERFLOW_BLOCK && mayBlock) {
+        while (tasks.size() >= capacity && poolRunning) {
+            pthread_cond_wait(&notFull, rwLock.getUnderlyingMutex());
+        }
+    } else if (capacity > 0 && tasks.size() >= capacity) {
+        droppedCount = 1;
+        if (overflow != OVERFLOW_SHED) {
+            rejectedCount++;
+            dropped = std::move(task);
+        } else {
+            shedCount++;
+            // The task served last is the smallest one, it is either a leaf or the new task
+            std::vector<Task>::iterator last = std::min_element(tasks.begin(), tasks.end());
+            if (task < *last) {
+                dropped = std::move(task);
+            } else {
+                dropped = std::move(*last);
+                *last = std::move(task);
+                std::make_heap(tasks.begin(), tasks.end());
+                pthread_cond_signal(&cond);
+            }
+        }
+        pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+        return droppedCount;
+    }
+
+    tasks.push_back(std::move(task));
+    std::push_heap(tasks.begin(), tasks.end());
     pthread_cond_signal(&cond); // Notify one waiting thread 
     pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+    return droppedCount;
 }
 
 Task TaskQueue::pop() {
+    bool idle = false;
+    return pop(0, idle);
+}
+
+Task TaskQueue::pop(long long maxWaitMicros, bool& idle) {
+    idle = false;
+    struct timespec deadline;
+    if (maxWaitMicros > 0) {
+        long long due = monotonicMicros() + maxWaitMicros;
+        deadline.tv_sec = due / 1000000;
+        deadline.tv_nsec = (due % 1000000) * 1000;
+    }
     pthread_mutex_lock(rwLock.getUnderlyingMutex());
 
     // Wait for tasks to be added
     while (tasks.empty() && poolRunning ) {
-        pthread_cond_wait(&cond, rwLock.getUnderlyingMutex());
+        if (maxWaitMicros <= 0) {
+            pthread_cond_wait(&cond, rwLock.getUnderlyingMutex());
+        } else if (pthread_cond_timedwait(&cond, rwLock.getUnderlyingMutex(), &deadline) == ETIMEDOUT
+                && tasks.empty() && poolRunning) {
+            idle = true;
+            pthread_mutex_unlock(rwLock.getUnderlyingMutex());
+            return Task();
+        }
     } 
     if (tasks.empty() && !poolRunning) {
         pthread_mutex_unlock(rwLock.getUnderlyingMutex());
         return Task(); // Indicate shutdown or empty queue
     }
 
-    Task task = tasks.top();
-    tasks.pop();
+    // Move the top out instead of copying it
+    std::pop_heap(tasks.begin(), tasks.end());
+    Task task(std::move(tasks.back()));
+    tasks.pop_back();
+    if (capacity > 0) {
+        pthread_cond_signal(&notFull);
+    }
+
+    if (fair) {
+        FairClock& clock = fairClocks[task.priority];
+        clock.virtualTime = std::max(clock.virtualTime, task.fairTag);
+    }
+
+    long long wait = monotonicMicros() - task.enqueuedAt;
+    std::map<int, long long>::const_iterator target = targets.find(task.priority);
+    waits[task.priority].record(wait, target != targets.end() && wait > target->second);
 
     pthread_mutex_unlock(rwLock.getUnderlyingMutex());
     return task;
@@ -41,6 +204,10 @@ bool TaskQueue::empty() {
 }
 
 void TaskQueue::pollShutDown() {
+    // Under the mutex, or a worker between its check and its wait would miss the wakeup
+    pthread_mutex_lock(rwLock.getUnderlyingMutex());
     poolRunning = false;
     pthread_cond_broadcast(&cond);
+    pthread_cond_broadcast(&notFull);
+    pthread_mutex_unlock(rwLock.getUnderlyingMutex());
 }
\ No newline at end of file
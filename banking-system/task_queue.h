@@ -9,44 +9,129 @@
 #define TASK_QUEUE_H_
 
 #include <iostream>
-#include <queue>
-#include <functional>
+#include <vector>
+#include <map>
+#include <cstdio>
+#include "small_function.h"
 #include <pthread.h>
 #include "read_write_lock.h"
 
-// Define a Task structure
+// Inline storage of a task's callable, enough for a parsed BankCommand and a Bank pointer
+#define TASK_INLINE_CAPACITY 64
+
+typedef SmallFunction<TASK_INLINE_CAPACITY> TaskFunction;
+
+#define TASK_NO_DEADLINE 0x7fffffffffffffffLL // Due time of a task ordered by priority alone
+#define WAIT_BUCKETS 32 // Power-of-two buckets of queue wait, up to about 35 minutes
+#define FAIR_TASK_COST 720720ULL // Virtual cost of a task, divided by its flow's weight (divisible by 1 to 16)
+
+// Define a Task structure, move-only so that queuing never copies the callable
 struct Task {
     int priority;                  // Task priority (lower = higher priority)
-    std::function<void()> fn;      // Task function to execute
+    TaskFunction fn;               // Task function to execute
     bool isShutdownTask = false;   // Flag indicating if this is a shutdown task (default is false)
+    long long enqueuedAt = 0;      // monotonicMicros() when pushed, set by TaskQueue::push
+    long long due = TASK_NO_DEADLINE; // Served earliest first, see TaskQueue::setScheduling
+    int flow = 0;                  // Who submitted it (an ATM id), 0 = nobody in particular
+    unsigned long long fairTag = 0; // Virtual start time of a fair-shared task, see TaskQueue::setFairShare
+    unsigned long seq = 0;         // Push order, first come first served among equals
 
     // Default constructor for shutdown or placeholder tasks
     Task() : priority(0), fn(nullptr), isShutdownTask(true) {}
 
     // Constructor for regular tasks
-    Task(int priority, std::function<void()> fn)
-        : priority(priority), fn(fn), isShutdownTask(false) {}
+    Task(int priority, TaskFunction&& fn, int flow = 0)
+        : priority(priority), fn(std::move(fn)), isShutdownTask(false), flow(flow) {}
+
+    Task(Task&& other) = default;
+    Task& operator=(Task&& other) = default;
 
     // Comparator for priority queue
     bool operator<(const Task& other) const {
-        return priority > other.priority; // Higher priority = smaller key
+        if (due != other.due) {
+            return due > other.due; // Earlier due time = smaller key
+        }
+        if (priority != other.priority) {
+            return priority > other.priority; // Higher priority = smaller key
+        }
+        if (fairTag != other.fairTag) {
+            return fairTag > other.fairTag;
+        }
+        return seq > other.seq;
     }
 };
 
+// Time tasks of one priority spent queued before a worker picked them up
+struct WaitStats {
+    unsigned long count;
+    unsigned long missed;   // Started after their deadline target
+    long long totalMicros;
+    long long maxMicros;
+    unsigned long buckets[WAIT_BUCKETS]; // buckets[i] counts waits below 2^i microseconds
+
+    WaitStats();
+    void record(long long waitMicros, bool missedTarget);
+    long long percentile(double q) const; // Upper bound of the bucket holding that quantile
+};
+
+// What push() does when a bounded queue is full
+enum OverflowPolicy {
+    OVERFLOW_BLOCK,  // Wait for room
+    OVERFLOW_SHED,   // Drop the task that would be served last, possibly the new one
+    OVERFLOW_REJECT  // Drop the new task
+};
+
 // TaskQueue class
 class TaskQueue {
 private:
-    std::priority_queue<Task> tasks; // Priority queue for tasks
+    std::vector<Task> tasks;         // Binary heap of tasks, kept with std::push_heap / std::pop_heap
     ReadWriteLock rwLock;           // Reader-writer lock for thread safety
     pthread_cond_t cond;            // Condition variable to notify waiting threads
+    pthread_cond_t notFull;         // Signaled when a blocked push may find room
     bool poolRunning =true; // Flag to indicate 
+    long long agingMicros = 0;              // Wait worth one priority level (0 = strict priority)
+    std::map<int, long long> targets;       // Priority -> enqueue-to-start target in microseconds
+    unsigned long pushed = 0;
+    std::map<int, WaitStats> waits;         // Per priority, under the mutex
+    size_t capacity = 0;                    // Most tasks queued at once (0 = unbounded)
+    OverflowPolicy overflow = OVERFLOW_BLOCK;
+    unsigned long shedCount = 0;
+    unsigned long rejectedCount = 0;
+    // Fair sharing, per priority: the virtual time and each flow's last finish tag
+    struct FairClock {
+        unsigned long long virtualTime = 0;
+        std::map<int, unsigned long long> finish;
+    };
+    bool fair = false;
+    std::map<int, size_t> weights;          // Flow -> weight
+    size_t defaultWeight = 1;
+    std::map<int, FairClock> fairClocks;
 
 public:
     TaskQueue();
     ~TaskQueue();
 
-    void push(const Task& task); // Add a task to the queue
+    // Tasks are served earliest due time first. A task whose priority has a target is due
+    // that long after it was pushed. Otherwise, with aging, it is due priority * agingMicros
+    // after it was pushed, so waiting agingMicros is worth one priority level and a busy
+    // top tier cannot starve the others. Without either it goes by priority alone, after
+    // every task that has a due time. Call before the first push.
+    void setScheduling(long long agingMicros, const std::map<int, long long>& targets);
+    void setCapacity(size_t capacity, OverflowPolicy policy); // Call before the first push
+    // Among tasks with the same due time and priority, serves the flows in proportion to
+    // their weights (start-time fair queuing) instead of first come first served, so a flow
+    // that queues a backlog only delays its own later tasks. Call before the first push.
+    void setFairShare(const std::map<int, size_t>& weights, size_t defaultWeight);
+    void reportWaits(FILE* out); // Enqueue-to-start latency per priority, shed and rejected counts
+
+    // Add a task to the queue. Returns how many tasks a full queue dropped (0 or 1, the new
+    // task or a queued one); a dropped task is destroyed without running. Unless `mayBlock`,
+    // OVERFLOW_BLOCK drops the new task instead of waiting, for threads shared by other work.
+    int push(Task&& task, bool mayBlock = true);
     Task pop();                  // Fetch the highest-priority task
+    // Like pop(), but gives up after maxWaitMicros (0 = never) without a task and sets `idle`;
+    // the Task returned then is a placeholder to be ignored
+    Task pop(long long maxWaitMicros, bool& idle);
     bool empty();                // Check if the queue is empty
 
     // Expose the condition variable for signaling in the thread pool
@@ -0,0 +1,200 @@
+/*
+ * tests.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+// Checks of the parts of the bank that are hard to reach through ATM files: make test
+// Time-dependent parts run on a clock the test steps by hand, so the results do not
+// depend on how fast the machine is. Runs in a scratch directory, the bank's logs and
+// the snapshot file stay out of the source tree.
+#include "banking_system.h"
+#include "atm_throttle.h"
+#include "partition.h"
+#include "snapshot_archive.h"
+#include "timer_service.h"
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <unistd.h>
+
+static int failures = 0;
+
+#define CHECK(condition) \
+	do { \
+		if (!(condition)) { \
+			std::fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #condition); \
+			failures++; \
+		} \
+	} while (0)
+
+static long long fakeNow = 0; // Microseconds of the hand-stepped clock
+static long long fakeClock() {
+	return fakeNow;
+}
+
+static bool run(Bank& bank, const std::string& line) {
+	BankCommand command;
+	return BankCommand::parse(line, 1, command) && bank.executeCommand(command, false);
+}
+
+static int balanceOf(const std::vector<PartitionStatusRecord>& records, int id) {
+	for (const PartitionStatusRecord& record : records) {
+		if (record.id == id) {
+			return record.balance;
+		}
+	}
+	return -1;
+}
+
+// Two-phase transfer between accounts of different partitions: it moves the money when
+// both sides agree, and leaves both balances alone when the destination votes no or the
+// source cannot pay
+static void testPartitionTransfer() {
+	BankConfig config;
+	config.partitions = 2;
+	config.timerJobs = false;
+	PartitionSet* partitions = new PartitionSet(config);
+	CHECK(partitions->start());
+	{
+		Bank bank(0, config, partitions);
+		CHECK(partitions->owner(1) != partitions->owner(2));
+		CHECK(run(bank, "O 1 p 100"));
+		CHECK(run(bank, "O 2 q 50"));
+
+		CHECK(run(bank, "T 1 p 2 30"));
+		CHECK(!run(bank, "T 1 p 9 5"));    // No account 9, the destination votes no
+		CHECK(!run(bank, "T 1 p 2 1000")); // The source cannot reserve it
+		CHECK(!run(bank, "T 1 x 2 5"));    // Wrong password
+
+		std::vector<PartitionStatusRecord> records;
+		partitions->saveStates(records);
+		CHECK(records.size() == 2);
+		CHECK(balanceOf(records, 1) == 70);
+		CHECK(balanceOf(records, 2) == 80);
+
+		CHECK(run(bank, "T 2 q 1 80"));
+		partitions->saveStates(records);
+		CHECK(balanceOf(records, 1) == 150);
+		CHECK(balanceOf(records, 2) == 0);
+		bank.stop();
+	}
+	delete partitions;
+}
+
+// States saved after the archive rewrote its file from a new base load as they were saved,
+// and the ones beyond the retention are gone
+static void testArchiveAfterCompaction() {
+	const size_t retention = 4;
+	const uint64_t saved = ARCHIVE_BASE_INTERVAL + 3 * retention; // Enough to compact at least once
+	SnapshotArchive* archive = new SnapshotArchive("tests_history.bin", retention);
+	CHECK(archive->open());
+	BankState state;
+	for (uint64_t sequence = 1; sequence <= saved; ++sequence) {
+		int tick = static_cast<int>(sequence);
+		state.reset(3);
+		state.add(1, tick, "p");
+		state.add(2, 2 * tick, "q");
+		if (sequence % 2 == 0) {
+			state.add(3, 7, "r"); // Opened and closed on every other state
+		}
+		archive->append(sequence, state);
+	}
+
+	BankState loaded;
+	CHECK(archive->load(saved, loaded)); // Waits for the writer, the file has been rewritten by now
+	CHECK(!archive->load(1, loaded));
+	CHECK(!archive->load(ARCHIVE_BASE_INTERVAL, loaded)); // Rewritten once more than that preceded the kept ones
+	for (uint64_t sequence = saved - retention + 1; sequence <= saved; ++sequence) {
+		int tick = static_cast<int>(sequence);
+		CHECK(archive->load(sequence, loaded));
+		CHECK(loaded.size() == (sequence % 2 == 0 ? 3u : 2u));
+		CHECK(loaded.find(1) != nullptr && loaded.find(1)->balance == tick);
+		CHECK(loaded.find(2) != nullptr && loaded.find(2)->balance == 2 * tick);
+		CHECK(loaded.find(2) != nullptr && std::string(loaded.find(2)->password) == "q");
+		CHECK((loaded.find(3) != nullptr) == (sequence % 2 == 0));
+	}
+	delete archive;
+	unlink("tests_history.bin");
+}
+
+// The token bucket refills at its rate up to its burst, and an ATM out of tokens is told
+// how long to wait
+static void testThrottleRefill() {
+	std::map<int, AtmRate> rates;
+	AtmRate rate = {10, 2}; // 10 commands a second, bursts of 2
+	rates[1] = rate;
+	fakeNow = 0;
+	AtmThrottle throttle(rates, fakeClock);
+
+	CHECK(throttle.acquire(1) == 0);
+	CHECK(throttle.acquire(1) == 0);
+	CHECK(throttle.acquire(1) == 100000); // Empty, a token every 100 ms
+	CHECK(throttle.acquire(7) == 0);      // Other ATMs are not limited
+
+	fakeNow = 40000;
+	CHECK(throttle.acquire(1) == 60000);
+	fakeNow = 100000;
+	CHECK(throttle.acquire(1) == 0);
+
+	fakeNow = 10000000; // Idle for a long time, the bucket only holds the burst
+	CHECK(throttle.acquire(1) == 0);
+	CHECK(throttle.acquire(1) == 0);
+	CHECK(throttle.acquire(1) > 0);
+}
+
+// Jobs parked on the upper levels of the timer wheel, or beyond its reach, are cascaded
+// down and run on the tick they are due
+static void testTimerCascade() {
+	const long long top = 1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS); // Ticks the wheel reaches
+	fakeNow = 0;
+	TimerService timers(fakeClock);
+	int fast = 0, level2 = 0, beyond = 0;
+	timers.addPeriodic(3 * TIMER_TICK_US, [&fast]() { fast++; });
+	timers.addPeriodic(100000LL * TIMER_TICK_US, [&level2]() { level2++; });
+	timers.addPeriodic((top + 5) * TIMER_TICK_US, [&beyond]() { beyond++; });
+
+	fakeNow = 99999LL * TIMER_TICK_US;
+	timers.poll();
+	CHECK(fast == 1);   // Missed runs are skipped, not replayed
+	CHECK(level2 == 0);
+	fakeNow = 100000LL * TIMER_TICK_US;
+	timers.poll();
+	CHECK(level2 == 1);
+	fakeNow = 199999LL * TIMER_TICK_US;
+	timers.poll();
+	CHECK(level2 == 1);
+	fakeNow = 200000LL * TIMER_TICK_US;
+	timers.poll();
+	CHECK(level2 == 2);
+
+	fakeNow = (top + 4) * TIMER_TICK_US;
+	timers.poll();
+	CHECK(beyond == 0);
+	fakeNow = (top + 5) * TIMER_TICK_US;
+	timers.poll();
+	CHECK(beyond == 1);
+}
+
+int main() {
+	char directory[] = "/tmp/bank-tests-XXXXXX";
+	if (mkdtemp(directory) == nullptr || chdir(directory) != 0) {
+		std::perror("tests: scratch directory");
+		return 1;
+	}
+
+	testPartitionTransfer(); // Forks, so before anything else starts a thread
+	testArchiveAfterCompaction();
+	testThrottleRefill();
+	testTimerCascade();
+
+	unlink("log.txt");
+	rmdir(directory);
+	if (failures > 0) {
+		std::fprintf(stderr, "%d check(s) failed\n", failures);
+		return 1;
+	}
+	std::printf("all tests passed\n");
+	return 0;
+}
@@ -0,0 +1,231 @@
+/*
+ * thread_placement.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "thread_placement.h"
+#include "bank_config.h"
+#include <set>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+#include <sched.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+
+#define NODE_SYSFS_DIR "/sys/devices/system/node"
+
+bool parseCpuList(const std::string& value, std::vector<int>& out) {
+	size_t start = 0;
+	while (start <= value.size()) {
+		size_t comma = value.find(',', start);
+		std::string item = value.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+		char* end = nullptr;
+		long first = std::strtol(item.c_str(), &end, 10);
+		long last = first;
+		if (*end == '-') {
+			last = std::strtol(end + 1, &end, 10);
+		}
+		if (item.empty() || *end != '\0' || first < 0 || last < first) {
+			return false;
+		}
+		for (long cpu = first; cpu <= last; ++cpu) {
+			out.push_back(static_cast<int>(cpu));
+		}
+		if (comma == std::string::npos) {
+			break;
+		}
+		start = comma + 1;
+	}
+	return true;
+}
+
+ThreadPlacement::ThreadPlacement() : accountNode(-1), enabled(false) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+ThreadPlacement& ThreadPlacement::instance() {
+	// Never destroyed, like the epoch domain: threads may still be placed while main returns
+	static ThreadPlacement* placement = new ThreadPlacement();
+	return *placement;
+}
+
+bool ThreadPlacement::configure(const BankConfig& config) {
+	if (config.vipCpus.empty() && config.atmCpus.empty() && config.backgroundCpus.empty()) {
+		return true;
+	}
+
+	// Only the cores this process may run on, e.g. inside a cpuset
+	cpu_set_t allowed;
+	CPU_ZERO(&allowed);
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		return false;
+	}
+	const std::vector<int>* lists[THREAD_ROLES] = {&config.vipCpus, &config.atmCpus, &config.backgroundCpus};
+	for (int role = 0; role < THREAD_ROLES; ++role) {
+		for (int cpu : *lists[role]) {
+			if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, &allowed)) {
+				fprintf(stderr, "Bank error: cpu %d is not available\n", cpu);
+				return false;
+			}
+		}
+		cpus[role] = *lists[role];
+	}
+
+	// Background jobs get the cores nobody else was given, or all of them if none is left
+	if (cpus[THREAD_BACKGROUND].empty()) {
+		std::set<int> hot(cpus[THREAD_VIP].begin(), cpus[THREAD_VIP].end());
+		hot.insert(cpus[THREAD_ATM].begin(), cpus[THREAD_ATM].end());
+		std::vector<int> all;
+		for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+			if (CPU_ISSET(cpu, &allowed)) {
+				all.push_back(cpu);
+				if (hot.count(cpu) == 0) {
+					cpus[THREAD_BACKGROUND].push_back(cpu);
+				}
+			}
+		}
+		if (cpus[THREAD_BACKGROUND].empty()) {
+			cpus[THREAD_BACKGROUND] = all;
+		}
+	}
+
+	// NUMA topology, one nodeN directory per node
+	DIR* dir = opendir(NODE_SYSFS_DIR);
+	if (dir != nullptr) {
+		struct dirent* entry;
+		while ((entry = readdir(dir)) != nullptr) {
+			std::string name = entry->d_name;
+			char* end = nullptr;
+			long node = name.compare(0, 4, "node") == 0 ? std::strtol(name.c_str() + 4, &end, 10) : -1;
+			if (node < 0 || end == name.c_str() + 4 || *end != '\0') {
+				continue;
+			}
+			std::ifstream list(std::string(NODE_SYSFS_DIR "/") + name + "/cpulist");
+			std::string line;
+			std::vector<int> nodeCpus;
+			if (std::getline(list, line) && parseCpuList(line, nodeCpus)) {
+				for (int cpu : nodeCpus) {
+					nodeOfCpu[cpu] = static_cast<int>(node);
+				}
+			}
+		}
+		closedir(dir);
+	}
+
+	// The accounts are touched by the hot threads, put them on the node most of their cores are on
+	std::map<int, size_t> votes;
+	for (int role = THREAD_VIP; role <= THREAD_ATM; ++role) {
+		for (int cpu : cpus[role]) {
+			auto it = nodeOfCpu.find(cpu);
+			if (it != nodeOfCpu.end()) {
+				votes[it->second]++;
+			}
+		}
+	}
+	size_t best = 0;
+	for (const auto& vote : votes) {
+		if (vote.second > best) {
+			best = vote.second;
+			accountNode = vote.first;
+		}
+	}
+	enabled = true;
+	return true;
+}
+
+std::string ThreadPlacement::describe(const std::vector<int>& set) const {
+	std::vector<int> sorted(set);
+	std::sort(sorted.begin(), sorted.end());
+	sorted.erase(std::unique(sorted.begin(), sorted.end()), sorted.end());
+
+	// Runs of consecutive cores print as ranges
+	std::string out = sorted.size() == 1 ? "cpu " : "cpus ";
+	std::set<int> nodes;
+	for (size_t i = 0; i < sorted.size(); ++i) {
+		size_t j = i;
+		while (j + 1 < sorted.size() && sorted[j + 1] == sorted[j] + 1) {
+			++j;
+		}
+		out += (i > 0 ? "," : "") + std::to_string(sorted[i]);
+		if (j > i) {
+			out += "-" + std::to_string(sorted[j]);
+		}
+		for (size_t k = i; k <= j; ++k) {
+			auto it = nodeOfCpu.find(sorted[k]);
+			if (it != nodeOfCpu.end()) {
+				nodes.insert(it->second);
+			}
+		}
+		i = j;
+	}
+	if (!nodes.empty()) {
+		out += nodes.size() == 1 ? " (node " : " (nodes ";
+		for (auto it = nodes.begin(); it != nodes.end(); ++it) {
+			out += (it != nodes.begin() ? "," : "") + std::to_string(*it);
+		}
+		out += ")";
+	}
+	return out;
+}
+
+void ThreadPlacement::place(pthread_t thread, ThreadRole role, size_t slot, const std::string& name) {
+	if (!enabled || cpus[role].empty()) {
+		return;
+	}
+	std::vector<int> target;
+	if (role == THREAD_BACKGROUND) {
+		target = cpus[role];
+	} else {
+		target.push_back(cpus[role][slot % cpus[role].size()]);
+	}
+
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for (int cpu : target) {
+		CPU_SET(cpu, &set);
+	}
+	int error = pthread_setaffinity_np(thread, sizeof(set), &set);
+
+	pthread_mutex_lock(&mutex);
+	placed.push_back(name + (error == 0 ? " on " + describe(target) : " not pinned"));
+	pthread_mutex_unlock(&mutex);
+}
+
+void ThreadPlacement::report(FILE* out) {
+	if (!enabled) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	for (const std::string& line : placed) {
+		fprintf(out, "Placement: %s\n", line.c_str());
+	}
+	pthread_mutex_unlock(&mutex);
+	if (accountNode >= 0) {
+		fprintf(out, "Placement: accounts on node %d\n", accountNode);
+	} else {
+		fprintf(out, "Placement: accounts on any node\n");
+	}
+}
+
+void* ThreadPlacement::allocate(size_t bytes, int node) {
+	void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (memory == MAP_FAILED) {
+		return nullptr;
+	}
+	if (node >= 0 && node < static_cast<int>(sizeof(unsigned long) * 8)) {
+		// Preferred rather than bound, a full node falls back to the others instead of failing.
+		// The pages are placed when first touched, which happens right after this.
+		unsigned long mask = 1UL << node;
+		syscall(SYS_mbind, memory, bytes, MPOL_PREFERRED, &mask, sizeof(mask) * 8, 0);
+	}
+	return memory;
+}
+
+void ThreadPlacement::release(void* memory, size_t bytes) {
+	munmap(memory, bytes);
+}
@@ -0,0 +1,68 @@
+/*
+ * thread_placement.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef THREAD_PLACEMENT_H_
+#define THREAD_PLACEMENT_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstddef>
+#include <pthread.h>
+
+struct BankConfig;
+
+// What a thread does, which decides where it may run
+enum ThreadRole {
+	THREAD_VIP,        // VIP pool workers, one core each out of --vip-cpus
+	THREAD_ATM,        // ATM threads, ATM scheduler threads and partition workers, one core each out of --atm-cpus
+	THREAD_BACKGROUND, // Timer jobs, the history writer and the query pool, anywhere in --background-cpus
+	THREAD_ROLES
+};
+
+// Parses a cpu list such as "0-3,8", as in --vip-cpus and /sys/devices/system/node/node0/cpulist
+bool parseCpuList(const std::string& value, std::vector<int>& out);
+
+// Where the threads run and the accounts live. Configured once by main before it starts any
+// thread; until then, and in the tools that never configure it, every call is a no-op. A hot
+// thread (VIP or ATM) is pinned to one core, taken round robin from its role's list by slot,
+// while background threads share whatever cores the hot ones were not given. Account storage
+// prefers the NUMA node most of the hot cores belong to.
+class ThreadPlacement {
+private:
+	std::vector<int> cpus[THREAD_ROLES];
+	std::map<int, int> nodeOfCpu; // From /sys/devices/system/node, empty if the kernel has no NUMA info
+	int accountNode;              // -1 = left to the kernel
+	bool enabled;
+	std::vector<std::string> placed; // One report line per placed thread
+	pthread_mutex_t mutex;           // Protects `placed`
+
+	ThreadPlacement();
+	ThreadPlacement(const ThreadPlacement&);            // Not copyable
+	ThreadPlacement& operator=(const ThreadPlacement&);
+
+	std::string describe(const std::vector<int>& set) const; // "cpus 0-3 (node 0)"
+
+public:
+	static ThreadPlacement& instance();
+
+	// Returns false if a listed core cannot be used; placement then stays off
+	bool configure(const BankConfig& config);
+	bool isEnabled() const { return enabled; }
+
+	// Pins a thread that was just created for `role`, `slot` picks its core among the role's
+	void place(pthread_t thread, ThreadRole role, size_t slot, const std::string& name);
+	int getAccountNode() const { return accountNode; }
+	void report(FILE* out); // Where every thread placed so far runs, and where the accounts live
+
+	// Page-aligned memory whose pages prefer `node` (any node if negative), freed with release()
+	static void* allocate(size_t bytes, int node);
+	static void release(void* memory, size_t bytes);
+};
+
+#endif /* THREAD_PLACEMENT_H_ */
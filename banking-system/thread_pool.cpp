@@ -5,20 +5,31 @@
  *      Author: os
  */
 #include "thread_pool.h"
+#include "atm_scheduler.h"
 
-ThreadPool::ThreadPool(TaskQueue& taskQueue, size_t numThreads)
-: taskQueue(taskQueue) {
+ThreadPool::ThreadPool(TaskQueue& taskQueue, size_t numThreads, ThreadRole role, const char* name,
+		size_t maxThreads, long long idleMicros)
+: taskQueue(taskQueue), outstanding(0), role(role), name(name), minThreads(numThreads),
+  maxThreads(maxThreads > numThreads ? maxThreads : numThreads),
+  idleMicros(maxThreads > numThreads ? idleMicros : 0), busy(0), waitMicros(0), lastGrowth(0),
+  created(0), peak(0), grown(0), retired(0), stopping(false) {
 	pthread_mutex_init(&stopMutex, nullptr);
+	pthread_cond_init(&idleCond, nullptr);
 
+	pthread_mutex_lock(&stopMutex);
 	for (size_t i = 0; i < numThreads; ++i) {
-		pthread_t thread;
-		pthread_create(&thread, nullptr, worker, this);
-		threads.push_back(thread);
+		spawnLocked();
 	}
+	pthread_mutex_unlock(&stopMutex);
 }
 
 ThreadPool::~ThreadPool() {
-	// Signal all threads to stop
+	// From now on no worker retires and none is added, so `threads` stays as it is
+	pthread_mutex_lock(&stopMutex);
+	stopping = true;
+	pthread_mutex_unlock(&stopMutex);
+
+	// Signal all threads to stop, the tasks still queued run first
 	taskQueue.pollShutDown();
 
 	// Broadcast to all waiting threads to wake up
@@ -28,29 +39,137 @@ ThreadPool::~ThreadPool() {
 	for (pthread_t thread : threads) {
 		pthread_join(thread, nullptr);
 	}
+	joinExitedLocked(); // Every worker is gone, nobody else holds the mutex
 
+	pthread_cond_destroy(&idleCond);
 	pthread_mutex_destroy(&stopMutex);
 }
 
+void ThreadPool::spawnLocked() {
+	pthread_t thread;
+	if (pthread_create(&thread, nullptr, worker, this) != 0) {
+		return;
+	}
+	ThreadPlacement::instance().place(thread, role, created, name + " " + std::to_string(created));
+	created++;
+	threads.push_back(thread);
+	if (threads.size() > peak) {
+		peak = threads.size();
+	}
+}
+
+void ThreadPool::maybeGrowLocked() {
+	if (stopping || threads.size() >= maxThreads) {
+		return;
+	}
+	size_t queued = outstanding - busy;
+	size_t idle = threads.size() - busy;
+	if (queued <= idle || (queued < POOL_GROW_DEPTH * threads.size() && waitMicros < POOL_GROW_WAIT_US)) {
+		return;
+	}
+	long long now = monotonicMicros();
+	if (now - lastGrowth < POOL_GROW_COOLDOWN_US) {
+		return;
+	}
+	lastGrowth = now;
+	joinExitedLocked(); // Workers retired earlier are gone by now, or about to be
+	spawnLocked();
+	grown++;
+}
+
+bool ThreadPool::retireLocked(pthread_t self) {
+	if (stopping || threads.size() <= minThreads) {
+		return false;
+	}
+	for (size_t i = 0; i < threads.size(); ++i) {
+		if (pthread_equal(threads[i], self)) {
+			threads.erase(threads.begin() + i);
+			exited.push_back(self); // Joined by the next growth or by the destructor
+			retired++;
+			return true;
+		}
+	}
+	return false;
+}
+
+void ThreadPool::joinExitedLocked() {
+	for (pthread_t thread : exited) {
+		pthread_join(thread, nullptr);
+	}
+	exited.clear();
+}
+
 void* ThreadPool::worker(void* arg) {
 	ThreadPool* pool = static_cast<ThreadPool*>(arg);
 
 	while (true) {
-		// Fetch and execute a task
-		
-		Task task = pool->taskQueue.pop();
+		// Fetch and execute a task, a worker above the minimum gives up after a quiet period
+		bool idle = false;
+		Task task = pool->taskQueue.pop(pool->idleMicros, idle);
+
+		if (idle) {
+			pthread_mutex_lock(&pool->stopMutex);
+			bool retiring = pool->retireLocked(pthread_self());
+			pthread_mutex_unlock(&pool->stopMutex);
+			if (retiring) {
+				break;
+			}
+			continue;
+		}
 
 		if (task.isShutdownTask) {
             // If pop returns nullopt, the queue is shutting down
             break;
         }
 
+		pthread_mutex_lock(&pool->stopMutex);
+		pool->busy++;
+		pool->waitMicros += (monotonicMicros() - task.enqueuedAt - pool->waitMicros) / 8;
+		pool->maybeGrowLocked(); // A slow start means the rest of the queue waits too
+		pthread_mutex_unlock(&pool->stopMutex);
+
 		task.fn(); // Execute the task
+
+		pthread_mutex_lock(&pool->stopMutex);
+		pool->busy--;
+		if (--pool->outstanding == 0) {
+			pthread_cond_broadcast(&pool->idleCond);
+		}
+		pthread_mutex_unlock(&pool->stopMutex);
 	}
 	return nullptr;
 }
 
-void ThreadPool::submitTask(int priority, const std::function<void()>& fn) {
-	Task task = {priority, fn};
-	taskQueue.push(task);
-}
\ No newline at end of file
+void ThreadPool::submitTask(int priority, TaskFunction&& fn, int flow, bool mayBlock) {
+	pthread_mutex_lock(&stopMutex);
+	outstanding++;
+	maybeGrowLocked();
+	pthread_mutex_unlock(&stopMutex);
+
+	int dropped = taskQueue.push(Task(priority, std::move(fn), flow), mayBlock);
+	if (dropped > 0) {
+		// The dropped task, this one or a queued one, will never finish
+		pthread_mutex_lock(&stopMutex);
+		outstanding -= dropped;
+		if (outstanding == 0) {
+			pthread_cond_broadcast(&idleCond);
+		}
+		pthread_mutex_unlock(&stopMutex);
+	}
+}
+
+void ThreadPool::drain() {
+	pthread_mutex_lock(&stopMutex);
+	while (outstanding > 0) {
+		pthread_cond_wait(&idleCond, &stopMutex);
+	}
+	pthread_mutex_unlock(&stopMutex);
+}
+void ThreadPool::report(FILE* out) {
+	pthread_mutex_lock(&stopMutex);
+	if (maxThreads > minThreads) {
+		std::fprintf(out, "%ss: %zu to %zu, %zu now, peak %zu, grown %lu times, retired %lu\n",
+				name.c_str(), minThreads, maxThreads, threads.size(), peak, grown, retired);
+	}
+	pthread_mutex_unlock(&stopMutex);
+}
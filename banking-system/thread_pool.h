@@ -10,21 +10,64 @@
 
 #include <vector>
 #include <iostream>
+#include <string>
+#include <cstdio>
 #include "task_queue.h"
+#include "thread_placement.h"
 
+#define POOL_IDLE_MS 1000           // Default idle time before a worker above the minimum retires
+#define POOL_GROW_WAIT_US 2000       // Queue wait (smoothed) that makes an adaptive pool grow
+#define POOL_GROW_DEPTH 4            // Queued tasks per worker that make an adaptive pool grow
+#define POOL_GROW_COOLDOWN_US 2000   // Least time between two workers added by an adaptive pool
+
+// Workers serving a TaskQueue. An adaptive pool (maxThreads above numThreads) starts with
+// numThreads workers and adds one, at most every POOL_GROW_COOLDOWN_US, while more tasks
+// are queued than idle workers can take and either the queue holds POOL_GROW_DEPTH tasks
+// per worker or tasks wait longer than POOL_GROW_WAIT_US before they start. A worker that finds nothing
+// to do for idleMicros retires on its own while the pool is above numThreads, so it takes a
+// whole quiet period to shrink but only a burst to grow.
 class ThreadPool {
 private:
 	std::vector<pthread_t> threads; // Vector of worker threads
+	std::vector<pthread_t> exited;  // Retired workers not joined yet
 	TaskQueue& taskQueue;           // Shared task queue
 	pthread_mutex_t stopMutex;      // Mutex to synchronize stop condition
+	pthread_cond_t idleCond;        // Signaled when the last outstanding task finishes
+	size_t outstanding;             // Tasks submitted and not finished yet, under stopMutex
+
+	// Sizing, under stopMutex
+	ThreadRole role;
+	std::string name;
+	size_t minThreads;
+	size_t maxThreads;
+	long long idleMicros;   // 0 = workers never retire
+	size_t busy;            // Workers running a task
+	long long waitMicros;   // Smoothed enqueue-to-start wait of the tasks started
+	long long lastGrowth;   // monotonicMicros() of the last worker added
+	size_t created;         // Workers ever started, numbers the next one
+	size_t peak;
+	unsigned long grown;
+	unsigned long retired;
+	bool stopping;
 
 	static void* worker(void* arg); // Worker thread function
+	void spawnLocked();             // Starts one more worker
+	void maybeGrowLocked();         // Adds a worker if the queue needs one
+	bool retireLocked(pthread_t self); // Removes an idle worker, false if the pool is at its minimum
+	void joinExitedLocked();
 
 public:
-	ThreadPool(TaskQueue& taskQueue, size_t numThreads);
+	// The workers are placed as `role`, reported as "<name> <index>". With maxThreads above
+	// numThreads the pool resizes between the two, see above.
+	ThreadPool(TaskQueue& taskQueue, size_t numThreads, ThreadRole role = THREAD_BACKGROUND,
+			const char* name = "pool worker", size_t maxThreads = 0, long long idleMicros = POOL_IDLE_MS * 1000LL);
 	~ThreadPool();
 
-	void submitTask(int priority, const std::function<void()>& fn); // Submit a new task
+	// Submit a new task on behalf of `flow` (see TaskQueue::setFairShare), a full queue may drop it or another one
+	// (`mayBlock` as in TaskQueue::push)
+	void submitTask(int priority, TaskFunction&& fn, int flow = 0, bool mayBlock = true);
+	void drain(); // Waits until every task submitted so far, and any they submit, has run
+	void report(FILE* out); // Size bounds, current and peak size and resize counts
 };
 
 #endif /* THREAD_POOL_H_ */
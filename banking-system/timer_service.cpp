@@ -0,0 +1,180 @@
+/*
+ * timer_service.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "timer_service.h"
+#include "thread_placement.h"
+#include <time.h>
+
+TimerService::TimerService(MonotonicClock clock)
+	: clock(clock), origin(clock()), currentTick(0), started(false), stopping(false) {
+	pthread_mutex_init(&mutex, nullptr);
+
+	// Deadlines are monotonic like the ticks
+	pthread_condattr_t attr;
+	pthread_condattr_init(&attr);
+	pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+	pthread_cond_init(&cond, &attr);
+	pthread_condattr_destroy(&attr);
+}
+
+TimerService::~TimerService() {
+	stop();
+	for (Job* job : jobs) {
+		delete job;
+	}
+	pthread_cond_destroy(&cond);
+	pthread_mutex_destroy(&mutex);
+}
+
+long long TimerService::now() const {
+	return (clock() - origin) / TIMER_TICK_US;
+}
+
+void TimerService::insert(Job* job, std::vector<Job*>& expired) {
+	long long delta = job->due - currentTick;
+	if (delta <= 0) {
+		expired.push_back(job);
+		return;
+	}
+	int level = 0;
+	while (level < TIMER_WHEEL_LEVELS - 1 && delta >= (1LL << (TIMER_WHEEL_BITS * (level + 1)))) {
+		++level;
+	}
+	long long slotTick = job->due;
+	if (delta >= (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS))) {
+		// Beyond the top level: park it as far as the wheel reaches, it is reinserted from there
+		slotTick = currentTick + (1LL << (TIMER_WHEEL_BITS * TIMER_WHEEL_LEVELS)) - 1;
+	}
+	wheel[level][(slotTick >> (TIMER_WHEEL_BITS * level)) & (TIMER_WHEEL_SLOTS - 1)].push_back(job);
+}
+
+void TimerService::advance(long long tick, std::vector<Job*>& expired) {
+	while (currentTick < tick) {
+		++currentTick;
+
+		// Cascade the upper levels whose slot boundary this tick is, highest first
+		for (int level = TIMER_WHEEL_LEVELS - 1; level > 0; --level) {
+			int shift = TIMER_WHEEL_BITS * level;
+			if ((currentTick & ((1LL << shift) - 1)) != 0) {
+				continue;
+			}
+			std::vector<Job*>& slot = wheel[level][(currentTick >> shift) & (TIMER_WHEEL_SLOTS - 1)];
+			std::vector<Job*> cascaded;
+			cascaded.swap(slot);
+			for (Job* job : cascaded) {
+				insert(job, expired);
+			}
+		}
+
+		std::vector<Job*>& slot = wheel[0][currentTick & (TIMER_WHEEL_SLOTS - 1)];
+		expired.insert(expired.end(), slot.begin(), slot.end());
+		slot.clear();
+	}
+}
+
+long long TimerService::nextDue() const {
+	long long earliest = -1;
+	for (const Job* job : jobs) {
+		if (earliest < 0 || job->due < earliest) {
+			earliest = job->due;
+		}
+	}
+	return earliest;
+}
+
+void TimerService::addPeriodic(long long periodMicros, TaskFunction&& fn) {
+	Job* job = new Job();
+	job->fn = std::move(fn);
+	job->period = periodMicros / TIMER_TICK_US > 0 ? periodMicros / TIMER_TICK_US : 1;
+
+	pthread_mutex_lock(&mutex);
+	job->due = currentTick + job->period;
+	jobs.push_back(job);
+	std::vector<Job*> expired;
+	insert(job, expired);
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+}
+
+void TimerService::start() {
+	pthread_mutex_lock(&mutex);
+	if (!started && !stopping) {
+		started = true;
+		pthread_create(&thread, nullptr, run, this);
+		ThreadPlacement::instance().place(thread, THREAD_BACKGROUND, 0, "bank timer");
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void TimerService::stop() {
+	pthread_mutex_lock(&mutex);
+	bool join = started && !stopping;
+	stopping = true;
+	pthread_cond_signal(&cond);
+	pthread_mutex_unlock(&mutex);
+
+	if (join) {
+		pthread_join(thread, nullptr);
+	}
+}
+
+bool TimerService::runExpired(std::vector<Job*>& expired) {
+	advance(now(), expired);
+	if (expired.empty()) {
+		return false;
+	}
+
+	// Jobs run without the mutex so they may add jobs; only this thread touches a due job
+	pthread_mutex_unlock(&mutex);
+	for (Job* job : expired) {
+		job->fn();
+	}
+	pthread_mutex_lock(&mutex);
+
+	long long tick = now();
+	std::vector<Job*> due;
+	due.swap(expired);
+	for (Job* job : due) {
+		job->due += job->period;
+		if (job->due <= tick) {
+			job->due += ((tick - job->due) / job->period + 1) * job->period; // Skip the missed runs
+		}
+		insert(job, expired);
+	}
+	return true;
+}
+
+void TimerService::poll() {
+	std::vector<Job*> expired;
+	pthread_mutex_lock(&mutex);
+	while (runExpired(expired)) {
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void* TimerService::run(void* arg) {
+	TimerService* service = static_cast<TimerService*>(arg);
+	std::vector<Job*> expired;
+
+	pthread_mutex_lock(&service->mutex);
+	while (!service->stopping) {
+		if (!service->runExpired(expired)) {
+			// Sleep until the earliest job is due, new jobs and stop() wake the thread early
+			long long due = service->nextDue();
+			if (due < 0) {
+				pthread_cond_wait(&service->cond, &service->mutex);
+			} else {
+				long long deadline = service->origin + due * TIMER_TICK_US;
+				struct timespec ts;
+				ts.tv_sec = deadline / 1000000;
+				ts.tv_nsec = (deadline % 1000000) * 1000;
+				pthread_cond_timedwait(&service->cond, &service->mutex, &ts);
+			}
+		}
+	}
+	pthread_mutex_unlock(&service->mutex);
+	return nullptr;
+}
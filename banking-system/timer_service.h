@@ -0,0 +1,65 @@
+/*
+ * timer_service.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef TIMER_SERVICE_H_
+#define TIMER_SERVICE_H_
+
+#include <vector>
+#include <pthread.h>
+#include "task_queue.h"
+#include "atm_scheduler.h"
+
+#define TIMER_TICK_US 1000   // Resolution of the wheel
+#define TIMER_WHEEL_BITS 6
+#define TIMER_WHEEL_SLOTS (1 << TIMER_WHEEL_BITS)
+#define TIMER_WHEEL_LEVELS 4 // 64^4 ticks, about 4.6 hours at 1 ms; longer periods are re-cascaded
+
+// Runs periodic jobs on one thread, kept in a hierarchical timer wheel: level L holds the
+// jobs due within 64^(L+1) ticks and is cascaded into the level below as time reaches it.
+// Jobs run at a fixed rate, each run is due one period after the previous due time (not
+// after the previous run ended), so they do not drift. Runs that are missed because a job
+// overran are skipped rather than replayed.
+class TimerService {
+private:
+	struct Job {
+		TaskFunction fn;
+		long long period; // In ticks
+		long long due;    // Tick of the next run
+	};
+
+	std::vector<Job*> jobs;
+	std::vector<Job*> wheel[TIMER_WHEEL_LEVELS][TIMER_WHEEL_SLOTS];
+	MonotonicClock clock;
+	long long origin;      // clock() of tick 0
+	long long currentTick; // Every tick up to this one has been processed
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;   // Signaled when a job is added and on stop
+	pthread_t thread;
+	bool started;
+	bool stopping;
+
+	static void* run(void* arg);
+	long long now() const; // Current tick
+	void insert(Job* job, std::vector<Job*>& expired); // Call with the mutex held
+	void advance(long long tick, std::vector<Job*>& expired); // Call with the mutex held
+	long long nextDue() const; // Call with the mutex held
+	bool runExpired(std::vector<Job*>& expired); // Call with the mutex held, false if nothing was due
+
+public:
+	// A service on another clock than monotonicMicros is not start()ed but poll()ed
+	explicit TimerService(MonotonicClock clock = monotonicMicros);
+	~TimerService(); // Stops the thread and frees the jobs
+
+	// Runs `job` every periodMicros, the first time one period from now. May be called
+	// before start() or from any thread while the service runs, including from a job.
+	void addPeriodic(long long periodMicros, TaskFunction&& job);
+	void start();
+	void stop(); // Wakes the thread at once and joins it, a job already running finishes first
+	void poll(); // Runs the jobs due by now on the calling thread, for a service that was not started
+};
+
+#endif /* TIMER_SERVICE_H_ */
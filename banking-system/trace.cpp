@@ -0,0 +1,156 @@
+/*
+ * trace.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "trace.h"
+#include <cstring>
+
+static TraceRecord makeRecord(TraceKind kind, int atmId, int accountId, int otherId = 0, int amount = 0) {
+	TraceRecord record;
+	std::memset(&record, 0, sizeof(record));
+	record.kind = kind;
+	record.atmId = static_cast<uint16_t>(atmId);
+	record.accountId = accountId;
+	record.otherId = otherId;
+	record.amount = amount;
+	return record;
+}
+
+TraceRecorder::TraceRecorder() : file(nullptr) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+TraceRecorder::~TraceRecorder() {
+	if (file != nullptr) {
+		std::fclose(file);
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+bool TraceRecorder::open(const std::string& path) {
+	file = std::fopen(path.c_str(), "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	TraceHeader header = {TRACE_MAGIC, TRACE_VERSION};
+	return std::fwrite(&header, sizeof(header), 1, file) == 1;
+}
+
+void TraceRecorder::write(const TraceRecord& record, const char* tail, size_t tailSize) {
+	if (file == nullptr) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	std::fwrite(&record, sizeof(record), 1, file); // Buffered, flushed when the recorder closes
+	if (tailSize > 0) {
+		std::fwrite(tail, 1, tailSize, file);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void TraceRecorder::writeOpen(int atmId, int accountId, int balance, const char* password, size_t length) {
+	TraceRecord record = makeRecord(TRACE_OPEN, atmId, accountId, static_cast<int>(length), balance);
+	write(record, password, length);
+}
+
+void TraceRecorder::record(const TxEvent& event, const char* password) {
+	switch (event.type) {
+	case TX_ACCOUNT_OPENED:
+		// The event holds a cut copy of a long password, the replay needs all of it
+		if (password != nullptr) {
+			writeOpen(event.atmId, event.accountId, event.balance, password, std::strlen(password));
+		} else {
+			writeOpen(event.atmId, event.accountId, event.balance, event.detail.password,
+					strnlen(event.detail.password, TX_PASSWORD_CAPACITY));
+		}
+		break;
+	case TX_ACCOUNT_CLOSED:
+		write(makeRecord(TRACE_CLOSE, event.atmId, event.accountId));
+		break;
+	case TX_DEPOSIT:
+		write(makeRecord(TRACE_DEPOSIT, event.atmId, event.accountId, 0, event.detail.op.amount));
+		break;
+	case TX_WITHDRAW:
+		write(makeRecord(TRACE_WITHDRAW, event.atmId, event.accountId, 0, event.detail.op.amount));
+		break;
+	case TX_TRANSFER:
+		write(makeRecord(TRACE_TRANSFER, event.atmId, event.accountId, event.detail.op.otherId,
+				event.detail.op.amount));
+		break;
+	case TX_BALANCE:
+		write(makeRecord(TRACE_BALANCE, event.atmId, event.accountId));
+		break;
+	case TX_COMMISSION:
+		write(makeRecord(TRACE_COMMISSION, 0, event.accountId, 0, event.detail.op.otherId));
+		break;
+	case TX_ROLLBACK:
+		write(makeRecord(TRACE_ROLLBACK, event.atmId, 0, 0, event.detail.op.amount));
+		break;
+	case TX_ERROR: {
+		TraceRecord record = makeRecord(TRACE_FAILED, event.atmId, event.accountId, 0, event.detail.op.amount);
+		record.extra = event.error;
+		write(record);
+		break;
+	}
+	default:
+		break; // Statements, logins and past reads are not replayed
+	}
+}
+
+void TraceRecorder::opened(int accountId, const std::string& password, int balance) {
+	writeOpen(0, accountId, balance, password.data(), password.size());
+}
+
+void TraceRecorder::closed(int accountId) {
+	write(makeRecord(TRACE_CLOSE, 0, accountId));
+}
+
+void TraceRecorder::setBalance(int accountId, int balance) {
+	write(makeRecord(TRACE_SET, 0, accountId, 0, balance));
+}
+
+void TraceRecorder::tick() {
+	write(makeRecord(TRACE_TICK, 0, 0));
+}
+
+void TraceRecorder::final(int accountId, int balance) {
+	write(makeRecord(TRACE_FINAL, 0, accountId, 0, balance));
+}
+
+void TraceRecorder::finalBank(int balance) {
+	write(makeRecord(TRACE_FINAL_BANK, 0, 0, 0, balance));
+}
+
+TraceReader::TraceReader() : file(nullptr) {}
+
+TraceReader::~TraceReader() {
+	if (file != nullptr) {
+		std::fclose(file);
+	}
+}
+
+bool TraceReader::open(const std::string& path) {
+	file = std::fopen(path.c_str(), "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	TraceHeader header;
+	return std::fread(&header, sizeof(header), 1, file) == 1 && header.magic == TRACE_MAGIC &&
+			header.version == TRACE_VERSION;
+}
+
+bool TraceReader::next(TraceRecord& record, std::string& password) {
+	if (std::fread(&record, sizeof(record), 1, file) != 1) {
+		return false;
+	}
+	password.clear();
+	if (record.kind == TRACE_OPEN && record.otherId > 0) {
+		password.resize(record.otherId);
+		if (std::fread(&password[0], 1, password.size(), file) != password.size()) {
+			return false;
+		}
+	}
+	return true;
+}
@@ -0,0 +1,100 @@
+/*
+ * trace.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <string>
+#include <cstdio>
+#include <stdint.h>
+#include <pthread.h>
+#include "tx_log.h"
+
+#define TRACE_MAGIC 0x43525442u // "BTRC"
+#define TRACE_VERSION 2 // 2: the password length of TRACE_OPEN moved to otherId
+
+// Kinds of trace records
+enum TraceKind {
+	TRACE_OPEN = 1,   // accountId, amount (balance); followed by the password, otherId bytes
+	TRACE_CLOSE,      // accountId
+	TRACE_DEPOSIT,    // accountId, amount
+	TRACE_WITHDRAW,   // accountId, amount
+	TRACE_TRANSFER,   // accountId (source), otherId (target), amount
+	TRACE_BALANCE,    // accountId
+	TRACE_COMMISSION, // accountId, amount (percentage)
+	TRACE_SET,        // accountId, amount (balance a rollback gave it)
+	TRACE_FAILED,     // accountId, amount, extra (TxError); never changed a balance
+	TRACE_TICK,       // a bank state was saved
+	TRACE_ROLLBACK,   // amount (iterations); its balances follow as OPEN, SET and CLOSE records
+	TRACE_FINAL,      // accountId, amount (balance at the end of the run)
+	TRACE_FINAL_BANK  // amount (balance of the bank's commission account at the end)
+};
+
+// One 16-byte record of a trace. A trace is a TraceHeader followed by records in
+// the order the bank applied them.
+struct TraceRecord {
+	uint8_t kind;      // TraceKind
+	uint8_t extra;     // TxError of TRACE_FAILED
+	uint16_t atmId;
+	int32_t accountId;
+	int32_t otherId;
+	int32_t amount;
+};
+
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord is a fixed 16-byte record");
+
+struct TraceHeader {
+	uint32_t magic;
+	uint32_t version;
+};
+
+// Records what the bank applies, in the order it applies it. Changes are recorded
+// under the locks of the accounts they touch, so the order of the records of one
+// account is the order its changes happened in, which is all a sequential replay
+// needs to end with the same balances.
+class TraceRecorder {
+private:
+	FILE* file;
+	pthread_mutex_t mutex;
+
+	void write(const TraceRecord& record, const char* tail = nullptr, size_t tailSize = 0);
+	void writeOpen(int atmId, int accountId, int balance, const char* password, size_t length);
+
+	TraceRecorder(const TraceRecorder&);            // Not copyable
+	TraceRecorder& operator=(const TraceRecorder&);
+
+public:
+	TraceRecorder();
+	~TraceRecorder();
+
+	bool open(const std::string& path);
+	void record(const TxEvent& event, const char* password = nullptr); // What the transaction log is given
+	void opened(int accountId, const std::string& password, int balance);
+	void closed(int accountId);
+	void setBalance(int accountId, int balance);
+	void tick();
+	void final(int accountId, int balance);
+	void finalBank(int balance);
+};
+
+// Reads a trace written by TraceRecorder
+class TraceReader {
+private:
+	FILE* file;
+
+	TraceReader(const TraceReader&);            // Not copyable
+	TraceReader& operator=(const TraceReader&);
+
+public:
+	TraceReader();
+	~TraceReader();
+
+	bool open(const std::string& path); // Fails unless the header matches
+	bool next(TraceRecord& record, std::string& password); // False at the end
+};
+
+#endif /* TRACE_H_ */
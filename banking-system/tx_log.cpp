@@ -0,0 +1,215 @@
+/*
+ * tx_log.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "tx_log.h"
+#include <cstring>
+#include <time.h>
+
+static int64_t wallClockNanos() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return static_cast<int64_t>(ts.tv_sec) * 1000000000LL + ts.tv_nsec;
+}
+
+TxEvent TxEvent::make(TxEventType type, int atmId, int accountId, int amount, int balance) {
+	TxEvent event;
+	std::memset(&event, 0, sizeof(event));
+	event.timestamp = wallClockNanos();
+	event.type = type;
+	event.atmId = atmId;
+	event.accountId = accountId;
+	event.balance = balance;
+	event.detail.op.amount = amount;
+	return event;
+}
+
+TxEvent TxEvent::failure(TxError error, int atmId, int accountId, int amount) {
+	TxEvent event = make(TX_ERROR, atmId, accountId, amount);
+	event.error = error;
+	return event;
+}
+
+TxEvent TxEvent::atmFailure(TxError error, int sourceAtmId, int atmId) {
+	TxEvent event = make(TX_ERROR, sourceAtmId, 0);
+	event.error = error;
+	event.detail.op.otherId = atmId;
+	return event;
+}
+
+// One line of an account statement
+static void renderStatementEntry(const TxEvent& e, FILE* out) {
+	int amount = e.detail.op.amount < 0 ? -e.detail.op.amount : e.detail.op.amount;
+	std::fprintf(out, "%d: Account %d statement: ", e.atmId, e.accountId);
+	switch (e.detail.op.entryType) {
+	case TX_ACCOUNT_OPENED:
+		std::fprintf(out, "opened with %d $", amount);
+		break;
+	case TX_DEPOSIT:
+		std::fprintf(out, "deposit of %d $", amount);
+		break;
+	case TX_WITHDRAW:
+		std::fprintf(out, "withdrawal of %d $", amount);
+		break;
+	case TX_COMMISSION:
+		std::fprintf(out, "commission of %d $", amount);
+		break;
+	case TX_TRANSFER:
+		std::fprintf(out, "transfer of %d $ %s account %d", amount,
+				e.detail.op.amount < 0 ? "to" : "from", e.detail.op.otherId);
+		break;
+	case TX_ROLLBACK:
+		std::fprintf(out, "rolled back by %+d $", e.detail.op.amount);
+		break;
+	}
+	std::fprintf(out, ", balance %d\n", e.balance);
+}
+
+void renderTxEvent(const TxEvent& e, FILE* out, const char* password) {
+	switch (e.type) {
+	case TX_ACCOUNT_OPENED:
+		if (password != nullptr) {
+			std::fprintf(out, "%d: New account id is %d with password %s and initial balance %d\n",
+					e.atmId, e.accountId, password, e.balance);
+		} else {
+			std::fprintf(out, "%d: New account id is %d with password %.*s and initial balance %d\n",
+					e.atmId, e.accountId, TX_PASSWORD_CAPACITY, e.detail.password, e.balance);
+		}
+		break;
+	case TX_ACCOUNT_CLOSED:
+		std::fprintf(out, "%d: Account %d is now closed. Balance was %d\n", e.atmId, e.accountId, e.balance);
+		break;
+	case TX_DEPOSIT:
+		std::fprintf(out, "%d: Account %d new balance is %d after %d $ was deposited\n",
+				e.atmId, e.accountId, e.balance, e.detail.op.amount);
+		break;
+	case TX_WITHDRAW:
+		std::fprintf(out, "%d: Account %d new balance is %d after %d $ was withdrawn\n",
+				e.atmId, e.accountId, e.balance, e.detail.op.amount);
+		break;
+	case TX_BALANCE:
+		std::fprintf(out, "%d: Account %d balance is %d\n", e.atmId, e.accountId, e.balance);
+		break;
+	case TX_TRANSFER:
+		std::fprintf(out, "%d: Transfer %d from account %d to account %d new account balance is %d"
+				" new target account balance is %d\n",
+				e.atmId, e.detail.op.amount, e.accountId, e.detail.op.otherId, e.balance, e.detail.op.otherBalance);
+		break;
+	case TX_COMMISSION:
+		std::fprintf(out, "Bank: commissions of %d %% were charged, bank gained %d from account %d\n",
+				e.detail.op.otherId, e.detail.op.amount, e.accountId);
+		break;
+	case TX_ROLLBACK:
+		std::fprintf(out, "%d: Rollback to %d bank iterations ago was completed successfully \n",
+				e.atmId, e.detail.op.amount);
+		break;
+	case TX_ATM_CLOSED:
+		std::fprintf(out, "Bank: ATM %d successfully closed\n", e.detail.op.otherId);
+		break;
+	case TX_STATEMENT:
+		renderStatementEntry(e, out);
+		break;
+	case TX_BALANCE_AT:
+		std::fprintf(out, "%d: Account %d balance was %d %d bank iterations ago\n",
+				e.atmId, e.accountId, e.balance, e.detail.op.amount);
+		break;
+	case TX_TOTALS_AT:
+		std::fprintf(out, "%d: Bank had %d accounts with a total balance of %lld $ %d bank iterations ago\n",
+				e.atmId, e.detail.op.otherId,
+				(static_cast<long long>(e.detail.op.otherBalance) << 32) | static_cast<uint32_t>(e.balance),
+				e.detail.op.amount);
+		break;
+	case TX_LOGIN:
+		std::fprintf(out, "%d: Account %d logged in\n", e.atmId, e.accountId);
+		break;
+	case TX_ERROR:
+		switch (e.error) {
+		case TX_ERROR_ACCOUNT_EXISTS:
+			std::fprintf(out, "Error %d: Your transaction failed – account with the same id exists\n", e.atmId);
+			break;
+		case TX_ERROR_ACCOUNT_MISSING:
+			std::fprintf(out, "Error %d: Your transaction failed – account id %d does not exist\n",
+					e.atmId, e.accountId);
+			break;
+		case TX_ERROR_WRONG_PASSWORD:
+			std::fprintf(out, "Error %d: Your transaction failed – password for account id %d is incorrect\n",
+					e.atmId, e.accountId);
+			break;
+		case TX_ERROR_DEPOSIT_PASSWORD:
+			std::fprintf(out, "Error: Deposit failed for account ID %d - incorrect password\n", e.accountId);
+			break;
+		case TX_ERROR_LOW_BALANCE:
+			std::fprintf(out, "Error %d: Your transaction failed – account id %d balance is lower than %d\n",
+					e.atmId, e.accountId, e.detail.op.amount);
+			break;
+		case TX_ERROR_ATM_MISSING:
+			std::fprintf(out, "Error %d: Your transaction failed – ATM ID %d does not exist\n",
+					e.atmId, e.detail.op.otherId);
+			break;
+		case TX_ERROR_ATM_ALREADY_CLOSED:
+			std::fprintf(out, "Error %d: Your close operation failed – ATM ID %d is already in a closed state\n",
+					e.atmId, e.detail.op.otherId);
+			break;
+		case TX_ERROR_NO_STATE:
+			std::fprintf(out, "Error %d: Your transaction failed – no bank state from %d iterations ago\n",
+					e.atmId, e.detail.op.amount);
+			break;
+		case TX_ERROR_VIP_QUEUE_FULL:
+			std::fprintf(out, "Error %d: Your transaction failed – the VIP queue is full\n", e.atmId);
+			break;
+		case TX_ERROR_PARTITION_DOWN:
+			std::fprintf(out, "Error %d: Your transaction failed – the partition of account id %d is down\n",
+					e.atmId, e.accountId);
+			break;
+		case TX_ERROR_PASSWORD_TOO_LONG:
+			std::fprintf(out, "Error %d: Your transaction failed – the password for account id %d is too long\n",
+					e.atmId, e.accountId);
+			break;
+		}
+		break;
+	}
+}
+
+bool readTxEvent(FILE* in, TxEvent& event, std::string& password) {
+	if (std::fread(&event, sizeof(event), 1, in) != 1) {
+		return false;
+	}
+	password.resize(event.tail);
+	return event.tail == 0 || std::fread(&password[0], event.tail, 1, in) == 1;
+}
+
+TransactionLog::TransactionLog(bool binary) : binary(binary) {
+	pthread_mutex_init(&mutex, nullptr);
+	file = std::fopen(binary ? "log.bin" : "log.txt", binary ? "ab" : "a"); // Append like the log always did
+}
+
+TransactionLog::~TransactionLog() {
+	if (file != nullptr) {
+		std::fclose(file);
+	}
+	pthread_mutex_destroy(&mutex);
+}
+
+void TransactionLog::record(const TxEvent& event, const char* password) {
+	if (file == nullptr) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	if (binary) {
+		size_t length = password != nullptr ? std::strlen(password) : 0;
+		if (event.type == TX_ACCOUNT_OPENED && length > TX_PASSWORD_CAPACITY) {
+			TxEvent opened = event;
+			opened.tail = static_cast<uint16_t>(length < TX_TAIL_CAPACITY ? length : TX_TAIL_CAPACITY);
+			std::fwrite(&opened, sizeof(opened), 1, file);
+			std::fwrite(password, opened.tail, 1, file);
+		} else {
+			std::fwrite(&event, sizeof(event), 1, file);
+		}
+	} else {
+		renderTxEvent(event, file, password);
+	}
+	std::fflush(file); // Keep the file complete after every transaction, as before
+	pthread_mutex_unlock(&mutex);
+}
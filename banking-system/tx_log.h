@@ -0,0 +1,105 @@
+/*
+ * tx_log.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef TX_LOG_H_
+#define TX_LOG_H_
+
+#include <cstdio>
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+
+#define TX_PASSWORD_CAPACITY 16 // Longer passwords follow their binary log record, see TxEvent::tail
+
+enum TxEventType {
+	TX_ACCOUNT_OPENED,  // accountId, balance, password
+	TX_ACCOUNT_CLOSED,  // accountId, balance
+	TX_DEPOSIT,         // accountId, amount, balance
+	TX_WITHDRAW,        // accountId, amount, balance
+	TX_BALANCE,         // accountId, balance
+	TX_TRANSFER,        // accountId -> otherId, amount, balance, otherBalance
+	TX_COMMISSION,      // accountId, amount (commission), otherId (percentage)
+	TX_ROLLBACK,        // amount (iterations)
+	TX_ATM_CLOSED,      // otherId (ATM)
+	TX_ERROR,           // error, accountId or otherId (ATM), amount
+	TX_STATEMENT,       // accountId, amount (signed change), balance, otherId, entryType (TX_ROLLBACK for a balance set by a rollback)
+	TX_LOGIN,           // accountId
+	TX_BALANCE_AT,      // accountId, balance, amount (iterations ago)
+	TX_TOTALS_AT        // otherId (accounts), balance + otherBalance (low and high half of the total), amount (iterations ago)
+};
+
+enum TxError {
+	TX_ERROR_NONE,
+	TX_ERROR_ACCOUNT_EXISTS,      // account with the same id exists
+	TX_ERROR_ACCOUNT_MISSING,     // accountId does not exist
+	TX_ERROR_WRONG_PASSWORD,      // password for accountId is incorrect
+	TX_ERROR_DEPOSIT_PASSWORD,    // deposit to accountId failed on the password
+	TX_ERROR_LOW_BALANCE,         // accountId balance is lower than amount
+	TX_ERROR_ATM_MISSING,         // ATM otherId does not exist
+	TX_ERROR_ATM_ALREADY_CLOSED,  // ATM otherId is already closed
+	TX_ERROR_NO_STATE,            // no saved state from amount iterations ago
+	TX_ERROR_VIP_QUEUE_FULL,      // a full VIP queue dropped the command
+	TX_ERROR_PARTITION_DOWN,      // the partition process owning accountId is gone
+	TX_ERROR_PASSWORD_TOO_LONG    // the password does not fit a command sent to the partitions
+};
+
+// One transaction log record. Fixed size, written as is to the binary log, followed by `tail`
+// bytes: the full password of a TX_ACCOUNT_OPENED that does not fit in detail.password.
+struct TxEvent {
+	int64_t timestamp;   // Wall clock time in nanoseconds
+	uint8_t type;        // TxEventType
+	uint8_t error;       // TxError for TX_ERROR events
+	uint16_t tail;       // Bytes following the record in the binary log, 0 in memory
+	int32_t atmId;
+	int32_t accountId;
+	int32_t balance;     // Resulting balance of accountId
+	union {
+		struct {
+			int32_t amount;
+			int32_t otherId;
+			int32_t otherBalance;
+			int32_t entryType;                // TxEventType of a TX_STATEMENT entry
+		} op;                                 // Every event but TX_ACCOUNT_OPENED
+		char password[TX_PASSWORD_CAPACITY];  // TX_ACCOUNT_OPENED, NUL terminated only when shorter, cut if longer
+	} detail;
+
+	static TxEvent make(TxEventType type, int atmId, int accountId, int amount = 0, int balance = 0);
+	static TxEvent failure(TxError error, int atmId, int accountId, int amount = 0);
+	static TxEvent atmFailure(TxError error, int sourceAtmId, int atmId);
+};
+
+static_assert(sizeof(TxEvent) == 40, "TxEvent is a fixed 40-byte record");
+
+#define TX_TAIL_CAPACITY 65535 // Longest password a binary log record carries in full
+
+// Renders an event exactly as the text log has always shown it. `password` is the full
+// password of a TX_ACCOUNT_OPENED, without it the possibly cut copy in the event is shown.
+void renderTxEvent(const TxEvent& event, FILE* out, const char* password = nullptr);
+
+// Reads the next record of a binary log, and into `password` the full password of an opening
+// (empty if the record holds all of it). False at the end of the file or on a cut record.
+bool readTxEvent(FILE* in, TxEvent& event, std::string& password);
+
+// The bank's transaction log, written either as text (log.txt) or as binary events (log.bin)
+class TransactionLog {
+private:
+	FILE* file;
+	bool binary;
+	pthread_mutex_t mutex;
+
+	TransactionLog(const TransactionLog&);            // Not copyable
+	TransactionLog& operator=(const TransactionLog&);
+
+public:
+	TransactionLog(bool binary);
+	~TransactionLog();
+
+	void record(const TxEvent& event, const char* password = nullptr); // See renderTxEvent
+	bool isBinary() const { return binary; }
+};
+
+#endif /* TX_LOG_H_ */
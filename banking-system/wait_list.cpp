@@ -0,0 +1,67 @@
+/*
+ * wait_list.cpp
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+#include "wait_list.h"
+#include <algorithm>
+
+WaitList::WaitList() : count(0) {
+	pthread_mutex_init(&mutex, nullptr);
+}
+
+WaitList::~WaitList() {
+	pthread_mutex_destroy(&mutex);
+}
+
+void WaitList::add(AccountWaiter* waiter) {
+	pthread_mutex_lock(&mutex);
+	waiters[waiter->accountId].push_back(waiter);
+	waiter->queued = true;
+	count.fetch_add(1);
+	pthread_mutex_unlock(&mutex);
+}
+
+void WaitList::cancel(AccountWaiter* waiter) {
+	pthread_mutex_lock(&mutex);
+	if (waiter->queued) {
+		std::vector<AccountWaiter*>& list = waiters[waiter->accountId];
+		list.erase(std::find(list.begin(), list.end(), waiter));
+		if (list.empty()) {
+			waiters.erase(waiter->accountId);
+		}
+		waiter->queued = false;
+		count.fetch_sub(1);
+	}
+	pthread_mutex_unlock(&mutex);
+}
+
+void WaitList::notify(int accountId, int balance) {
+	// A waiter is added before its condition is checked once more, so either that check
+	// or this notification sees the change
+	if (count.load() == 0) {
+		return;
+	}
+	pthread_mutex_lock(&mutex);
+	std::map<int, std::vector<AccountWaiter*> >::iterator it = waiters.find(accountId);
+	if (it != waiters.end()) {
+		std::vector<AccountWaiter*>& list = it->second;
+		size_t kept = 0;
+		for (size_t i = 0; i < list.size(); ++i) {
+			AccountWaiter* waiter = list[i];
+			if (balance >= waiter->minBalance) {
+				waiter->queued = false;
+				count.fetch_sub(1);
+				waiter->wake(waiter->ctx);
+			} else {
+				list[kept++] = waiter;
+			}
+		}
+		list.resize(kept);
+		if (list.empty()) {
+			waiters.erase(it);
+		}
+	}
+	pthread_mutex_unlock(&mutex);
+}
@@ -0,0 +1,49 @@
+/*
+ * wait_list.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: os
+ */
+
+#ifndef WAIT_LIST_H_
+#define WAIT_LIST_H_
+
+#include <map>
+#include <vector>
+#include <atomic>
+#include <climits>
+#include <pthread.h>
+
+#define WAIT_ACCOUNT_EXISTS INT_MIN // minBalance of a waiter that only needs the account to exist
+
+// A failed command parked until the account it needs changes. Owned by the caller,
+// which must cancel it before freeing it.
+struct AccountWaiter {
+	int accountId;
+	int minBalance;          // Woken once the account has at least this balance
+	void (*wake)(void* ctx); // Called once, under the wait list's mutex
+	void* ctx;
+	bool queued;             // Under the wait list's mutex
+};
+
+// Waiters per account id. Mutations that may satisfy a waiter (account creation,
+// deposits, transfer credits) call notify() after they release the account.
+class WaitList {
+private:
+	std::map<int, std::vector<AccountWaiter*> > waiters;
+	std::atomic<size_t> count; // Lets notify() skip the mutex when nobody waits
+	pthread_mutex_t mutex;
+
+	WaitList(const WaitList&);            // Not copyable
+	WaitList& operator=(const WaitList&);
+
+public:
+	WaitList();
+	~WaitList();
+
+	void add(AccountWaiter* waiter);
+	void cancel(AccountWaiter* waiter);        // No-op if it was woken already
+	void notify(int accountId, int balance);   // Wakes the account's waiters whose condition holds
+};
+
+#endif /* WAIT_LIST_H_ */